@@ -32,12 +32,15 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <sys/socket.h>
 #include "config.h"
 #include "proclib.h"
 #include "ipc.h"
 #include "cmd.h"
 #include "debug.h"
 #include "hashtable.h"
+#include "frozenTable.h"
 #include "xdr.h"
 #include "cmd-pkt.h"
 
@@ -45,13 +48,17 @@ struct DatareqCmd {
    struct CMD_XDRCommandInfo *cmd;
    struct DatareqCmd *next;
 };
-static struct HashTable *xdrCommandHash = NULL;
+// Commands are looked up for every received packet, so lookups go through
+//  a lock-free snapshot of the registry
+static struct FrozenTable xdrCommandTable = FT_INITIALIZER;
 static struct DatareqCmd *xdrDatareqList = NULL;
 static struct HashTable *xdrErrorHash = NULL;
 static int cleanup_reg = 0;
 
 /// Value in the PROT element in the CMD structure that indicates protected cmd
 #define CMD_PROTECTED 1
+// Events reported by the loop stats populator, keeping the response small
+#define LOOP_STATS_MAX_EVENTS 16
 
 // Code to handle multicast packet management
 struct MulticastCommand {
@@ -70,15 +77,22 @@ struct McastCommandState {
    struct McastCommandState *next;
 };
 
-struct CMDResponseCb {
+// Pending responses are matched on the ipcref and the address the command
+//  was sent to
+struct CMDResponseKey {
    uint32_t id;
-   struct sockaddr_in host;
+   in_addr_t addr;
+   in_port_t port;
+};
+
+struct CMDResponseCb {
+   struct CMDResponseKey key;
    IPC_command_callback cb;
    void *arg;
    enum IPC_CB_TYPE cb_type;
-   void *to_evt;
+   EVT_sched_handle to_evt;
    ProcessData *proc;
-   struct CMDResponseCb *next;
+   struct CMDResponseCb *next;   // Older callback registered with the same key
 };
 
 struct DataReqParams {
@@ -95,28 +109,46 @@ struct Command {
    uint32_t uid, group, prot;
 };
 
+// Datagrams received per cmd_handler_cb call unless set with
+//  CMD_set_recv_batch
+#define CMD_RECV_BATCH 16
+#define CMD_RECV_BATCH_MAX 1024
+
+// Preallocated buffers that cmd_handler_cb receives a batch of datagrams into
+struct CMDRecvRing {
+   unsigned int size;
+   unsigned char *buffs;      // size buffers of MAX_IP_PACKET_SIZE bytes
+   struct sockaddr_in *addrs;
+   size_t *lens;
+#ifdef __linux__
+   struct mmsghdr *msgs;
+   struct iovec *iov;
+#endif
+};
+
 struct CommandCbArg {
    struct Command *cmds;
    struct McastCommandState *mcast;
    struct ProcessData *proc;
-   struct CMDResponseCb *resp;
+   struct HashTable *resp;    // CMDResponseCb chains, keyed by CMDResponseKey
+   unsigned int respCount;    // Callbacks in resp, including chained ones
    struct IPC_Heartbeat beats;
+   struct CMDRecvRing recv;
+   unsigned int recvBatch;    // Ring size to use on the next read
 };
 
 struct CMD_XDRCommandInfo *CMD_xdr_cmd_by_number(uint32_t num);
 static void fakeStatusCommand(int socket, unsigned char cmd, void * data,
       size_t dataLen, struct sockaddr_in * src);
 
-static ProcessData *cmdGProc = NULL;
+static __thread ProcessData *cmdGProc = NULL;
 
 static void CMD_hash_cleanup(void)
 {
    struct DatareqCmd *node;
    cleanup_reg = 0;
 
-   if (xdrCommandHash)
-      HASH_free_table(xdrCommandHash);
-   xdrCommandHash = NULL;
+   FT_clear(&xdrCommandTable);
 
    if (xdrErrorHash)
       HASH_free_table(xdrErrorHash);
@@ -139,6 +171,78 @@ void heartbeat_populator(void *arg, XDR_tx_struct cb, void *cb_args)
    cb(&cmds->beats, cb_args, IPC_RESULTCODE_SUCCESS);
 }
 
+struct LoopStatsEvents {
+   struct IPC_EventStats events[LOOP_STATS_MAX_EVENTS];
+   int length;
+};
+
+// Keeps the events with the longest single callback call, sorted longest
+//  first
+static void loop_stats_event_cb(void *arg, const char *name, int fd,
+      int event, const struct EVTEventStats *stats)
+{
+   struct LoopStatsEvents *list = (struct LoopStatsEvents*)arg;
+   struct IPC_EventStats *dst;
+   int i;
+
+   if (!stats->duration.count)
+      return;
+
+   for (i = list->length; i > 0; i--)
+      if (list->events[i - 1].max_usec >= stats->duration.max_usec)
+         break;
+   if (i == LOOP_STATS_MAX_EVENTS)
+      return;
+
+   if (list->length < LOOP_STATS_MAX_EVENTS)
+      list->length++;
+   memmove(&list->events[i + 1], &list->events[i],
+         (list->length - i - 1) * sizeof(struct IPC_EventStats));
+
+   dst = &list->events[i];
+   dst->name = (char*)name;
+   dst->fd = fd;
+   dst->event = event;
+   dst->count = stats->duration.count;
+   dst->total_usec = stats->duration.total_usec;
+   dst->max_usec = stats->duration.max_usec;
+   dst->max_late_usec = stats->lateness.max_usec;
+   dst->buckets = EVT_HIST_BUCKETS;
+   dst->duration = (uint32_t*)stats->duration.buckets;
+   dst->lateness = (uint32_t*)stats->lateness.buckets;
+}
+
+void loop_stats_populator(void *arg, XDR_tx_struct cb, void *cb_args)
+{
+   struct CommandCbArg *cmds = (struct CommandCbArg*)arg;
+   struct IPC_LoopStats resp;
+   struct LoopStatsEvents list;
+   struct EVTLoopStats stats;
+   EVTHandler *evt;
+
+   if (!cmds || !cmds->proc)
+      return;
+   evt = PROC_evt(cmds->proc);
+
+   EVT_get_loop_stats(evt, &stats);
+   list.length = 0;
+   EVT_iterate_event_stats(evt, &loop_stats_event_cb, &list);
+
+   resp.busy_usec = stats.busy_usec;
+   resp.idle_usec = stats.idle_usec;
+   resp.loops = stats.loops;
+   resp.timed_events = stats.timed_events;
+   resp.fd_events = stats.fd_events;
+   resp.buckets = EVT_HIST_BUCKETS;
+   resp.timed_duration = stats.timed.duration.buckets;
+   resp.timed_lateness = stats.timed.lateness.buckets;
+   resp.fd_duration = stats.fd.duration.buckets;
+   resp.length = list.length;
+   resp.events = list.events;
+
+   cb(&resp, cb_args, IPC_RESULTCODE_SUCCESS);
+}
+
 void data_req_populate_cb(void *data, void *arg, uint32_t error)
 {
    struct DataReqParams *params;
@@ -379,6 +483,63 @@ void cmd_remove_multicast_handler(struct CommandCbArg *st,
    }
 }
 
+static size_t cmd_resp_hash_func(void *key)
+{
+   struct CMDResponseKey *k = (struct CMDResponseKey*)key;
+
+   return k->id ^ ((size_t)k->addr << 16) ^ k->port;
+}
+
+static int cmd_resp_cmp_keys(void *key1, void *key2)
+{
+   struct CMDResponseKey *k1 = (struct CMDResponseKey*)key1;
+   struct CMDResponseKey *k2 = (struct CMDResponseKey*)key2;
+
+   return k1->id == k2->id && k1->addr == k2->addr && k1->port == k2->port;
+}
+
+static void *cmd_resp_key_for_data(void *data)
+{
+   return &((struct CMDResponseCb*)data)->key;
+}
+
+// Removes a pending response from the table.  When another callback was
+//  registered with the same key it takes the removed one's place.
+static void cmd_resp_unlink(struct CommandCbArg *cmds,
+      struct CMDResponseCb *state)
+{
+   struct CMDResponseCb **itr, *head;
+
+   head = HASH_find_key(cmds->resp, &state->key);
+   if (head == state) {
+      // Swapping in the next callback in place can't fail, unlike adding it
+      //  back after a removal
+      if (state->next)
+         HASH_replace_data(cmds->resp, state->next);
+      else
+         HASH_remove_key(cmds->resp, &state->key);
+      return;
+   }
+
+   for (itr = head ? &head->next : NULL; itr && *itr; itr = &(*itr)->next) {
+      if (*itr == state) {
+         *itr = state->next;
+         break;
+      }
+   }
+}
+
+static void cmd_resp_free_chain(void *data)
+{
+   struct CMDResponseCb *state = (struct CMDResponseCb*)data, *next;
+
+   for (; state; state = next) {
+      next = state->next;
+      EVT_sched_remove_handle(PROC_evt(state->proc), state->to_evt);
+      free(state);
+   }
+}
+
 void cmd_cleanup_cb_state(struct CommandCbArg *st, struct EventState *evt_loop)
 {
    struct McastCommandState *state;
@@ -404,6 +565,12 @@ void cmd_cleanup_cb_state(struct CommandCbArg *st, struct EventState *evt_loop)
       st->mcast = state->next;
       free(state);
    }
+
+   // Outstanding commands are dropped without calling their callbacks
+   HASH_extract(st->resp, &cmd_resp_free_chain);
+   HASH_free_table(st->resp);
+   st->resp = NULL;
+   st->respCount = 0;
 }
 
 // Structure to hold a single command
@@ -483,6 +650,7 @@ int cmd_handler_init(const char * procName, struct ProcessData *proc,
 
    CMD_set_xdr_cmd_handler(IPC_CMDS_DATA_REQ, &cmd_handle_data_req, cmds);
    XDR_register_populator(&heartbeat_populator, cmds, IPC_TYPES_HEARTBEAT);
+   XDR_register_populator(&loop_stats_populator, cmds, IPC_TYPES_LOOP_STATS);
    cmds->proc = proc;
    if (procName) {
       sprintf(cfgFile, "./%s.cmd.cfg", procName);
@@ -537,7 +705,7 @@ int cmd_handler_init(const char * procName, struct ProcessData *proc,
 
 int CMD_pending_responses(struct CommandCbArg *cmds)
 {
-   return cmds->resp != NULL;
+   return cmds->respCount > 0;
 }
 
 static void cmd_handle_xdr_response(ProcessData *proc,
@@ -545,107 +713,219 @@ static void cmd_handle_xdr_response(ProcessData *proc,
 {
    struct IPC_ResponseHeader hdr;
    size_t len = 0;
-   struct CMDResponseCb **itr, *state = NULL;
+   struct CMDResponseKey key;
+   struct CMDResponseCb *state;
 
    if (IPC_ResponseHeader_decode(data, &hdr, &len, dataLen, NULL) < 0)
       return;
    if (hdr.cmd != IPC_CMDS_RESPONSE)
       return;
 
-   for (itr = &proc->cmds->resp; itr && (*itr); itr = &(*itr)->next) {
-      if ((*itr)->id == hdr.ipcref && (*itr)->host.sin_port == src->sin_port &&
-            (*itr)->host.sin_addr.s_addr == src->sin_addr.s_addr ) {
-         state = *itr;
-         *itr = state->next;
-         break;
-      }
-   }
-
+   memset(&key, 0, sizeof(key));
+   key.id = hdr.ipcref;
+   key.addr = src->sin_addr.s_addr;
+   key.port = src->sin_port;
+   state = HASH_find_key(proc->cmds->resp, &key);
    if (!state)
       return;
+   cmd_resp_unlink(proc->cmds, state);
+   proc->cmds->respCount--;
 
    CMD_resolve_callback(proc, state->cb, state->arg, state->cb_type,
          data, dataLen);
 
-   if (state->to_evt) {
-      EVT_sched_remove(PROC_evt(proc), state->to_evt);
-      state->to_evt = NULL;
-   }
+   EVT_sched_remove_handle(PROC_evt(proc), state->to_evt);
 
    free(state);
 }
 
-int cmd_handler_cb(int socket, char type, void * arg)
+// Handles a single datagram received on the command socket
+static void cmd_dispatch_packet(ProcessData *proc, int socket,
+      unsigned char *data, size_t dataLen, struct sockaddr_in *src)
 {
-   ProcessData *proc = (ProcessData*)arg;
-   unsigned char data[MAX_IP_PACKET_SIZE];
    struct Command *cmd = NULL;
    struct CommandCbArg *cmds = proc->cmds;
-   size_t dataLen, used = 0;
-   struct sockaddr_in src;
+   size_t used = 0;
    struct IPC_Command xdr_cmd;
    struct CMD_XDRCommandInfo *cmd_info;
    uint32_t cmd_num;
-   data[0] = 0;
+
+   // Command 0 was never used.  Now it is used to tell the difference
+   //  between the old command format and the newer XDR format
+   if (*data == 0) {
+      if (XDR_decode_uint32((char*)data, &cmd_num,
+               &used, dataLen, NULL) < 0)
+         DBG_print(DBG_LEVEL_WARN, "Failed to decode XDR uint32 of "
+               "length %lu\n", dataLen);
+      if (cmd_num == IPC_CMDS_RESPONSE) {
+         cmds->beats.responses++;
+         cmd_handle_xdr_response(proc, (char*)data, dataLen, src);
+      }
+      else if (IPC_Command_decode((char*)data, &xdr_cmd,
+               &used, dataLen, NULL) < 0) {
+         cmds->beats.commands++;
+         DBG_print(DBG_LEVEL_WARN, "Failed to decode XDR command of "
+               "length %lu\n", dataLen);
+      }
+      else {
+         cmds->beats.commands++;
+         cmd_info = CMD_xdr_cmd_by_number(xdr_cmd.cmd);
+         if (cmd_info && cmd_info->handler)
+            cmd_info->handler(cmds->proc, &xdr_cmd, src,
+                  cmd_info->arg, socket);
+         else if (cmd_info)
+            IPC_error(proc, &xdr_cmd, IPC_RESULTCODE_UNSUPPORTED, src);
+
+         XDR_free_union(&xdr_cmd.parameters);
+      }
+   }
+   else {
+      cmds->beats.commands++;
+      cmd = cmds->cmds + *data;
+      DBG_print(DBG_LEVEL_INFO, "Received command 0x%02x (%d - %d)",
+                                 *data, cmd->uid, cmd->group);
+
+      // Check to see if command is protected
+      if (cmd->prot == CMD_PROTECTED) {
+         //NOTE(Joshua Anderson): Cryptography support was reomved for now, so this is now a No-OP.
+         DBG_print(DBG_LEVEL_WARN, "Protected commands are not supported\n");
+      } else {
+         // Un-protected command, nothing out of the ordinary here
+         (*(cmd->cmd_cb))(socket, *data, data+1, dataLen-1, src);
+      }
+   }
+}
+
+static void cmd_recv_ring_free(struct CMDRecvRing *ring)
+{
+   free(ring->buffs);
+   free(ring->addrs);
+   free(ring->lens);
+#ifdef __linux__
+   free(ring->msgs);
+   free(ring->iov);
+#endif
+   memset(ring, 0, sizeof(*ring));
+}
+
+// Sizes the receive ring for the requested batch.  Only called between
+//  batches so handlers can change the batch size safely.
+static int cmd_recv_ring_resize(struct CommandCbArg *cmds)
+{
+   struct CMDRecvRing *ring = &cmds->recv;
+   unsigned int i, size = cmds->recvBatch ? cmds->recvBatch : CMD_RECV_BATCH;
+
+   if (ring->size == size)
+      return 0;
+
+   cmd_recv_ring_free(ring);
+   // Buffers are only touched as far as datagrams fill them, so unused
+   //  space in large buffers costs address space rather than memory
+   ring->buffs = malloc((size_t)size * MAX_IP_PACKET_SIZE);
+   ring->addrs = malloc(size * sizeof(*ring->addrs));
+   ring->lens = malloc(size * sizeof(*ring->lens));
+   if (!ring->buffs || !ring->addrs || !ring->lens) {
+      cmd_recv_ring_free(ring);
+      return -1;
+   }
+
+#ifdef __linux__
+   ring->msgs = malloc(size * sizeof(*ring->msgs));
+   ring->iov = malloc(size * sizeof(*ring->iov));
+   if (!ring->msgs || !ring->iov) {
+      cmd_recv_ring_free(ring);
+      return -1;
+   }
+
+   for (i = 0; i < size; i++) {
+      ring->iov[i].iov_base = ring->buffs + (size_t)i * MAX_IP_PACKET_SIZE;
+      ring->iov[i].iov_len = MAX_IP_PACKET_SIZE;
+   }
+#else
+   (void)i;
+#endif
+   ring->size = size;
+
+   return 0;
+}
+
+// Receives up to a ring's worth of datagrams.  Returns the number received.
+static int cmd_recv_batch(int socket, struct CMDRecvRing *ring)
+{
+#ifdef __linux__
+   int i, cnt;
+
+   // recvmmsg overwrites the lengths, so reset the headers for every batch
+   for (i = 0; i < (int)ring->size; i++) {
+      memset(&ring->msgs[i].msg_hdr, 0, sizeof(ring->msgs[i].msg_hdr));
+      ring->msgs[i].msg_hdr.msg_name = &ring->addrs[i];
+      ring->msgs[i].msg_hdr.msg_namelen = sizeof(ring->addrs[i]);
+      ring->msgs[i].msg_hdr.msg_iov = &ring->iov[i];
+      ring->msgs[i].msg_hdr.msg_iovlen = 1;
+   }
+
+   cnt = recvmmsg(socket, ring->msgs, ring->size, MSG_DONTWAIT, NULL);
+   if (cnt <= 0) {
+      if (cnt < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+         ERRNO_WARN("cmd_handler_cb - recvmmsg\n");
+      return cnt;
+   }
+
+   for (i = 0; i < cnt; i++)
+      ring->lens[i] = ring->msgs[i].msg_len;
+
+   return cnt;
+#else
+   int len;
+
+   len = socket_read(socket, ring->buffs, MAX_IP_PACKET_SIZE, &ring->addrs[0]);
+   if (len < 0)
+      return len;
+   ring->lens[0] = len;
+   return 1;
+#endif
+}
+
+int cmd_handler_cb(int socket, char type, void * arg)
+{
+   ProcessData *proc = (ProcessData*)arg;
+   struct CommandCbArg *cmds = proc->cmds;
+   struct CMDRecvRing *ring = &cmds->recv;
+   int cnt, i;
    cmdGProc = proc;
 
    // should only be read events, but make sure
-   if (type == EVENT_FD_READ) {
-      // read from the socket to get the command and it's data
-      dataLen = socket_read(socket, data, MAX_IP_PACKET_SIZE, &src);
+   if (type != EVENT_FD_READ)
+      return EVENT_KEEP;
+
+   if (cmd_recv_ring_resize(cmds) < 0) {
+      DBG_print(DBG_LEVEL_WARN, "Failed to allocate command receive ring\n");
+      return EVENT_KEEP;
+   }
 
+   // read a batch of commands from the socket and handle them in order
+   cnt = cmd_recv_batch(socket, ring);
+   for (i = 0; i < cnt; i++) {
       // make sure something was actually read
-      if (dataLen > 0) {
-         // Command 0 was never used.  Now it is used to tell the difference
-         //  between the old command format and the newer XDR format
-         if (*data == 0) {
-            if (XDR_decode_uint32((char*)data, &cmd_num,
-                     &used, dataLen, NULL) < 0)
-               DBG_print(DBG_LEVEL_WARN, "Failed to decode XDR uint32 of "
-                     "length %lu\n", dataLen);
-            if (cmd_num == IPC_CMDS_RESPONSE) {
-               cmds->beats.responses++;
-               cmd_handle_xdr_response(proc, (char*)data, dataLen, &src);
-            }
-            else if (IPC_Command_decode((char*)data, &xdr_cmd,
-                     &used, dataLen, NULL) < 0) {
-               cmds->beats.commands++;
-               DBG_print(DBG_LEVEL_WARN, "Failed to decode XDR command of "
-                     "length %lu\n", dataLen);
-            }
-            else {
-               cmds->beats.commands++;
-               cmd_info = CMD_xdr_cmd_by_number(xdr_cmd.cmd);
-               if (cmd_info && cmd_info->handler)
-                  cmd_info->handler(cmds->proc, &xdr_cmd, &src,
-                        cmd_info->arg, socket);
-               else if (cmd_info)
-                  IPC_error(proc, &xdr_cmd, IPC_RESULTCODE_UNSUPPORTED, &src);
-
-               XDR_free_union(&xdr_cmd.parameters);
-            }
-         }
-         else {
-            cmds->beats.commands++;
-            cmd = cmds->cmds + *data;
-            DBG_print(DBG_LEVEL_INFO, "Received command 0x%02x (%d - %d)",
-                                       *data, cmd->uid, cmd->group);
-
-            // Check to see if command is protected
-            if (cmd->prot == CMD_PROTECTED) {
-               //NOTE(Joshua Anderson): Cryptography support was reomved for now, so this is now a No-OP.
-               DBG_print(DBG_LEVEL_WARN, "Protected commands are not supported\n");
-            } else {
-               // Un-protected command, nothing out of the ordinary here
-               (*(cmd->cmd_cb))(socket, *data, data+1, dataLen-1, &src);
-            }
-         }
-      }
+      if (ring->lens[i] > 0)
+         cmd_dispatch_packet(proc, socket,
+               ring->buffs + (size_t)i * MAX_IP_PACKET_SIZE, ring->lens[i],
+               &ring->addrs[i]);
    }
 
    return EVENT_KEEP;
 }
 
+int CMD_set_recv_batch(struct CommandCbArg *cmds, unsigned int count)
+{
+   if (!cmds || count < 1 || count > CMD_RECV_BATCH_MAX)
+      return -1;
+
+   // The ring is resized before the next read
+   cmds->recvBatch = count;
+   return 0;
+}
+
 int tx_cmd_handler_cb(int socket, char type, void * arg)
 {
    unsigned char data[MAX_IP_PACKET_SIZE];
@@ -694,6 +974,8 @@ void cmd_handler_cleanup(struct CommandCbArg **goner)
    if (cmds && cmds->cmds) {
       free(cmds->cmds);
    }
+   if (cmds)
+      cmd_recv_ring_free(&cmds->recv);
    free(cmds);
    *goner = NULL;
 }
@@ -762,8 +1044,10 @@ static int cmd_hash_by_name(void *data, void *arg)
    struct CMD_HashByName_Args *p = (struct CMD_HashByName_Args*)arg;
    struct CMD_XDRCommandInfo *cmd = (struct CMD_XDRCommandInfo*)data;
 
-   if (cmd->name && 0 == strcasecmp(cmd->name, p->name))
+   if (cmd->name && 0 == strcasecmp(cmd->name, p->name)) {
       p->result = cmd;
+      return 1;
+   }
 
    return 0;
 }
@@ -773,8 +1057,7 @@ struct CMD_XDRCommandInfo *CMD_xdr_cmd_by_name(const char *name)
    struct CMD_HashByName_Args p = { name, NULL };
    struct DatareqCmd *itr;
 
-   if (xdrCommandHash)
-      HASH_iterate_arg_table(xdrCommandHash, &cmd_hash_by_name, &p);
+   FT_iterate(&xdrCommandTable, &cmd_hash_by_name, &p);
 
    for (itr = xdrDatareqList; itr && !p.result; itr = itr->next)
       if (!strcasecmp(itr->cmd->name, name))
@@ -785,13 +1068,7 @@ struct CMD_XDRCommandInfo *CMD_xdr_cmd_by_name(const char *name)
 
 struct CMD_XDRCommandInfo *CMD_xdr_cmd_by_number(uint32_t num)
 {
-   struct CMD_XDRCommandInfo *cmd = NULL;
-   
-   if (xdrCommandHash)
-      cmd = (struct CMD_XDRCommandInfo *)
-         HASH_find_key(xdrCommandHash, (void*)(intptr_t)num);
-
-   return cmd;
+   return (struct CMD_XDRCommandInfo *)FT_find(&xdrCommandTable, num);
 }
 
 int CMD_xdr_cmd_help(struct CMD_XDRCommandInfo *command)
@@ -843,7 +1120,7 @@ int CMD_mc_cmd_help(struct CMD_MulticallInfo *command)
    return 2;
 }
 
-static int print_cmd_summary(void *data)
+static int print_cmd_summary(void *data, void *arg)
 {
    struct CMD_XDRCommandInfo *xdr = (struct CMD_XDRCommandInfo*)data;
    if (xdr->name && xdr->summary)
@@ -865,10 +1142,10 @@ int CMD_usage_summary(struct CMD_MulticallInfo *mc, const char *name)
       else if (mc->name)
          printf("  \033[31m\033[1m%24s\033[0m -- UNDOCUMENTED\n", mc->name);
    }
-   HASH_iterate_table(xdrCommandHash, &print_cmd_summary);
+   FT_iterate(&xdrCommandTable, &print_cmd_summary, NULL);
 
    for (itr = xdrDatareqList; itr; itr = itr->next)
-      print_cmd_summary(itr->cmd);
+      print_cmd_summary(itr->cmd, NULL);
 
    return 1;
 }
@@ -1065,77 +1342,31 @@ void CMD_register_commands(struct CMD_XDRCommandInfo *cmd, int override)
       CMD_register_command(cmd, override);
 }
 
-static size_t xdr_cmd_hash_func(void *key)
-{
-   return (uintptr_t)key;
-}
-
-static void *xdr_cmd_key_for_data(void *data)
-{
-   if (!data)
-      return 0;
-   return (void*)(uintptr_t)(((struct CMD_XDRCommandInfo*)data)->command);
-}
-
-static int xdr_cmd_cmp_key(void *key1, void *key2)
-{
-   if ( ((uintptr_t)key1) == ((uintptr_t)key2) )
-      return 1;
-   return 0;
-}
-
 void CMD_register_command(struct CMD_XDRCommandInfo *cmd, int override)
 {
-   struct HashTable *table = NULL;
    struct DatareqCmd *node;
 
-   if (!cmd)
+   if (!cmd || (!cmd->command && !cmd->types))
       return;
 
-   if (cmd->command) {
-      if (!xdrCommandHash) {
-         if (!cleanup_reg)
-            atexit(&CMD_hash_cleanup);
-         cleanup_reg = 1;
-
-         xdrCommandHash = HASH_create_table(37, &xdr_cmd_hash_func,
-            &xdr_cmd_cmp_key, &xdr_cmd_key_for_data);
-         if (!xdrCommandHash)
-            return;
-      }
-      table = xdrCommandHash;
-   }
-   else if (cmd->types) {
-      if (!cleanup_reg)
-         atexit(&CMD_hash_cleanup);
-      cleanup_reg = 1;
-
-      node = malloc(sizeof(*node));
-      if (!node)
-         return;
-      node->next = xdrDatareqList;
-      node->cmd = cmd;
-      xdrDatareqList = node;
-
-      if (cmd->params)
-         cmd->parameter = XDR_definition_for_type(cmd->params);
-
-      return;
-   }
-   else
-      return;
+   if (!cleanup_reg)
+      atexit(&CMD_hash_cleanup);
+   cleanup_reg = 1;
 
    if (cmd->params)
       cmd->parameter = XDR_definition_for_type(cmd->params);
 
-   if (HASH_find_key(table, (void*)(intptr_t)cmd->command)) {
-      if (override) {
-         HASH_remove_key(table, (void*)(intptr_t)cmd->command);
-         HASH_add_data(table, cmd);
-      }
+   if (cmd->command) {
+      FT_insert(&xdrCommandTable, cmd->command, cmd, override);
+      return;
    }
-   else
-      HASH_add_data(table, cmd);
+
+   node = malloc(sizeof(*node));
+   if (!node)
+      return;
+   node->next = xdrDatareqList;
+   node->cmd = cmd;
+   xdrDatareqList = node;
 }
 
 void CMD_register_errors(struct CMD_ErrorInfo *errs)
@@ -1317,20 +1548,14 @@ struct IPC_OpaqueStruct CMD_struct_to_opaque_struct(void *src, uint32_t type)
 static int response_timeout_cb(void *arg)
 {
    struct CMDResponseCb *state = (struct CMDResponseCb*)arg;
-   struct CMDResponseCb **itr;
 
    if (!arg)
       return EVENT_REMOVE;
 
-   for (itr = &state->proc->cmds->resp; itr && (*itr); itr = &(*itr)->next) {
-      if (*itr == state) {
-         *itr = state->next;
-         break;
-      }
-   }
+   cmd_resp_unlink(state->proc->cmds, state);
+   state->proc->cmds->respCount--;
 
    state->cb(state->proc, 1, state->arg, NULL, 0, state->cb_type);
-   state->to_evt = NULL;
    free(state);
 
    return EVENT_REMOVE;
@@ -1341,27 +1566,44 @@ void CMD_add_response_cb(ProcessData *proc, uint32_t id,
       IPC_command_callback cb, void *arg,
       enum IPC_CB_TYPE cb_type, unsigned int timeout)
 {
-   struct CMDResponseCb *state;
+   struct CMDResponseCb *state, *prev;
    struct CommandCbArg *st = proc->cmds;
 
    if (!st)
       return;
 
+   if (!st->resp)
+      st->resp = HASH_create_table(0, &cmd_resp_hash_func,
+            &cmd_resp_cmp_keys, &cmd_resp_key_for_data);
+   if (!st->resp)
+      return;
+
    state = malloc(sizeof(*state));
+   if (!state)
+      return;
    memset(state, 0, sizeof(*state));
 
-   state->id = id;
-   state->host = host;
+   state->key.id = id;
+   state->key.addr = host.sin_addr.s_addr;
+   state->key.port = host.sin_port;
    state->cb = cb;
    state->arg = arg;
    state->cb_type = cb_type;
    state->proc = proc;
-   state->next = st->resp;
-   st->resp = state;
+
+   // The newest callback for a key is matched first
+   prev = HASH_replace_data(st->resp, state);
+   state->next = prev;
+   if (!prev && HASH_add_data(st->resp, state) < 0) {
+      free(state);
+      return;
+   }
+   st->respCount++;
 
    if (timeout)
-      state->to_evt = EVT_sched_add(PROC_evt(proc), EVT_ms2tv(timeout),
-            response_timeout_cb, state);
+      state->to_evt = EVT_sched_get_handle(PROC_evt(proc),
+            EVT_sched_add(PROC_evt(proc), EVT_ms2tv(timeout),
+               response_timeout_cb, state));
 }
 
 int CMD_set_cmd_handler(struct CommandCbArg *cmd,
@@ -96,6 +96,18 @@ int cmd_handler_cb(int socket, char type, void *arg);
 
 void cmd_handler_cleanup(struct CommandCbArg **cmds);
 
+/**
+ * Set the most datagrams cmd_handler_cb receives from the command socket
+ * per wakeup.  Each datagram in a batch has its own MAX_IP_PACKET_SIZE
+ * receive buffer.
+ *
+ * @param cmds The command state.
+ * @param count Batch size between 1 and 1024.  The default is 16.
+ *
+ * @return 0 on success, -1 if count is out of range.
+ */
+int CMD_set_recv_batch(struct CommandCbArg *cmds, unsigned int count);
+
 //look here to subscribe to multicasts
 void cmd_set_multicast_handler(struct CommandCbArg *st,
    struct EventState *evt_loop, const char *service, int cmdNum,
@@ -36,7 +36,7 @@
 
 /// Default level of debug message printing
 static int gDBGLevel = DBG_LEVEL_WARN;
-static struct EventTimer *gDBGTimer = NULL;
+static __thread struct EventTimer *gDBGTimer = NULL;
 
 // Debug output function
 void DBG_print(int level, const char *fmt, ...)
@@ -0,0 +1,667 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "events.h"
+#include "eventPoller.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_LIBURING
+#include <poll.h>
+#include <liburing.h>
+#endif
+
+struct SelectEventPoller {
+   struct EventPoller ep;
+   fd_set sets[EVENT_MAX];
+   int counts[EVENT_MAX];
+   int maxFd;
+   struct EP_ready ready[FD_SETSIZE];
+};
+
+static int ep_select_set_interest(struct EventPoller *poller, int fd,
+      unsigned int mask)
+{
+   struct SelectEventPoller *ep = (struct SelectEventPoller*)poller;
+   int event;
+
+   if (fd < 0 || fd >= FD_SETSIZE) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   for (event = 0; event < EVENT_MAX; event++) {
+      if ((mask & EP_MASK(event)) && !FD_ISSET(fd, &ep->sets[event])) {
+         FD_SET(fd, &ep->sets[event]);
+         ep->counts[event]++;
+      }
+      else if (!(mask & EP_MASK(event)) && FD_ISSET(fd, &ep->sets[event])) {
+         FD_CLR(fd, &ep->sets[event]);
+         ep->counts[event]--;
+      }
+   }
+
+   if (mask && fd > ep->maxFd)
+      ep->maxFd = fd;
+   else if (!mask && fd == ep->maxFd) {
+      // Find next highest
+      for (; ep->maxFd > 0; ep->maxFd--)
+         for (event = 0; event < EVENT_MAX; event++)
+            if (FD_ISSET(ep->maxFd, &ep->sets[event]))
+               return 0;
+   }
+
+   return 0;
+}
+
+static int ep_select_wait(struct EventPoller *poller, struct timeval *timeout,
+      struct EP_ready **ready)
+{
+   struct SelectEventPoller *ep = (struct SelectEventPoller*)poller;
+   fd_set eventSets[EVENT_MAX];
+   fd_set *eventSetPtrs[EVENT_MAX];
+   int event, fd, retval, cnt = 0;
+
+   for (event = 0; event < EVENT_MAX; event++) {
+      if (ep->counts[event] > 0) {
+         eventSetPtrs[event] = &eventSets[event];
+         memcpy(eventSetPtrs[event], &ep->sets[event], sizeof(fd_set));
+      }
+      else
+         eventSetPtrs[event] = NULL;
+   }
+
+   *ready = ep->ready;
+   retval = select(ep->maxFd + 1, eventSetPtrs[EVENT_FD_READ],
+         eventSetPtrs[EVENT_FD_WRITE], eventSetPtrs[EVENT_FD_ERROR], timeout);
+   if (retval <= 0)
+      return retval;
+
+   for (fd = 0; retval > 0 && fd <= ep->maxFd; fd++) {
+      ep->ready[cnt].events = 0;
+      for (event = 0; event < EVENT_MAX; event++) {
+         if (eventSetPtrs[event] && FD_ISSET(fd, eventSetPtrs[event])) {
+            ep->ready[cnt].events |= EP_MASK(event);
+            retval--;
+         }
+      }
+      if (ep->ready[cnt].events)
+         ep->ready[cnt++].fd = fd;
+   }
+
+   return cnt;
+}
+
+static void ep_select_cleanup(struct EventPoller *ep)
+{
+   if (ep)
+      free(ep);
+}
+
+struct EventPoller *EP_select_init(void)
+{
+   struct SelectEventPoller *ep;
+   int event;
+
+   ep = malloc(sizeof(struct SelectEventPoller));
+   if (!ep)
+      return NULL;
+   memset(ep, 0, sizeof(struct SelectEventPoller));
+
+   for (event = 0; event < EVENT_MAX; event++)
+      FD_ZERO(&ep->sets[event]);
+
+   ep->ep.name = "select";
+   ep->ep.fd_limit = FD_SETSIZE;
+   ep->ep.set_interest = &ep_select_set_interest;
+   ep->ep.wait = &ep_select_wait;
+   ep->ep.cleanup = &ep_select_cleanup;
+
+   return &ep->ep;
+}
+
+#ifdef __linux__
+
+#define EP_EPOLL_BATCH 256
+
+// Regular files can't be added to an epoll set.  select() always reports
+//  them as ready, so they are kept on a side list and reported the same way.
+struct EP_always_ready {
+   int fd;
+   unsigned int mask;
+};
+
+struct EpollEventPoller {
+   struct EventPoller ep;
+   int epfd;
+   struct epoll_event events[EP_EPOLL_BATCH];
+   struct EP_ready *ready;
+   struct EP_always_ready *always;
+   int alwaysLen, alwaysMax;
+};
+
+static int ep_epoll_set_always(struct EpollEventPoller *ep, int fd,
+      unsigned int mask)
+{
+   struct EP_always_ready *tmp;
+   int i;
+
+   for (i = 0; i < ep->alwaysLen; i++)
+      if (ep->always[i].fd == fd)
+         break;
+
+   if (!mask) {
+      if (i < ep->alwaysLen)
+         ep->always[i] = ep->always[--ep->alwaysLen];
+      return 0;
+   }
+
+   if (i == ep->alwaysLen) {
+      if (ep->alwaysLen == ep->alwaysMax) {
+         tmp = realloc(ep->always, (ep->alwaysMax + 8) * sizeof(*tmp));
+         if (!tmp)
+            return -1;
+         ep->always = tmp;
+         tmp = realloc(ep->ready,
+               (EP_EPOLL_BATCH + ep->alwaysMax + 8) * sizeof(struct EP_ready));
+         if (!tmp)
+            return -1;
+         ep->ready = (struct EP_ready*)tmp;
+         ep->alwaysMax += 8;
+      }
+      ep->alwaysLen++;
+   }
+
+   ep->always[i].fd = fd;
+   ep->always[i].mask = mask;
+
+   return 0;
+}
+
+static int ep_epoll_set_interest(struct EventPoller *poller, int fd,
+      unsigned int mask)
+{
+   struct EpollEventPoller *ep = (struct EpollEventPoller*)poller;
+   struct epoll_event ev;
+
+   if (!mask) {
+      ep_epoll_set_always(ep, fd, 0);
+      if (epoll_ctl(ep->epfd, EPOLL_CTL_DEL, fd, NULL) == -1 &&
+            errno != ENOENT && errno != EBADF)
+         return -1;
+      return 0;
+   }
+
+   memset(&ev, 0, sizeof(ev));
+   if (mask & EP_MASK(EVENT_FD_READ))
+      ev.events |= EPOLLIN;
+   if (mask & EP_MASK(EVENT_FD_WRITE))
+      ev.events |= EPOLLOUT;
+   if (mask & EP_MASK(EVENT_FD_ERROR))
+      ev.events |= EPOLLPRI;
+   if (mask & EP_EDGE)
+      ev.events |= EPOLLET;
+   if (mask & EP_ONESHOT)
+      ev.events |= EPOLLONESHOT;
+   // Carry the interest mask with the fd so readiness can be translated
+   //  without a lookup
+   ev.data.u64 = ((uint64_t)mask << 32) | (uint32_t)fd;
+
+   if (epoll_ctl(ep->epfd, EPOLL_CTL_MOD, fd, &ev) == 0)
+      return 0;
+   if (errno != ENOENT)
+      return -1;
+   if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+      return 0;
+   if (errno == EPERM)
+      return ep_epoll_set_always(ep, fd, mask);
+
+   return -1;
+}
+
+static int ep_epoll_wait(struct EventPoller *poller, struct timeval *timeout,
+      struct EP_ready **ready)
+{
+   struct EpollEventPoller *ep = (struct EpollEventPoller*)poller;
+   int i, res, cnt = 0, ms = -1;
+   unsigned int mask, events;
+
+   if (ep->alwaysLen)
+      ms = 0;
+   else if (timeout) {
+      // Round up so we never wake before the next timed event is due.
+      //  Timeouts too long for epoll_wait wake early and wait again.
+      if (timeout->tv_sec >= INT_MAX / 1000 - 1)
+         ms = INT_MAX;
+      else
+         ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+   }
+
+   *ready = ep->ready;
+   res = epoll_wait(ep->epfd, ep->events, EP_EPOLL_BATCH, ms);
+   if (res < 0)
+      return res;
+
+   for (i = 0; i < res; i++) {
+      events = ep->events[i].events;
+      mask = ep->events[i].data.u64 >> 32;
+
+      ep->ready[cnt].events = 0;
+      if (events & EPOLLIN)
+         ep->ready[cnt].events |= EP_MASK(EVENT_FD_READ);
+      if (events & EPOLLOUT)
+         ep->ready[cnt].events |= EP_MASK(EVENT_FD_WRITE);
+      if (events & EPOLLPRI)
+         ep->ready[cnt].events |= EP_MASK(EVENT_FD_ERROR);
+      // select() reports errors and hangups as readable and writable
+      if (events & (EPOLLERR | EPOLLHUP)) {
+         ep->ready[cnt].events |=
+            mask & (EP_MASK(EVENT_FD_READ) | EP_MASK(EVENT_FD_WRITE));
+         if (!ep->ready[cnt].events)
+            ep->ready[cnt].events |= mask & EP_MASK(EVENT_FD_ERROR);
+      }
+
+      ep->ready[cnt].events &= mask & ~(EP_EDGE | EP_ONESHOT);
+      if (ep->ready[cnt].events)
+         ep->ready[cnt++].fd = (int)(uint32_t)ep->events[i].data.u64;
+   }
+
+   for (i = 0; i < ep->alwaysLen; i++) {
+      ep->ready[cnt].fd = ep->always[i].fd;
+      ep->ready[cnt++].events =
+         ep->always[i].mask & ~(EP_EDGE | EP_ONESHOT);
+      // Always ready fds are disabled the same way epoll disables the rest
+      if (ep->always[i].mask & EP_ONESHOT)
+         ep->always[i--] = ep->always[--ep->alwaysLen];
+   }
+
+   return cnt;
+}
+
+static void ep_epoll_cleanup(struct EventPoller *poller)
+{
+   struct EpollEventPoller *ep = (struct EpollEventPoller*)poller;
+
+   if (!ep)
+      return;
+
+   if (ep->epfd >= 0)
+      close(ep->epfd);
+   if (ep->ready)
+      free(ep->ready);
+   if (ep->always)
+      free(ep->always);
+   free(ep);
+}
+
+struct EventPoller *EP_epoll_init(void)
+{
+   struct EpollEventPoller *ep;
+
+   ep = malloc(sizeof(struct EpollEventPoller));
+   if (!ep)
+      return NULL;
+   memset(ep, 0, sizeof(struct EpollEventPoller));
+
+   ep->ready = malloc(EP_EPOLL_BATCH * sizeof(struct EP_ready));
+   if (!ep->ready) {
+      free(ep);
+      return NULL;
+   }
+
+   ep->epfd = epoll_create1(EPOLL_CLOEXEC);
+   if (ep->epfd < 0) {
+      free(ep->ready);
+      free(ep);
+      return NULL;
+   }
+
+   ep->ep.name = "epoll";
+   ep->ep.fd_limit = 0;
+   ep->ep.native = EP_EDGE | EP_ONESHOT;
+   ep->ep.set_interest = &ep_epoll_set_interest;
+   ep->ep.wait = &ep_epoll_wait;
+   ep->ep.cleanup = &ep_epoll_cleanup;
+
+   return &ep->ep;
+}
+
+#else
+
+struct EventPoller *EP_epoll_init(void)
+{
+   errno = ENOSYS;
+   return NULL;
+}
+
+#endif
+
+#ifdef HAVE_LIBURING
+
+#define EP_URING_ENTRIES 256
+// user_data of requests whose completions are ignored
+#define EP_URING_IGNORE UINT64_MAX
+
+// Each watched fd has at most one poll request in flight.  Level-triggered
+//  fds use single-shot polls that are rearmed before every wait, so a fd
+//  that is still ready completes again immediately.  Edge-triggered fds use
+//  a multishot poll, which only completes when the fd is woken.  One-shot
+//  fds, edge-triggered or not, use a single-shot poll that isn't rearmed
+//  until their interest is set again.
+struct EP_uring_fd {
+   unsigned int mask;         // Interest, including EP_EDGE and EP_ONESHOT
+   uint32_t gen;              // Tags requests so stale completions are dropped
+   char inflight;
+   char rearm;                // Queued on the rearm list
+   uint32_t reported;         // Wait in which the fd was last reported
+   int ready_idx;
+};
+
+struct UringEventPoller {
+   struct EventPoller ep;
+   struct io_uring ring;
+   struct EP_uring_fd *fds;
+   int fdCap;
+   int *rearm;                // Level-triggered fds to poll again
+   int rearmLen;
+   struct EP_ready *ready;
+   uint32_t waits;
+};
+
+static struct io_uring_sqe *ep_uring_sqe(struct UringEventPoller *ep)
+{
+   struct io_uring_sqe *sqe = io_uring_get_sqe(&ep->ring);
+
+   // The submission queue is full, flush it and try again
+   if (!sqe && io_uring_submit(&ep->ring) >= 0)
+      sqe = io_uring_get_sqe(&ep->ring);
+   return sqe;
+}
+
+static int ep_uring_arm(struct UringEventPoller *ep, int fd)
+{
+   struct EP_uring_fd *ufd = &ep->fds[fd];
+   struct io_uring_sqe *sqe;
+   unsigned int events = 0;
+
+   if (!(sqe = ep_uring_sqe(ep))) {
+      errno = EBUSY;
+      return -1;
+   }
+
+   if (ufd->mask & EP_MASK(EVENT_FD_READ))
+      events |= POLLIN;
+   if (ufd->mask & EP_MASK(EVENT_FD_WRITE))
+      events |= POLLOUT;
+   if (ufd->mask & EP_MASK(EVENT_FD_ERROR))
+      events |= POLLPRI;
+
+   if ((ufd->mask & EP_EDGE) && !(ufd->mask & EP_ONESHOT))
+      io_uring_prep_poll_multishot(sqe, fd, events);
+   else
+      io_uring_prep_poll_add(sqe, fd, events);
+   sqe->user_data = ((uint64_t)ufd->gen << 32) | (uint32_t)fd;
+   ufd->inflight = 1;
+
+   return 0;
+}
+
+static int ep_uring_cancel(struct UringEventPoller *ep, int fd)
+{
+   struct EP_uring_fd *ufd = &ep->fds[fd];
+   struct io_uring_sqe *sqe;
+
+   if (!ufd->inflight)
+      return 0;
+   if (!(sqe = ep_uring_sqe(ep))) {
+      errno = EBUSY;
+      return -1;
+   }
+
+   // The remove request takes the user_data of the poll to cancel in addr
+   io_uring_prep_rw(IORING_OP_POLL_REMOVE, sqe, -1, NULL, 0, 0);
+   sqe->addr = ((uint64_t)ufd->gen << 32) | (uint32_t)fd;
+   sqe->user_data = EP_URING_IGNORE;
+   ufd->inflight = 0;
+
+   return 0;
+}
+
+static int ep_uring_grow(struct UringEventPoller *ep, int fd)
+{
+   struct EP_uring_fd *fds;
+   int *rearm, cap = ep->fdCap ? ep->fdCap : 64;
+   struct EP_ready *ready;
+
+   while (cap <= fd)
+      cap *= 2;
+
+   fds = realloc(ep->fds, cap * sizeof(*fds));
+   if (!fds)
+      return -1;
+   memset(&fds[ep->fdCap], 0, (cap - ep->fdCap) * sizeof(*fds));
+   ep->fds = fds;
+
+   // Every fd is reported and rearmed at most once per wait
+   rearm = realloc(ep->rearm, cap * sizeof(*rearm));
+   if (!rearm)
+      return -1;
+   ep->rearm = rearm;
+   ready = realloc(ep->ready, cap * sizeof(*ready));
+   if (!ready)
+      return -1;
+   ep->ready = ready;
+   ep->fdCap = cap;
+
+   return 0;
+}
+
+static int ep_uring_set_interest(struct EventPoller *poller, int fd,
+      unsigned int mask)
+{
+   struct UringEventPoller *ep = (struct UringEventPoller*)poller;
+   struct EP_uring_fd *ufd;
+
+   if (fd < 0 || (fd >= ep->fdCap && !mask))
+      return 0;
+   if (fd >= ep->fdCap && ep_uring_grow(ep, fd) < 0)
+      return -1;
+   ufd = &ep->fds[fd];
+
+   // Replace any outstanding poll.  Completions for it carry the old
+   //  generation and are dropped.
+   if (ep_uring_cancel(ep, fd) < 0)
+      return -1;
+   ufd->gen++;
+   ufd->mask = mask;
+   if (!mask)
+      return 0;
+
+   return ep_uring_arm(ep, fd);
+}
+
+static int ep_uring_wait(struct EventPoller *poller, struct timeval *timeout,
+      struct EP_ready **ready)
+{
+   struct UringEventPoller *ep = (struct UringEventPoller*)poller;
+   struct __kernel_timespec ts;
+   struct io_uring_cqe *cqe;
+   struct EP_uring_fd *ufd;
+   struct EP_ready *entry;
+   unsigned int head, seen = 0, events;
+   int i, fd, res, cnt = 0;
+
+   // Poll the level-triggered fds reported last time again.  The requests
+   //  are submitted by the same io_uring_enter that waits.
+   for (i = 0; i < ep->rearmLen; i++) {
+      ufd = &ep->fds[ep->rearm[i]];
+      ufd->rearm = 0;
+      if (ufd->mask && !ufd->inflight && ep_uring_arm(ep, ep->rearm[i]) < 0)
+         return -1;
+   }
+   ep->rearmLen = 0;
+
+   if (timeout) {
+      ts.tv_sec = timeout->tv_sec;
+      ts.tv_nsec = timeout->tv_usec * 1000;
+   }
+   res = io_uring_submit_and_wait_timeout(&ep->ring, &cqe, 1,
+         timeout ? &ts : NULL, NULL);
+   if (res < 0 && res != -ETIME && res != -EINTR) {
+      errno = -res;
+      return -1;
+   }
+
+   *ready = ep->ready;
+   ep->waits++;
+
+   io_uring_for_each_cqe(&ep->ring, head, cqe) {
+      seen++;
+      if (cqe->user_data == EP_URING_IGNORE)
+         continue;
+      fd = (int)(uint32_t)cqe->user_data;
+      if (fd >= ep->fdCap)
+         continue;
+      ufd = &ep->fds[fd];
+      if (ufd->gen != (uint32_t)(cqe->user_data >> 32) || !ufd->mask)
+         continue;
+
+      if (!(cqe->flags & IORING_CQE_F_MORE)) {
+         ufd->inflight = 0;
+         // One-shot fds stay disarmed until their interest is set again
+         if (!(ufd->mask & EP_ONESHOT) && !ufd->rearm) {
+            ufd->rearm = 1;
+            ep->rearm[ep->rearmLen++] = fd;
+         }
+      }
+      if (cqe->res == -ECANCELED)
+         continue;
+
+      // Errors, such as a closed fd, are reported like select() does
+      events = cqe->res < 0 ? POLLERR : (unsigned int)cqe->res;
+      if (ufd->reported != ep->waits) {
+         ufd->reported = ep->waits;
+         ufd->ready_idx = cnt;
+         ep->ready[cnt].fd = fd;
+         ep->ready[cnt++].events = 0;
+      }
+      entry = &ep->ready[ufd->ready_idx];
+
+      if (events & POLLIN)
+         entry->events |= EP_MASK(EVENT_FD_READ);
+      if (events & POLLOUT)
+         entry->events |= EP_MASK(EVENT_FD_WRITE);
+      if (events & POLLPRI)
+         entry->events |= EP_MASK(EVENT_FD_ERROR);
+      if (events & (POLLERR | POLLHUP | POLLNVAL)) {
+         entry->events |=
+            ufd->mask & (EP_MASK(EVENT_FD_READ) | EP_MASK(EVENT_FD_WRITE));
+         if (!entry->events)
+            entry->events |= ufd->mask & EP_MASK(EVENT_FD_ERROR);
+      }
+      entry->events &= ufd->mask & ~(EP_EDGE | EP_ONESHOT);
+   }
+   io_uring_cq_advance(&ep->ring, seen);
+
+   // Drop fds whose completions didn't include a watched event
+   for (i = 0; i < cnt; ) {
+      if (!ep->ready[i].events) {
+         ep->ready[i] = ep->ready[--cnt];
+         continue;
+      }
+      i++;
+   }
+
+   return cnt;
+}
+
+static void ep_uring_cleanup(struct EventPoller *poller)
+{
+   struct UringEventPoller *ep = (struct UringEventPoller*)poller;
+
+   if (!ep)
+      return;
+
+   io_uring_queue_exit(&ep->ring);
+   free(ep->fds);
+   free(ep->rearm);
+   free(ep->ready);
+   free(ep);
+}
+
+struct EventPoller *EP_uring_init(void)
+{
+   struct UringEventPoller *ep;
+   int res;
+
+   ep = malloc(sizeof(struct UringEventPoller));
+   if (!ep)
+      return NULL;
+   memset(ep, 0, sizeof(struct UringEventPoller));
+
+   res = io_uring_queue_init(EP_URING_ENTRIES, &ep->ring, 0);
+   if (res < 0) {
+      free(ep);
+      errno = -res;
+      return NULL;
+   }
+
+   // Waiting with a timeout in a single io_uring_enter needs EXT_ARG
+   if (!(ep->ring.features & IORING_FEAT_EXT_ARG) ||
+         ep_uring_grow(ep, 0) < 0) {
+      ep_uring_cleanup(&ep->ep);
+      errno = ENOSYS;
+      return NULL;
+   }
+
+   ep->ep.name = "io_uring";
+   ep->ep.fd_limit = 0;
+   ep->ep.native = EP_EDGE | EP_ONESHOT;
+   ep->ep.set_interest = &ep_uring_set_interest;
+   ep->ep.wait = &ep_uring_wait;
+   ep->ep.cleanup = &ep_uring_cleanup;
+
+   return &ep->ep;
+}
+
+#else
+
+struct EventPoller *EP_uring_init(void)
+{
+   errno = ENOSYS;
+   return NULL;
+}
+
+#endif
+
+struct EventPoller *EP_default_init(void)
+{
+   struct EventPoller *ep = EP_epoll_init();
+
+   if (!ep)
+      ep = EP_select_init();
+
+   return ep;
+}
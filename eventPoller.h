@@ -0,0 +1,134 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _EVENT_POLLER_H_
+#define _EVENT_POLLER_H_
+
+#include <sys/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Bit used in poller interest and readiness masks for the given
+ * EVENT_FD_* event type.
+ */
+#define EP_MASK(event) (1u << (event))
+
+/**
+ * Interest mask modifiers.  EP_EDGE only reports a fd when it becomes
+ * ready.  EP_ONESHOT stops reporting a fd after it has been reported once,
+ * until its interest is set again.
+ */
+#define EP_EDGE (1u << 6)
+#define EP_ONESHOT (1u << 7)
+
+/**
+ * A single ready file descriptor, as reported by an EventPoller.
+ */
+struct EP_ready {
+   int fd;
+   unsigned int events;    // Mask of ready EVENT_FD_* types, see EP_MASK
+};
+
+/**
+ * The EventPoller abstraction separates the event loop from the kernel
+ * interface used to wait for file descriptor readiness.  The event loop
+ * tells the poller which event types it is interested in for each fd, and
+ * the poller reports the ready subset when asked to wait.
+ *
+ * There are three EventPoller implementations provided, the select poller,
+ * the epoll poller and the io_uring poller.  The select poller works
+ * everywhere but is limited to FD_SETSIZE descriptors and scans every
+ * descriptor on each wakeup.  The epoll poller is the default on Linux and
+ * only reports active descriptors.  The io_uring poller is only built when
+ * liburing is installed.  It submits poll requests and waits for their
+ * completions, with the timeout, in a single system call.
+ */
+struct EventPoller {
+   /**
+    * Short human readable name of the implementation.
+    */
+   const char *name;
+
+   /**
+    * File descriptors greater than or equal to this limit can not be
+    * watched.  0 if there is no limit.
+    */
+   int fd_limit;
+
+   /**
+    * The EP_EDGE and EP_ONESHOT modifiers the poller implements.  Pollers
+    * ignore the modifiers they don't implement and the event loop emulates
+    * them.
+    */
+   unsigned int native;
+
+   /**
+    * Replace the set of event types watched on a file descriptor.  A mask
+    * of 0 stops watching the fd entirely.  Setting the same mask again
+    * rearms a fd disabled by EP_ONESHOT.
+    *
+    * @return 0 on success, -1 on failure with errno set.
+    */
+   int (*set_interest)(struct EventPoller *ep, int fd, unsigned int mask);
+
+   /**
+    * Block until at least one watched fd is ready or the timeout elapses.
+    * A NULL timeout blocks indefinitely.  The array of ready fds is owned
+    * by the poller and is valid until the next call to wait.
+    *
+    * @return The number of entries in ready, or -1 on error with errno set.
+    */
+   int (*wait)(struct EventPoller *ep, struct timeval *timeout,
+         struct EP_ready **ready);
+
+   /**
+    * Cleanup the event poller.
+    */
+   void (*cleanup)(struct EventPoller *ep);
+};
+
+/**
+ * Create a select(2) based event poller.
+ */
+struct EventPoller *EP_select_init(void);
+
+/**
+ * Create an epoll(7) based event poller.  Returns NULL on platforms
+ * without epoll.
+ */
+struct EventPoller *EP_epoll_init(void);
+
+/**
+ * Create an io_uring based event poller.  Returns NULL when libproc was
+ * built without liburing or the kernel lacks the features it needs.
+ */
+struct EventPoller *EP_uring_init(void);
+
+/**
+ * Create the best event poller available on this platform.
+ */
+struct EventPoller *EP_default_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
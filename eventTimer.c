@@ -23,6 +23,11 @@
 #include <string.h>
 #include <sys/select.h>
 #include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
 
 static void et_virt_inc_time(struct EventTimer *et, struct timeval *time);
 static void et_virt_set_time(struct EventTimer *et, struct timeval *time);
@@ -201,6 +206,108 @@ struct EventTimer *ET_rtdebug_init()
    return &et->et;
 }
 
+#ifdef __linux__
+
+struct TimerfdEventTimer {
+   struct EventTimer et;
+   int fd;
+   char armed;
+   struct timeval armedAt;
+};
+
+int ET_timerfd_block(struct EventTimer *timer, struct timeval *nextAwake,
+      int pauseWhileBlocking, ET_block_cb blockcb, void *arg)
+{
+   struct TimerfdEventTimer *et = (struct TimerfdEventTimer *)timer;
+   struct itimerspec its;
+   struct timeval curTime, zero = { 0, 0 };
+
+   // The event loop couldn't watch the timerfd
+   if (!et->et.wake_fd)
+      return ET_default_block(&et->et, nextAwake, pauseWhileBlocking,
+            blockcb, arg);
+
+   memset(&its, 0, sizeof(its));
+
+   if (!nextAwake) {
+      if (et->armed && timerfd_settime(et->fd, TFD_TIMER_ABSTIME, &its, NULL)
+            == 0)
+         et->armed = 0;
+      return blockcb(&et->et, NULL, arg);
+   }
+
+   ET_default_monotonic(NULL, &curTime);
+   if (!timercmp(nextAwake, &curTime, >))
+      return blockcb(&et->et, &zero, arg);
+
+   // The timer is only reprogrammed when the deadline changes
+   if (!et->armed || timercmp(&et->armedAt, nextAwake, !=)) {
+      its.it_value.tv_sec = nextAwake->tv_sec;
+      its.it_value.tv_nsec = nextAwake->tv_usec * 1000;
+      if (timerfd_settime(et->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+         et->armed = 0;
+         return ET_default_block(&et->et, nextAwake, pauseWhileBlocking,
+               blockcb, arg);
+      }
+      et->armed = 1;
+      et->armedAt = *nextAwake;
+   }
+
+   // The timerfd wakes the poller, so no timeout is needed
+   return blockcb(&et->et, NULL, arg);
+}
+
+int ET_timerfd_wake_fd(struct EventTimer *timer)
+{
+   return ((struct TimerfdEventTimer *)timer)->fd;
+}
+
+void ET_timerfd_cleanup(struct EventTimer *timer)
+{
+   struct TimerfdEventTimer *et = (struct TimerfdEventTimer *)timer;
+
+   if (!et)
+      return;
+
+   if (et->fd >= 0)
+      close(et->fd);
+   free(et);
+}
+
+struct EventTimer *ET_timerfd_init()
+{
+   struct TimerfdEventTimer *et;
+
+   et = malloc(sizeof(struct TimerfdEventTimer));
+   if (!et)
+      return NULL;
+   memset(et, 0, sizeof(struct TimerfdEventTimer));
+
+   et->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (et->fd < 0) {
+      free(et);
+      return NULL;
+   }
+
+   et->et.block = &ET_timerfd_block;
+   et->et.get_gmt_time = &ET_default_gmt;
+   et->et.get_monotonic_time = &ET_default_monotonic;
+   et->et.cleanup = &ET_timerfd_cleanup;
+   et->et.wake_fd = &ET_timerfd_wake_fd;
+
+   return &et->et;
+}
+
+#else
+
+struct EventTimer *ET_timerfd_init()
+{
+   errno = ENOSYS;
+   return NULL;
+}
+
+#endif
+
 struct VirtualEventTimer {
    struct EventTimer et;
    struct timeval time;
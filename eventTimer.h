@@ -116,6 +116,14 @@ struct EventTimer {
     * @return VIRT_CLK_PAUSED or VIRT_CLK_ACTIVE.
     */
    char (*virt_get_pause)(struct EventTimer *et);
+
+   /**
+    * Optional.  Return a file descriptor that becomes readable when the
+    * nextAwake time passed to block is reached.  The event loop watches
+    * the fd along with its other fds and reads it when it is readable, so
+    * block doesn't need to pass a timeout to the block callback.
+    */
+   int (*wake_fd)(struct EventTimer *et);
 };
 
 /**
@@ -130,6 +138,15 @@ struct EventTimer *ET_default_init();
  */
 struct EventTimer *ET_rtdebug_init();
 
+/**
+ * Create an event timer that waits for timed events with a CLOCK_MONOTONIC
+ * timerfd armed at the absolute time of the next event.  This avoids the
+ * millisecond rounding of the poller's timeout, and the timer is only
+ * reprogrammed when the next deadline changes.  Linux only, returns NULL
+ * elsewhere.
+ */
+struct EventTimer *ET_timerfd_init();
+
 /**
  * Create a virtual event manager, which executes timed events as fast as possible.
  *
@@ -23,10 +23,15 @@
  * @author Greg Eddington
  */
 #include "events.h"
-#include "priorityQueue.h"
+#include "minHeap.h"
 #include "eventTimer.h"
+#include "eventPoller.h"
+#include "timerWheel.h"
+#include "slabPool.h"
+#include "hashtable.h"
 #include "proclib.h"
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/time.h>
@@ -34,6 +39,10 @@
 #include <sys/select.h>
 #include <signal.h>
 #include <assert.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include <strings.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -51,40 +60,67 @@
 #define EDBG_ENV_VAR "LIBPROC_DEBUGGER"
 #define EDBG_VCLK_ENV_VAR "LIBPROC_DEBUGGER_VCLK"
 #define EDBG_GVCLK_ENV_VAR "LIBPROC_DEBUGGER_GVCLK"
+#define POLLER_ENV_VAR "LIBPROC_POLLER"
+#define TIMER_ENV_VAR "LIBPROC_TIMER"
+#define STATS_ENV_VAR "LIBPROC_EVT_STATS"
 #define RESP_WAIT_MS 300
+#define SCHED_PER_SLAB 32
+#define DEFER_MIN_CAP 64
+// Slot of events that have no handle, such as the null event
+#define SCHED_NO_SLOT UINT32_MAX
+// Default number of bulk class callbacks run per loop iteration
+#define EVT_BULK_BUDGET 8
 
 // Structure representing a schedule callback
 typedef struct _ScheduleCB
 {
    struct timeval scheduleTime;
    struct timeval nextAwake;
+   struct timeval expires;          // nextAwake plus slack, the queue key
    EVT_sched_cb callback;
    void *arg;
-   size_t pos;
+   size_t pos;                      // Heap position, or batch index if batched
    struct timeval timeStep;
-   ps_pqueue_t *queue;
+   struct MinHeap *queue;
+   struct TW_node wheel;
+   struct EVTEventStats *stats;     // Allocated once event stats are enabled
    uint32_t count;
+   uint32_t name;                   // Id in the event name table, 0 if none
+   uint32_t slack;                  // Usec the event may be delayed
+   uint32_t slot;                   // Index in the handle table
+   unsigned char prio;              // EVT_PRIO_* dispatch class
    char breakpoint;
    char critical;
    char inCallback;
-   char name[128];
+   char batched;                    // Due and waiting in the expiry batch
 } ScheduleCB;
 
-// Structure which defines a file callback
+// Structure which defines a file callback.  Stored in an array indexed
+//  directly by the fd that launches the event.
 typedef struct EventCB
 {
    EVT_fd_cb cb[EVENT_MAX];        // An array of function callbacks to call
-   EVT_fd_cb cleanup[EVENT_MAX]; // An array of cleanup callback to call
    void *arg[EVENT_MAX];               // An array of arguments to pass to callbacks
    uint32_t counts[EVENT_MAX];
-   char breakpoint[EVENT_MAX];
    char inCallback[EVENT_MAX];
+   char used;                        // Non-zero if any callback is registered
    char pausable;
    char critical;
-   int fd;                           // The file descriptor which will launch the event 
-   char name[128];
-   struct EventCB *next;            // The next signal callback
-} *EventCBPtr;
+   unsigned char polled;             // Event mask registered with the poller
+   unsigned char mode;               // EVT_FD_EDGE and EVT_FD_ONESHOT flags
+   unsigned char prio;               // EVT_PRIO_* dispatch class
+   char disarmed;                    // One-shot fd waiting for EVT_fd_rearm
+} EventCB;
+
+// Rarely used file callback state, kept in an array parallel to the EventCBs
+//  so the dispatch path doesn't have to load it
+struct EventCBInfo
+{
+   EVT_fd_cb cleanup[EVENT_MAX]; // An array of cleanup callback to call
+   char breakpoint[EVENT_MAX];
+   uint32_t name;                // Id in the event name table, 0 if none
+   struct EVTEventStats *stats[EVENT_MAX];
+};
 
 struct GPIOInterruptCBList {
    EVT_sched_cb cb;
@@ -107,22 +143,52 @@ struct EDBGClient {
    struct EDBGClient *next;
 };
 
+// Handle table entry.  A handle is the slot's generation in the upper 32
+//  bits and the slot index in the lower 32 bits.  The generation changes
+//  every time the slot is released, so stale handles never match.
+struct SchedSlot {
+   ScheduleCB *evt;                 // NULL when the slot is free
+   uint32_t gen;
+   uint32_t next_free;
+};
+
+// A deferred callback.  Canceled callbacks are left in the ring with a
+//  NULL cb.
 struct DeferredEvent {
    EVT_sched_cb cb;
    void *arg;
-   struct DeferredEvent *next;
+};
+
+// A callback posted to the loop from another thread
+struct PostedEvent {
+   EVT_sched_cb cb;
+   void *arg;
+   struct PostedEvent *next;
 };
 
 // A structure which contains information regarding the state of the event handler
 struct EventState
 {
-   fd_set eventSet[EVENT_MAX];                            // File descriptor sets to watch
-   fd_set blockedSet[EVENT_MAX];                          // File descriptor sets to watch
-   int maxFd, maxFds[EVENT_MAX], eventCnt[EVENT_MAX]; // fd information
-   int hashSize;                                         // The hash size of the event handler
+   struct EventPoller *poller;                            // Waits for fd readiness
+   EventCB *fds;                                         // File callbacks, indexed by fd
+   struct EventCBInfo *fdInfo;                           // Parallel to fds
+   int fdCap;                                            // Number of entries in fds
+   int maxFd;                                            // Largest registered fd
    int keepGoing;                                        // Whether the handler should loop or not
    struct GPIOInterruptDesc gpio_intrs[2];            // GPIO interrupt state
-   ps_pqueue_t *queue, *dbg_queue;                       // The schedule queue
+   struct MinHeap *queue, *dbg_queue;                    // The schedule queue
+   struct TimerWheel *wheel;                             // Optional coarse queue
+   uint64_t wheel_res;                                   // Wheel tick in usec
+   struct SlabPool *sched_pool;                          // ScheduleCB storage
+   struct SchedSlot *slots;                              // Timed event handles
+   uint32_t slotCap, slotFree;
+   ScheduleCB **batch;                                   // Due timed events
+   size_t batchLen, batchCap;
+   struct PostedEvent *post_head;                        // Newest, pushed by posters
+   struct PostedEvent *post_tail;                        // Oldest, popped by the loop
+   struct PostedEvent post_stub;
+   int post_fd[2];                                       // Wakes the loop for posts
+   int post_pending;                                     // Wakeup already signaled
    struct EventTimer *evt_timer;
    char custom_timer;
    enum EVTDebuggerState initialDebuggerState;
@@ -133,11 +199,13 @@ struct EventState
    unsigned long long loop_counter;
    unsigned long long timed_event_counter;
    unsigned long long fd_event_counter;
+   struct EVTLoopStats stats;                            // Loop utilization
+   struct timeval stats_mark;                            // Last wakeup
    int steps_to_break;
    EVT_debug_state_cb debuggerStateCB;
    void *debuggerStateArg;
    ScheduleCB *next_timed_event;
-   EventCBPtr next_fd_event;
+   int next_fd_event;
    int next_fd_event_evt;
    int dbg_step;
    void *dump_evt;
@@ -145,23 +213,170 @@ struct EventState
    void *breakpoint_evt;
    ScheduleCB null_evt;
    long critical_sched_count, critical_fd_count;
+   long critical_post_count;           // Held by EVT_post_hold
+   unsigned int budget[EVT_PRIO_CLASSES];                // Callbacks per loop
+   unsigned int dispatched[EVT_PRIO_CLASSES];            // This iteration
    uint8_t break_on_next:1;
    uint8_t dump_every_loop:1;
    uint8_t full_dump_format:1;
    uint8_t in_loop:1;
-   struct DeferredEvent *deferred;
+   uint8_t fds_paused:1;
+   uint8_t event_stats:1;
+   struct DeferredEvent *defer_ring;   // Deferred callbacks, indexed by seq
+   size_t defer_cap;                   // Ring size, a power of two
+   size_t defer_peak;
+   uintptr_t defer_head, defer_tail;   // Seq of the oldest and next callback
+   unsigned long long deferred_counter;
+   unsigned int deferred_last;         // Run by the last loop iteration
    int (*cmds_pending)(void*);
    void *cmds_pending_arg;
+};
 
-   // MUST be last entry in struct
-   EventCBPtr events[1];                                  // List of pointers to event callbacks
+// The handler most recently created or run on this thread, for virtual time
+static __thread EVTHandler *global_evt = NULL;
+
+// Event names are only read by the debugger, so rather than carrying a
+//  string in every event they are interned in a process wide table and
+//  referenced by a reference counted id.  Id 0 means no name.
+struct EVTName {
+   char *str;
+   uint32_t id;
+   uint32_t refs;
 };
 
-// Static global for virtual time
-static EVTHandler *global_evt = NULL;
+static pthread_mutex_t evt_names_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct HashTable *evt_names_hash = NULL;
+static struct EVTName **evt_names = NULL;      // Indexed by id
+static uint32_t evt_names_len = 1, evt_names_cap = 0;
+static uint32_t *evt_names_free = NULL;        // Ids available for reuse
+static uint32_t evt_names_free_len = 0;
+
+static size_t evt_name_hash(void *key)
+{
+   const unsigned char *str = (const unsigned char*)key;
+   size_t hash = 5381;
+
+   while (*str)
+      hash = hash * 33 + *str++;
+
+   return hash;
+}
+
+static int evt_name_cmp(void *key1, void *key2)
+{
+   return !strcmp((const char*)key1, (const char*)key2);
+}
+
+static void *evt_name_key(void *data)
+{
+   return ((struct EVTName*)data)->str;
+}
+
+// Returns an id for the string, adding it to the table if needed
+static uint32_t evt_name_intern(const char *str)
+{
+   struct EVTName *name, **names;
+   uint32_t id = 0, *ids;
+
+   pthread_mutex_lock(&evt_names_lock);
+
+   if (!evt_names_hash)
+      evt_names_hash = HASH_create_table(31, &evt_name_hash, &evt_name_cmp,
+            &evt_name_key);
+   if (!evt_names_hash)
+      goto done;
+
+   name = (struct EVTName*)HASH_find_key(evt_names_hash, (void*)str);
+   if (name) {
+      name->refs++;
+      id = name->id;
+      goto done;
+   }
+
+   if (!evt_names_free_len && evt_names_len >= evt_names_cap) {
+      names = realloc(evt_names, (evt_names_cap + 32) * sizeof(*names));
+      if (!names)
+         goto done;
+      evt_names = names;
+      ids = realloc(evt_names_free, (evt_names_cap + 32) * sizeof(*ids));
+      if (!ids)
+         goto done;
+      evt_names_free = ids;
+      evt_names_cap += 32;
+   }
+
+   name = malloc(sizeof(*name));
+   if (!name)
+      goto done;
+   name->str = strdup(str);
+   if (!name->str) {
+      free(name);
+      goto done;
+   }
+   name->refs = 1;
+   if (evt_names_free_len)
+      name->id = evt_names_free[--evt_names_free_len];
+   else
+      name->id = evt_names_len++;
+   evt_names[name->id] = name;
+   HASH_add_data(evt_names_hash, name);
+   id = name->id;
+
+done:
+   pthread_mutex_unlock(&evt_names_lock);
+   return id;
+}
+
+static void evt_name_release(uint32_t id)
+{
+   struct EVTName *name;
+
+   if (!id)
+      return;
+
+   pthread_mutex_lock(&evt_names_lock);
+   name = evt_names[id];
+   if (--name->refs == 0) {
+      HASH_remove_data(evt_names_hash, name);
+      evt_names[id] = NULL;
+      evt_names_free[evt_names_free_len++] = id;
+      free(name->str);
+      free(name);
+   }
+   pthread_mutex_unlock(&evt_names_lock);
+}
+
+// The string stays valid for as long as the caller holds its reference
+static const char *evt_name_str(uint32_t id)
+{
+   const char *str = NULL;
+
+   if (!id)
+      return NULL;
+
+   pthread_mutex_lock(&evt_names_lock);
+   str = evt_names[id]->str;
+   pthread_mutex_unlock(&evt_names_lock);
+
+   return str;
+}
+
+// Replaces the name referenced by *id with the formatted string
+static void evt_name_vset(uint32_t *id, const char *fmt, va_list ap)
+{
+   char buff[128];
+   uint32_t old = *id;
+
+   vsnprintf(buff, sizeof(buff), fmt, ap);
+   buff[sizeof(buff) - 1] = 0;
+
+   *id = evt_name_intern(buff);
+   evt_name_release(old);
+}
 
 static void edbg_init(EVTHandler *ctx);
 static void edbg_report_state(EVTHandler *ctx, uint8_t full_format);
+static const char *get_function_name(void *func_addr);
 void evt_fd_set_pausable(EVTHandler *ctx, int fd, char pausable);
 extern int ET_default_monotonic(struct EventTimer *et, struct timeval *tv);
 extern char EVT_sched_move_to_mono(EVTHandler *handler, void *eventId);
@@ -236,34 +451,173 @@ int timeval_subtract(struct timeval *result, struct timeval *x,
   return x->tv_sec < y->tv_sec;
 }
 
-// Compare priority callback
-static int cmp_pri(struct timeval next, struct timeval curr)
+#define WHEEL_EVT(node) \
+   ((ScheduleCB*)((char*)(node) - offsetof(ScheduleCB, wheel)))
+
+static uint64_t evt_wheel_tick(EVTHandler *ctx, struct timeval *tv)
 {
-	return timercmp(&next, &curr, >=);
+   return ((uint64_t)tv->tv_sec * 1000000 + tv->tv_usec) / ctx->wheel_res;
 }
 
-// Get priority callback
-static struct timeval get_pri(void *a)
+// Moves a timed event whose wheel slot has started into the exact queue
+static void evt_wheel_release(struct TW_node *node, void *arg)
 {
-	return ((ScheduleCB *) a)->nextAwake;
+   ScheduleCB *evt = WHEEL_EVT(node);
+
+   MH_insert(evt->queue, evt, MH_tv2key(&evt->expires));
 }
 
-// Set priority callback
-static void set_pri(void *a, struct timeval pri)
+// Moves every timed event out of the wheel so the priority queue holds the
+//  complete schedule.  Used by the debugger, which walks the queue directly.
+static void evt_wheel_flush(EVTHandler *ctx)
 {
-	((ScheduleCB *) a)->nextAwake = pri;
+   if (ctx->wheel)
+      TW_release_all(ctx->wheel, &evt_wheel_release, ctx);
 }
 
-// Get position callback
-static size_t get_pos(void *a)
+// Adds a timed event to the wheel when it is far enough out, otherwise to
+//  its priority queue
+static int evt_sched_enqueue(EVTHandler *ctx, ScheduleCB *evt)
 {
-	return ((ScheduleCB *) a)->pos;
+   // The queues are ordered by the latest time the event may run
+   evt->expires = evt->nextAwake;
+   if (evt->slack) {
+      evt->expires.tv_usec += evt->slack;
+      evt->expires.tv_sec += evt->expires.tv_usec / 1000000;
+      evt->expires.tv_usec %= 1000000;
+   }
+
+   if (ctx->wheel && evt->queue == ctx->queue &&
+         0 == TW_add(ctx->wheel, &evt->wheel,
+            evt_wheel_tick(ctx, &evt->expires))) {
+      evt->pos = MH_NOT_QUEUED;
+      return 0;
+   }
+
+   return MH_insert(evt->queue, evt, MH_tv2key(&evt->expires));
 }
 
-// Set position callback
-static void set_pos(void *a, size_t pos)
+// Removes a timed event from whichever queue holds it.  Returns -1 if the
+//  event isn't queued.
+static int evt_sched_dequeue(EVTHandler *ctx, ScheduleCB *evt)
 {
-	((ScheduleCB *) a)->pos = pos;
+   // Batched events hold their batch index in pos
+   if (evt->batched) {
+      ctx->batch[evt->pos] = NULL;
+      evt->batched = 0;
+      evt->pos = MH_NOT_QUEUED;
+      return 0;
+   }
+   if (TW_is_queued(&evt->wheel)) {
+      TW_remove(ctx->wheel, &evt->wheel);
+      return 0;
+   }
+   if (MH_NOT_QUEUED == evt->pos || !evt->queue)
+      return -1;
+
+   MH_remove(evt->queue, evt->pos);
+
+   return 0;
+}
+
+// Moves every timed event that is due into the expiry batch
+static void evt_sched_collect(EVTHandler *ctx, struct timeval *now)
+{
+   ScheduleCB *evt, **batch;
+   size_t cap;
+
+   ctx->batchLen = 0;
+   while ((evt = MH_peek(ctx->queue))) {
+      // The queue is ordered by the latest time each event may run.  Stop at
+      //  the first event that can't run yet, even if a later one could.
+      if (timercmp(&evt->nextAwake, now, >))
+         break;
+
+      if (ctx->batchLen == ctx->batchCap) {
+         cap = ctx->batchCap ? ctx->batchCap * 2 : 16;
+         batch = realloc(ctx->batch, cap * sizeof(*batch));
+         if (!batch)
+            break;
+         ctx->batch = batch;
+         ctx->batchCap = cap;
+      }
+
+      MH_pop(ctx->queue);
+      evt->batched = 1;
+      evt->pos = ctx->batchLen;
+      ctx->batch[ctx->batchLen++] = evt;
+   }
+}
+
+// Puts batched events that weren't dispatched back into their queue
+static void evt_sched_requeue_batch(EVTHandler *ctx, size_t start)
+{
+   ScheduleCB *evt;
+
+   for (; start < ctx->batchLen; start++) {
+      if (!(evt = ctx->batch[start]))
+         continue;
+      evt->batched = 0;
+      evt->pos = MH_NOT_QUEUED;
+      evt_sched_enqueue(ctx, evt);
+   }
+   ctx->batchLen = 0;
+}
+
+// Allocates a zeroed timed event with a handle table slot
+static ScheduleCB *evt_sched_alloc(EVTHandler *ctx)
+{
+   struct SchedSlot *slots;
+   ScheduleCB *evt;
+   uint32_t i, cap;
+
+   if (ctx->slotFree == SCHED_NO_SLOT) {
+      cap = ctx->slotCap ? ctx->slotCap * 2 : SCHED_PER_SLAB;
+      if (cap <= ctx->slotCap || cap == SCHED_NO_SLOT)
+         return NULL;
+      slots = realloc(ctx->slots, cap * sizeof(*slots));
+      if (!slots)
+         return NULL;
+      for (i = ctx->slotCap; i < cap; i++) {
+         slots[i].evt = NULL;
+         slots[i].gen = 1;
+         slots[i].next_free = i + 1 < cap ? i + 1 : SCHED_NO_SLOT;
+      }
+      ctx->slots = slots;
+      ctx->slotFree = ctx->slotCap;
+      ctx->slotCap = cap;
+   }
+
+   evt = SP_alloc(ctx->sched_pool);
+   if (!evt)
+      return NULL;
+   memset(evt, 0, sizeof(*evt));
+
+   evt->prio = EVT_PRIO_NORMAL;
+   evt->slot = ctx->slotFree;
+   ctx->slotFree = ctx->slots[evt->slot].next_free;
+   ctx->slots[evt->slot].evt = evt;
+
+   return evt;
+}
+
+static void evt_sched_free(EVTHandler *ctx, ScheduleCB *evt)
+{
+   struct SchedSlot *slot;
+
+   if (evt->slot != SCHED_NO_SLOT) {
+      slot = &ctx->slots[evt->slot];
+      slot->evt = NULL;
+      // Generation 0 is skipped so no handle is ever 0
+      if (!++slot->gen)
+         slot->gen = 1;
+      slot->next_free = ctx->slotFree;
+      ctx->slotFree = evt->slot;
+   }
+
+   evt_name_release(evt->name);
+   free(evt->stats);
+   SP_free(ctx->sched_pool, evt);
 }
 
 int null_evt_callback(void *arg)
@@ -277,23 +631,238 @@ void EVT_set_cmds_pending(struct EventState *state, int (*cb)(void*), void *arg)
    state->cmds_pending_arg = arg;
 }
 
-/* Initializes an EventState with a given hash size.
- * @param hashSize The hash size of the event handler.
+// Drains the EventTimer's wake fd.  The timed events themselves are
+//  processed by the loop.
+static int evt_timer_wake(int fd, char type, void *arg)
+{
+   uint64_t expirations;
+
+   if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+      ERRNO_WARN("Failed to read event timer fd %d", fd);
+
+   return EVENT_KEEP;
+}
+
+// Installs the EventTimer, watching its wake fd if it has one
+static void evt_timer_attach(EVTHandler *ctx, struct EventTimer *et)
+{
+   int fd;
+
+   ctx->evt_timer = et;
+   if (!et)
+      return;
+   DBG_set_timer(et);
+
+   if (et->wake_fd && (fd = et->wake_fd(et)) >= 0) {
+      if (!EVT_fd_add(ctx, fd, EVENT_FD_READ, &evt_timer_wake, et)) {
+         // Tell the timer to fall back to a block timeout
+         et->wake_fd = NULL;
+         return;
+      }
+      EVT_fd_set_critical(ctx, fd, 0);
+      EVT_fd_set_name(ctx, fd, "Event Timer");
+   }
+}
+
+static void evt_timer_detach(EVTHandler *ctx)
+{
+   struct EventTimer *et = ctx->evt_timer;
+   int fd;
+
+   if (!et)
+      return;
+
+   if (et->wake_fd && (fd = et->wake_fd(et)) >= 0)
+      EVT_fd_remove(ctx, fd, EVENT_FD_READ);
+   DBG_set_timer(NULL);
+   et->cleanup(et);
+   ctx->evt_timer = NULL;
+}
+
+// Posted events are kept in an intrusive multi-producer single-consumer
+//  queue.  Producers only swap the head pointer and link the previous head to
+//  the new node, so posting never blocks.  The loop pops from the tail.
+static void evt_post_push(EVTHandler *ctx, struct PostedEvent *evt)
+{
+   struct PostedEvent *prev;
+
+   __atomic_store_n(&evt->next, NULL, __ATOMIC_RELAXED);
+   prev = __atomic_exchange_n(&ctx->post_head, evt, __ATOMIC_ACQ_REL);
+   __atomic_store_n(&prev->next, evt, __ATOMIC_RELEASE);
+}
+
+// Returns NULL if the queue is empty, or if a producer is midway through a
+//  push.  That producer will signal the loop again once it's done.
+static struct PostedEvent *evt_post_pop(EVTHandler *ctx)
+{
+   struct PostedEvent *tail = ctx->post_tail, *next, *head;
+
+   next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+   if (tail == &ctx->post_stub) {
+      if (!next)
+         return NULL;
+      ctx->post_tail = tail = next;
+      next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+   }
+
+   if (next) {
+      ctx->post_tail = next;
+      return tail;
+   }
+
+   head = __atomic_load_n(&ctx->post_head, __ATOMIC_ACQUIRE);
+   if (tail != head)
+      return NULL;
+
+   // tail is the last node, so put the stub behind it before taking it
+   evt_post_push(ctx, &ctx->post_stub);
+   next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+   if (next) {
+      ctx->post_tail = next;
+      return tail;
+   }
+
+   return NULL;
+}
+
+static void evt_post_run_all(EVTHandler *ctx)
+{
+   struct PostedEvent *evt;
+
+   while ((evt = evt_post_pop(ctx))) {
+      evt->cb(evt->arg);
+      free(evt);
+   }
+}
+
+static int evt_post_wake(int fd, char type, void *arg)
+{
+   EVTHandler *ctx = (EVTHandler*)arg;
+   char buff[8];
+
+   while (read(fd, buff, sizeof(buff)) > 0)
+      ;
+
+   // Clear the flag before draining so posts made during the drain signal
+   //  the loop again
+   __atomic_store_n(&ctx->post_pending, 0, __ATOMIC_SEQ_CST);
+   evt_post_run_all(ctx);
+
+   return EVENT_KEEP;
+}
+
+static int evt_post_init(EVTHandler *ctx)
+{
+   ctx->post_head = ctx->post_tail = &ctx->post_stub;
+   ctx->post_stub.next = NULL;
+
+#ifdef __linux__
+   ctx->post_fd[0] = ctx->post_fd[1] =
+      eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (ctx->post_fd[0] < 0)
+      return -1;
+#else
+   if (pipe(ctx->post_fd) < 0)
+      return -1;
+   fcntl(ctx->post_fd[0], F_SETFL, O_NONBLOCK);
+   fcntl(ctx->post_fd[1], F_SETFL, O_NONBLOCK);
+#endif
+
+   if (!EVT_fd_add(ctx, ctx->post_fd[0], EVENT_FD_READ, &evt_post_wake, ctx)) {
+      close(ctx->post_fd[0]);
+      if (ctx->post_fd[1] != ctx->post_fd[0])
+         close(ctx->post_fd[1]);
+      return -1;
+   }
+   EVT_fd_set_critical(ctx, ctx->post_fd[0], 0);
+   EVT_fd_set_name(ctx, ctx->post_fd[0], "Posted Events");
+
+   return 0;
+}
+
+static void evt_post_cleanup(EVTHandler *ctx)
+{
+   evt_post_run_all(ctx);
+
+   EVT_fd_remove(ctx, ctx->post_fd[0], EVENT_FD_READ);
+   close(ctx->post_fd[0]);
+   if (ctx->post_fd[1] != ctx->post_fd[0])
+      close(ctx->post_fd[1]);
+}
+
+/**
+ * Run a callback on the handler's event loop.  Safe to call from any
+ *  thread.
+ *
+ * @param target The event handler to run the callback on.
+ * @param cb The callback.
+ * @param arg The callback argument.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int EVT_post(EVTHandler *target, EVT_sched_cb cb, void *arg)
+{
+   struct PostedEvent *evt;
+   uint64_t one = 1;
+
+   if (!target || !cb)
+      return -1;
+
+   evt = malloc(sizeof(*evt));
+   if (!evt)
+      return -1;
+   evt->cb = cb;
+   evt->arg = arg;
+
+   evt_post_push(target, evt);
+
+   // Only the first post since the loop last drained the queue wakes it.
+   //  The eventfd counter can't realistically overflow, so a failed write
+   //  leaves the loop already signaled.
+   if (0 == __atomic_exchange_n(&target->post_pending, 1, __ATOMIC_SEQ_CST) &&
+         write(target->post_fd[1], &one, sizeof(one)) < 0 && errno != EAGAIN)
+      ERRNO_WARN("Failed to wake event loop");
+
+   return 0;
+}
+
+void EVT_post_hold(EVTHandler *ctx)
+{
+   ctx->critical_post_count++;
+}
+
+void EVT_post_release(EVTHandler *ctx)
+{
+   if (ctx->critical_post_count > 0)
+      ctx->critical_post_count--;
+}
+
+/* Initializes an EventState with a given size hint.
+ * @param hashSize The initial number of fds and timed events to make room for.
  * @return A pointer to the new EventState
  */
 struct EventState *EVT_initWithSize(int hashSize, EVT_debug_state_cb debug_cb,
         void *arg)
 {
    struct EventState *res = NULL;
-   int i;
-   const char *dbg_state;
+   const char *dbg_state, *poller, *timer;
 
-   res = (struct EventState*)malloc(
-         sizeof(struct EventState) + hashSize * sizeof(EventCBPtr));
+   res = (struct EventState*)malloc(sizeof(struct EventState));
    if (!res)
       return NULL;
    memset(res, 0, sizeof(struct EventState));
 
+   if (hashSize < 1)
+      hashSize = 1;
+   res->fds = calloc(hashSize, sizeof(EventCB));
+   res->fdInfo = calloc(hashSize, sizeof(struct EventCBInfo));
+   res->sched_pool = SP_init(sizeof(ScheduleCB), SCHED_PER_SLAB);
+   if (!res->fds || !res->fdInfo || !res->sched_pool)
+      goto fail;
+   res->fdCap = hashSize;
+   res->slotFree = SCHED_NO_SLOT;
+   res->budget[EVT_PRIO_BULK] = EVT_BULK_BUDGET;
+
    memset(&res->gpio_intrs, 0, sizeof(res->gpio_intrs));
    res->debuggerStateCB = debug_cb;
    res->debuggerStateArg = arg;
@@ -313,47 +882,51 @@ struct EventState *EVT_initWithSize(int hashSize, EVT_debug_state_cb debug_cb,
       res->debuggerState = EDBG_ENABLED;
 
    res->keepGoing = 1;
-   for ( i = 0; i < EVENT_MAX; i++) {
-      FD_ZERO(&res->eventSet[i]);
-      FD_ZERO(&res->blockedSet[i]);
-      res->maxFds[i] = 0;
-      res->eventCnt[i] = 0;
-   }
-   res->hashSize = hashSize;
    res->maxFd = 0;
-   for (i = 0; i < res->hashSize; i++)
-      res->events[i] = NULL;
 
-   res->queue = ps_pqueue_init(hashSize, cmp_pri, get_pri, set_pri,
-         get_pos, set_pos);
-   if (res->queue == NULL){
-      free(res);
- 	   return NULL;
-   }
+   res->queue = MH_init(hashSize, offsetof(ScheduleCB, pos));
+   if (res->queue == NULL)
+      goto fail;
 
-   res->dbg_queue = ps_pqueue_init(hashSize, cmp_pri, get_pri, set_pri,
-         get_pos, set_pos);
-   if (res->dbg_queue == NULL){
-      free(res->queue);
-      free(res);
- 	   return NULL;
-   }
+   res->dbg_queue = MH_init(hashSize, offsetof(ScheduleCB, pos));
+   if (res->dbg_queue == NULL)
+      goto fail;
    
-   res->evt_timer = ET_default_init();
-   if (!res->evt_timer) {
-      free(res->queue);
-      free(res);
-      return NULL;
-   }
-   DBG_set_timer(res->evt_timer);
+   // Select the fd poller
+   poller = getenv(POLLER_ENV_VAR);
+   if (poller && !strcasecmp(poller, "select"))
+      res->poller = EP_select_init();
+   else if (poller && !strcasecmp(poller, "epoll"))
+      res->poller = EP_epoll_init();
+   else if (poller && (!strcasecmp(poller, "io_uring") ||
+            !strcasecmp(poller, "uring")))
+      res->poller = EP_uring_init();
+   if (!res->poller)
+      res->poller = EP_default_init();
+   if (!res->poller)
+      goto fail;
+
+   if (getenv(STATS_ENV_VAR))
+      res->event_stats = 1;
+
+   timer = getenv(TIMER_ENV_VAR);
+   if (timer && !strcasecmp(timer, "timerfd"))
+      evt_timer_attach(res, ET_timerfd_init());
+   if (!res->evt_timer)
+      evt_timer_attach(res, ET_default_init());
+   if (!res->evt_timer)
+      goto fail;
    
+   if (evt_post_init(res) < 0)
+      goto fail;
+
    global_evt = res;
    res->loop_counter = 0;
    res->timed_event_counter = 0;
    res->fd_event_counter = 0;
    res->steps_to_break = 0;
    res->next_timed_event = NULL;
-   res->next_fd_event = NULL;
+   res->next_fd_event = -1;
    res->custom_timer = 0;
    res->dump_evt = NULL;
    res->dbg_reply_evt = NULL;
@@ -363,8 +936,22 @@ struct EventState *EVT_initWithSize(int hashSize, EVT_debug_state_cb debug_cb,
    res->dbg_step = 0;
    memset(&res->null_evt, 0, sizeof(res->null_evt));
    res->null_evt.callback = null_evt_callback;
+   res->null_evt.slot = SCHED_NO_SLOT;
 
    return res;
+
+fail:
+   // Release whatever was set up before the failure
+   evt_timer_detach(res);
+   if (res->poller)
+      res->poller->cleanup(res->poller);
+   MH_free(res->queue);
+   MH_free(res->dbg_queue);
+   SP_destroy(res->sched_pool);
+   free(res->fds);
+   free(res->fdInfo);
+   free(res);
+   return NULL;
 }
 
 /* Initializes an EventState with a hash size of 19
@@ -386,45 +973,105 @@ struct timeval EVT_sched_remaining(EVTHandler *handler, void *eventId)
    return result;
 }
 
-static int EVT_remove_internal(struct EventState *ctx, struct EventCB **curr,
-      int event)
+// Computes the set of events the poller should watch for a fd.  While the
+//  fds are paused by the debugger only non-pausable or non-breakpointed
+//  events are watched.
+static unsigned int evt_fd_interest(struct EventState *ctx, int fd)
 {
-   struct EventCB *tmp;
+   unsigned int mask = 0;
+   int event;
+
+   if (ctx->fds[fd].disarmed)
+      return 0;
+
+   for (event = 0; event < EVENT_MAX; event++)
+      if (ctx->fds[fd].cb[event] && (!ctx->fds_paused ||
+               !ctx->fds[fd].pausable || !ctx->fdInfo[fd].breakpoint[event]))
+         mask |= EP_MASK(event);
+
+   if (mask && (ctx->fds[fd].mode & EVT_FD_EDGE))
+      mask |= EP_EDGE;
+   if (mask && (ctx->fds[fd].mode & EVT_FD_ONESHOT))
+      mask |= EP_ONESHOT;
+
+   return mask;
+}
+
+// Pushes a fd's interest mask to the poller if it has changed
+static int evt_fd_sync(struct EventState *ctx, int fd, int force)
+{
+   unsigned int mask = evt_fd_interest(ctx, fd);
+
+   if (!force && mask == ctx->fds[fd].polled)
+      return 0;
+
+   if ((*ctx->poller->set_interest)(ctx->poller, fd, mask) < 0) {
+      DBG_print(DBG_LEVEL_WARN, "Failed to update %s poller for fd %d: %s\n",
+            ctx->poller->name, fd, strerror(errno));
+      return -1;
+   }
+   ctx->fds[fd].polled = mask;
+
+   return 0;
+}
+
+// Returns the file callback for a fd, or NULL if none is registered
+static EventCB *evt_fd_lookup(struct EventState *ctx, int fd)
+{
+   if (fd < 0 || fd >= ctx->fdCap || !ctx->fds[fd].used)
+      return NULL;
+
+   return &ctx->fds[fd];
+}
+
+// Grows the file callback arrays to hold at least fd
+static int evt_fd_grow(struct EventState *ctx, int fd)
+{
+   EventCB *fds;
+   struct EventCBInfo *info;
+   int cap = ctx->fdCap;
+
+   while (cap <= fd)
+      cap *= 2;
+
+   fds = realloc(ctx->fds, cap * sizeof(EventCB));
+   if (!fds)
+      return -1;
+   memset(&fds[ctx->fdCap], 0, (cap - ctx->fdCap) * sizeof(EventCB));
+   ctx->fds = fds;
+
+   info = realloc(ctx->fdInfo, cap * sizeof(struct EventCBInfo));
+   if (!info)
+      return -1;
+   memset(&info[ctx->fdCap], 0,
+         (cap - ctx->fdCap) * sizeof(struct EventCBInfo));
+   ctx->fdInfo = info;
+   ctx->fdCap = cap;
+
+   return 0;
+}
+
+static int EVT_remove_internal(struct EventState *ctx, int fd, int event)
+{
+   EventCB *tmp = evt_fd_lookup(ctx, fd);
    int i, deleteIt = 1;
 
-   if (!curr || !*curr || !(*curr)->cb[event]){
+   if (!tmp || !tmp->cb[event]){
       return 0;
    }
-   tmp = *curr;
 
-   if (tmp->cleanup[event]){
-      (*tmp->cleanup[event])(-1, event, tmp->arg[event]);
+   if (ctx->fdInfo[fd].cleanup[event]){
+      (*ctx->fdInfo[fd].cleanup[event])(-1, event, tmp->arg[event]);
+      // The cleanup callback may have grown the table
+      tmp = &ctx->fds[fd];
    }
 
-   ctx->eventCnt[event]--;
    tmp->cb[event] = NULL;
-   tmp->cleanup[event] = NULL;
    tmp->arg[event] = NULL;
-   FD_CLR(tmp->fd, &ctx->eventSet[event]);
-   FD_CLR(tmp->fd, &ctx->blockedSet[event]);
-
-	if (tmp->fd == ctx->maxFds[event]) {
-      ctx->maxFds[event] = 0;;
-      if (ctx->eventCnt[event] > 0) {
-      	//Find next highest
-         for(i = 1; i < tmp->fd; i++)
-            if (FD_ISSET(i, &ctx->eventSet[event])){
-               ctx->maxFds[event] = i;
-            }
-
-         ctx->maxFd = ctx->maxFds[0];
-         for (i = 1; i < EVENT_MAX; i++){
-            if (ctx->maxFds[i] > ctx->maxFd){
-               ctx->maxFd = ctx->maxFds[i];
-            }
-         }
-      }
-   }
+   ctx->fdInfo[fd].cleanup[event] = NULL;
+   free(ctx->fdInfo[fd].stats[event]);
+   ctx->fdInfo[fd].stats[event] = NULL;
+   evt_fd_sync(ctx, fd, 0);
 
    for(i = 0; i < EVENT_MAX; i++){
       if (tmp->cb[i]){
@@ -436,39 +1083,84 @@ static int EVT_remove_internal(struct EventState *ctx, struct EventCB **curr,
       if (tmp->critical)
          ctx->critical_fd_count--;
 
-      *curr = tmp->next;
-      free(tmp);
+      memset(tmp, 0, sizeof(*tmp));
+      evt_name_release(ctx->fdInfo[fd].name);
+      memset(&ctx->fdInfo[fd], 0, sizeof(ctx->fdInfo[fd]));
+
+      if (fd == ctx->maxFd) {
+         //Find next highest
+         while (ctx->maxFd > 0 && !ctx->fds[ctx->maxFd].used)
+            ctx->maxFd--;
+      }
    }
 
    return deleteIt;
 }
 
+// Returns the ring entry for the next deferred callback, growing the ring
+//  if it is full
+static struct DeferredEvent *evt_defer_slot(EVTHandler *ctx)
+{
+   struct DeferredEvent *ring;
+   size_t cap;
+   uintptr_t seq;
+
+   if (ctx->defer_tail - ctx->defer_head == ctx->defer_cap) {
+      cap = ctx->defer_cap ? ctx->defer_cap * 2 : DEFER_MIN_CAP;
+      ring = malloc(cap * sizeof(*ring));
+      if (!ring)
+         return NULL;
+      // Entries are placed by sequence number, which depends on the size
+      for (seq = ctx->defer_head; seq != ctx->defer_tail; seq++)
+         ring[seq & (cap - 1)] = ctx->defer_ring[seq & (ctx->defer_cap - 1)];
+      free(ctx->defer_ring);
+      ctx->defer_ring = ring;
+      ctx->defer_cap = cap;
+   }
+
+   return &ctx->defer_ring[ctx->defer_tail & (ctx->defer_cap - 1)];
+}
+
+// Runs deferred callbacks until the ring is empty, including callbacks
+//  deferred by the callbacks themselves.  Returns the number run.
+static unsigned int evt_run_deferred(EVTHandler *ctx)
+{
+   struct DeferredEvent def;
+   unsigned int count = 0;
+
+   while (ctx->defer_head != ctx->defer_tail) {
+      // Copy the entry out, the callback may grow the ring
+      def = ctx->defer_ring[ctx->defer_head & (ctx->defer_cap - 1)];
+      ctx->defer_head++;
+      if (def.cb) {
+         def.cb(def.arg);
+         count++;
+      }
+   }
+   ctx->deferred_counter += count;
+
+   return count;
+}
+
 void EVT_free_handler(EVTHandler *ctx)
 {
    int i, event;
    ScheduleCB *curProc;
-   struct DeferredEvent *def;
 
    if (!ctx)
       return;
 
-   while ((def = ctx->deferred)) {
-      ctx->deferred = def->next;
-      if (def->cb)
-         def->cb(def->arg);
-      free(def);
-   }
+   evt_run_deferred(ctx);
 
    if (ctx->dbgBuffer)
       ipc_destroy_buffer(&ctx->dbgBuffer);
    if (ctx->dbgServer)
       zmql_destroy_tcp_server(&ctx->dbgServer);
 
-   if (ctx->evt_timer) {
-      DBG_set_timer(NULL);
-      ctx->evt_timer->cleanup(ctx->evt_timer);
-   }
-   global_evt = NULL;
+   evt_post_cleanup(ctx);
+   evt_timer_detach(ctx);
+   if (global_evt == ctx)
+      global_evt = NULL;
 
    if (ctx->breakpoint_evt)
       EVT_sched_remove(ctx, ctx->breakpoint_evt);
@@ -477,66 +1169,68 @@ void EVT_free_handler(EVTHandler *ctx)
    if (ctx->dbg_reply_evt)
       EVT_sched_remove(ctx, ctx->dbg_reply_evt);
 
-   for(i = 0; i < ctx->hashSize; i++){
-      while(ctx->events[i]){
-         for(event = 0; event < EVENT_MAX; event++){
-            EVT_remove_internal(ctx, &ctx->events[i], event);
-         }
+   for(i = 0; i <= ctx->maxFd; i++){
+      for(event = 0; event < EVENT_MAX; event++){
+         EVT_remove_internal(ctx, i, event);
       }
    }
 
-   while ((curProc = ps_pqueue_peek(ctx->queue))) {
-       ps_pqueue_pop(ctx->queue);
+   evt_wheel_flush(ctx);
+   TW_free(ctx->wheel);
+
+   while ((curProc = MH_peek(ctx->queue))) {
+       MH_pop(ctx->queue);
        // Call the callback and see if it wants to be kept
        if (curProc != &ctx->null_evt)
-          free(curProc);
+          evt_sched_free(ctx, curProc);
    }
 
-   while ((curProc = ps_pqueue_peek(ctx->dbg_queue))) {
-       ps_pqueue_pop(ctx->dbg_queue);
+   while ((curProc = MH_peek(ctx->dbg_queue))) {
+       MH_pop(ctx->dbg_queue);
        // Call the callback and see if it wants to be kept
        if (curProc != &ctx->null_evt)
-          free(curProc);
-   }
-
-   ps_pqueue_free(ctx->queue);
-   ps_pqueue_free(ctx->dbg_queue);
+          evt_sched_free(ctx, curProc);
+   }
+
+   MH_free(ctx->queue);
+   MH_free(ctx->dbg_queue);
+   if (ctx->poller)
+      ctx->poller->cleanup(ctx->poller);
+   free(ctx->fds);
+   free(ctx->fdInfo);
+   free(ctx->batch);
+   free(ctx->slots);
+   SP_destroy(ctx->sched_pool);
+   free(ctx->defer_ring);
    free(ctx);
 }
 
 void EVT_fd_remove(EVTHandler *ctx, int fd, int event)
 {
-   struct EventCB **curr;
+   EventCB *curr = evt_fd_lookup(ctx, fd);
 
-   for (curr = &ctx->events[fd % ctx->hashSize]; *curr; )
-      if ((*curr)->fd == fd && !(*curr)->inCallback[event]) {
-         if (!EVT_remove_internal(ctx, curr, event))
-            curr = &(*curr)->next;
-      }
-      else {
-         if ((*curr)->fd == fd && (*curr)->inCallback[event])
-            DBG_print(DBG_LEVEL_WARN, "Calling EVT_fd_remove within a fd "
-                  "event callback is a bug.  See EVT_fd_force_remove as an "
-                  "alternative");
-         curr = &(*curr)->next;
-      }
+   if (!curr)
+      return;
+
+   if (!curr->inCallback[event])
+      EVT_remove_internal(ctx, fd, event);
+   else
+      DBG_print(DBG_LEVEL_WARN, "Calling EVT_fd_remove within a fd "
+            "event callback is a bug.  See EVT_fd_force_remove as an "
+            "alternative");
 }
 
 void EVT_fd_force_remove(EVTHandler *ctx, int fd, int event)
 {
-   struct EventCB **curr;
+   EventCB *curr = evt_fd_lookup(ctx, fd);
 
-   for (curr = &ctx->events[fd % ctx->hashSize]; *curr; ) {
-      if ((*curr)->fd == fd && !(*curr)->inCallback[event]) {
-         if (!EVT_remove_internal(ctx, curr, event))
-            curr = &(*curr)->next;
-      }
-      else {
-         if ((*curr)->fd == fd && (*curr)->inCallback[event])
-            (*curr)->inCallback[event] = 3;
-         curr = &(*curr)->next;
-      }
-   }
+   if (!curr)
+      return;
+
+   if (!curr->inCallback[event])
+      EVT_remove_internal(ctx, fd, event);
+   else
+      curr->inCallback[event] = 3;
 }
 
 char EVT_fd_add(EVTHandler *ctx, int fd, int event, EVT_fd_cb cb, void *p)
@@ -544,46 +1238,71 @@ char EVT_fd_add(EVTHandler *ctx, int fd, int event, EVT_fd_cb cb, void *p)
    return EVT_fd_add_with_cleanup(ctx, fd, event, cb, NULL, p);
 }
 
+static char evt_fd_add(EVTHandler *ctx, int fd, int event,
+      EVT_fd_cb cb, EVT_fd_cb cleanup_cb, void *p, int mode);
+
+char EVT_fd_add_flags(EVTHandler *ctx, int fd, int event, EVT_fd_cb cb,
+      void *p, unsigned int flags)
+{
+   if (flags & ~(EVT_FD_EDGE | EVT_FD_ONESHOT))
+      return 0;
+
+   return evt_fd_add(ctx, fd, event, cb, NULL, p, flags);
+}
+
+char EVT_fd_rearm(EVTHandler *ctx, int fd)
+{
+   EventCB *curr = evt_fd_lookup(ctx, fd);
+
+   if (!curr)
+      return 0;
+
+   if (curr->disarmed) {
+      curr->disarmed = 0;
+      if (evt_fd_sync(ctx, fd, 1) < 0)
+         return 0;
+   }
+
+   return 1;
+}
+
 char EVT_fd_add_with_cleanup(EVTHandler *ctx, int fd, int event,
       EVT_fd_cb cb, EVT_fd_cb cleanup_cb, void *p)
 {
-   struct EventCB *curr, **currP, *tail;
-   int i;
+   return evt_fd_add(ctx, fd, event, cb, cleanup_cb, p, -1);
+}
+
+// Registers a fd callback.  A mode of -1 keeps the fd's current mode.
+static char evt_fd_add(EVTHandler *ctx, int fd, int event,
+      EVT_fd_cb cb, EVT_fd_cb cleanup_cb, void *p, int mode)
+{
+   EventCB *curr;
+   EVT_fd_cb prev_cb;
 
    if (!cb) {
       EVT_fd_remove(ctx, fd, event);
       return 0;
    }
 
-   for (currP = &ctx->events[fd % ctx->hashSize];
-         *currP && (*currP)->fd != fd;
-         currP = &(*currP)->next)
-      ;
-   curr = *currP;
+   if (fd < 0 || (ctx->poller->fd_limit && fd >= ctx->poller->fd_limit)) {
+      DBG_print(DBG_LEVEL_WARN, "fd %d can not be watched by the %s poller\n",
+            fd, ctx->poller->name);
+      return 0;
+   }
 
-   if (!curr) {
-      curr = (struct EventCB*)malloc(sizeof(struct EventCB));
-      if (!curr)
-         return -1;
+   if (fd >= ctx->fdCap && evt_fd_grow(ctx, fd) < 0)
+      return 0;
+   curr = &ctx->fds[fd];
 
-      memset(curr, 0, sizeof(*curr));
+   if (!curr->used) {
+      curr->used = 1;
       curr->critical = 1;
       curr->pausable = 1;
-      curr->fd = fd;
-      // Add to end of linked list to avoid corruption when adding a callback
-      //  from within another callback in the same collision bucket
-      for (tail = ctx->events[fd % ctx->hashSize]; tail && tail->next;
-            tail = tail->next);
-      if (!tail)
-         ctx->events[fd % ctx->hashSize] = curr;
-      else
-         tail->next = curr;
-
+      curr->prio = EVT_PRIO_NORMAL;
       ctx->critical_fd_count++;
    }
-   if (!curr->cb[event])
-      ctx->eventCnt[event]++;
-   else if (curr->cb[event] != cb || curr->arg[event] != p) {
+   prev_cb = curr->cb[event];
+   if (prev_cb && (curr->cb[event] != cb || curr->arg[event] != p)) {
       const char *ename = "READ";
       if (event == EVENT_FD_WRITE)
          ename = "WRITE";
@@ -592,75 +1311,66 @@ char EVT_fd_add_with_cleanup(EVTHandler *ctx, int fd, int event,
       DBG_print(DBG_LEVEL_WARN, "Warning: Only one event handler can be "
             "registered for a fd at a time.  Overwriting event %s (%d) on "
             "fd %d.  %p:%p -> %p:%p\n", ename,
-            event, curr->fd, curr->cb[event], curr->arg[event], cb, p);
-      if (curr->cleanup[event] && curr->arg[event] != p)
-         (*curr->cleanup[event])(-1, event, curr->arg[event]);
+            event, fd, curr->cb[event], curr->arg[event], cb, p);
+      if (ctx->fdInfo[fd].cleanup[event] && curr->arg[event] != p) {
+         (*ctx->fdInfo[fd].cleanup[event])(-1, event, curr->arg[event]);
+         curr = &ctx->fds[fd];
+      }
    }
 
    curr->cb[event] = cb;
-   curr->cleanup[event] = cleanup_cb;
    curr->arg[event] = p;
+   curr->disarmed = 0;
+   if (mode >= 0)
+      curr->mode = mode;
+   ctx->fdInfo[fd].cleanup[event] = cleanup_cb;
 
    if (curr->inCallback[event])
       curr->inCallback[event] = 2;
-   else {
-      FD_SET(fd, &ctx->eventSet[event]);
-      if (!curr->pausable || !curr->breakpoint[event])
-         FD_SET(fd, &ctx->blockedSet[event]);
 
-      if (fd > ctx->maxFds[event]){
-         ctx->maxFds[event] = fd;
+   // Always push registrations to the poller, even when the mask is
+   //  unchanged, in case the fd was closed and reused without being removed
+   //  from the event loop first.  epoll forgets closed fds on its own.
+   if (evt_fd_sync(ctx, fd, 1) < 0) {
+      ctx->fdInfo[fd].cleanup[event] = NULL;
+      if (!curr->inCallback[event])
+         EVT_remove_internal(ctx, fd, event);
+      return 0;
    }
 
-      ctx->maxFd = ctx->maxFds[0];
-      for (i = 1; i < EVENT_MAX; i++)
-         if (ctx->maxFds[i] > ctx->maxFd)
-            ctx->maxFd = ctx->maxFds[i];
-   }
+   if (fd > ctx->maxFd)
+      ctx->maxFd = fd;
 
    return 1;
 }
 
 static int EVT_clean_fdsets(struct EventState *ctx)
 {
-   fd_set testSet;
-   int i, evt, used, res, max;
-   struct timeval poll;
+   EventCB *curr;
+   int fd;
    int foundOne = 0;
 
    DBG_print(DBG_LEVEL_WARN, "Warning: cleaning file descriptors is a slow process. "
          "Remove them when you are done instead!\n");
 
-   max = ctx->maxFd + 1;
-   for (i = 0; i < max; i++) {
-      used = 0;
-      for (evt = 0; evt < EVENT_MAX; evt++)
-         used = used || FD_ISSET(i, &ctx->eventSet[evt]);
-      if (!used){
+   for (fd = 0; fd <= ctx->maxFd; fd++) {
+      curr = evt_fd_lookup(ctx, fd);
+      if (!curr || fcntl(fd, F_GETFD) != -1 || errno != EBADF)
          continue;
-      }
 
-      FD_ZERO(&testSet);
-      FD_SET(i, &testSet);
-      poll.tv_sec = 0;
-      poll.tv_usec = 0;
-
-      res = select(i + 1, &testSet, NULL, NULL, &poll);
-      if (res == -1 && errno == EBADF) {
-         foundOne = 1;
-         fprintf(stderr, "\tFound fd %d for events: ", i);
-         if (FD_ISSET(i, &ctx->eventSet[EVENT_FD_READ]))
-            fprintf(stderr, "read ");
-         if (FD_ISSET(i, &ctx->eventSet[EVENT_FD_WRITE]))
-            fprintf(stderr, "write ");
-         if (FD_ISSET(i, &ctx->eventSet[EVENT_FD_ERROR]))
-            fprintf(stderr, "error ");
-         fprintf(stderr, "\n");
-
-         EVT_fd_remove(ctx, i, EVENT_FD_READ);
-         EVT_fd_remove(ctx, i, EVENT_FD_WRITE);
-         EVT_fd_remove(ctx, i, EVENT_FD_ERROR);
-      }
+      foundOne = 1;
+      fprintf(stderr, "\tFound fd %d for events: ", fd);
+      if (curr->cb[EVENT_FD_READ])
+         fprintf(stderr, "read ");
+      if (curr->cb[EVENT_FD_WRITE])
+         fprintf(stderr, "write ");
+      if (curr->cb[EVENT_FD_ERROR])
+         fprintf(stderr, "error ");
+      fprintf(stderr, "\n");
+
+      EVT_fd_remove(ctx, fd, EVENT_FD_READ);
+      EVT_fd_remove(ctx, fd, EVENT_FD_WRITE);
+      EVT_fd_remove(ctx, fd, EVENT_FD_ERROR);
    }
 
    return foundOne;
@@ -734,12 +1444,262 @@ void EVT_set_evt_timer(EVTHandler *ctx, struct EventTimer *et)
    assert(ctx);
    assert(et);
 
-   if (ctx->evt_timer)
-      ctx->evt_timer->cleanup(ctx->evt_timer);
-   
-   ctx->evt_timer = et;
+   evt_timer_detach(ctx);
+   evt_timer_attach(ctx, et);
    ctx->custom_timer = 1;
-   DBG_set_timer(et);
+}
+
+/**
+ * Replace the poller used to wait for fd events.  All currently registered
+ * fds are moved to the new poller.
+ *
+ * @param ctx  EVTHandler struct
+ * @param ep   The EventPoller instance.
+ *
+ * @return 0 on success, -1 if the fds could not be moved to the new poller.
+ *    The old poller remains in use on failure.
+ */
+char EVT_set_poller(EVTHandler *ctx, struct EventPoller *ep)
+{
+   struct EventPoller *old;
+   int fd;
+
+   assert(ctx);
+   assert(ep);
+
+   old = ctx->poller;
+   ctx->poller = ep;
+   for (fd = 0; fd <= ctx->maxFd; fd++)
+      if (ctx->fds[fd].used && ((ep->fd_limit && fd >= ep->fd_limit) ||
+               evt_fd_sync(ctx, fd, 1) < 0))
+         goto revert;
+
+   if (old)
+      old->cleanup(old);
+
+   return 0;
+
+revert:
+   ctx->poller = old;
+   for (fd = 0; fd <= ctx->maxFd; fd++)
+      if (ctx->fds[fd].used)
+         evt_fd_sync(ctx, fd, 1);
+
+   return -1;
+}
+
+/**
+ * Enable or disable the timing wheel used to hold timed events that are
+ * far in the future.
+ *
+ * @param ctx  EVTHandler struct
+ * @param resolution  Width of the finest wheel slot, or NULL to disable
+ *               the wheel.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+char EVT_set_timer_wheel(EVTHandler *ctx, struct timeval *resolution)
+{
+   struct timeval now;
+   uint64_t res;
+
+   assert(ctx);
+
+   if (ctx->wheel) {
+      evt_wheel_flush(ctx);
+      TW_free(ctx->wheel);
+      ctx->wheel = NULL;
+   }
+
+   if (!resolution)
+      return 0;
+
+   res = (uint64_t)resolution->tv_sec * 1000000 + resolution->tv_usec;
+   if (!res)
+      return -1;
+
+   ctx->wheel_res = res;
+   ctx->evt_timer->get_monotonic_time(ctx->evt_timer, &now);
+   ctx->wheel = TW_init(evt_wheel_tick(ctx, &now));
+   if (!ctx->wheel)
+      return -1;
+
+   return 0;
+}
+
+/**
+ * Read the occupancy of the handler's event storage pools.
+ *
+ * @param ctx  EVTHandler struct
+ * @param stats  Filled in with the pool counters.
+ */
+void EVT_get_pool_stats(EVTHandler *ctx, struct EVTPoolStats *stats)
+{
+   assert(ctx);
+   assert(stats);
+
+   SP_get_stats(ctx->sched_pool, &stats->sched);
+   memset(&stats->deferred, 0, sizeof(stats->deferred));
+   stats->deferred.obj_size = sizeof(struct DeferredEvent);
+   stats->deferred.slabs = ctx->defer_ring != NULL;
+   stats->deferred.total = ctx->defer_cap;
+   stats->deferred.in_use = ctx->defer_tail - ctx->defer_head;
+   stats->deferred.peak = ctx->defer_peak;
+}
+
+// Microseconds from start to end, 0 if the clock went backwards
+static uint64_t evt_elapsed_usec(struct timeval *start, struct timeval *end)
+{
+   struct timeval diff;
+
+   if (timercmp(end, start, <))
+      return 0;
+   timersub(end, start, &diff);
+
+   return (uint64_t)diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+static void evt_hist_add(struct EVTHistogram *hist, uint64_t usec)
+{
+   int bucket = usec ? 64 - __builtin_clzll(usec) : 0;
+
+   if (bucket >= EVT_HIST_BUCKETS)
+      bucket = EVT_HIST_BUCKETS - 1;
+
+   hist->buckets[bucket]++;
+   hist->count++;
+   hist->total_usec += usec;
+   if (usec > hist->max_usec)
+      hist->max_usec = usec > UINT32_MAX ? UINT32_MAX : usec;
+}
+
+// Per-event stats are allocated the first time the event runs with stats
+//  enabled.  On allocation failure only the loop wide totals are kept.
+static struct EVTEventStats *evt_event_stats(struct EVTEventStats **stats)
+{
+   if (!*stats)
+      *stats = calloc(1, sizeof(struct EVTEventStats));
+
+   return *stats;
+}
+
+/**
+ * Enable or disable timing of individual event callbacks.
+ *
+ * @param ctx  EVTHandler struct
+ * @param enable  Non-zero to time callbacks.
+ */
+void EVT_set_event_stats(EVTHandler *ctx, int enable)
+{
+   assert(ctx);
+
+   ctx->event_stats = enable ? 1 : 0;
+}
+
+/**
+ * Read the loop utilization and the callback timing totals.
+ *
+ * @param ctx  EVTHandler struct
+ * @param stats  Filled in with the loop statistics.
+ */
+void EVT_get_loop_stats(EVTHandler *ctx, struct EVTLoopStats *stats)
+{
+   assert(ctx);
+   assert(stats);
+
+   *stats = ctx->stats;
+   stats->loops = ctx->loop_counter;
+   stats->timed_events = ctx->timed_event_counter;
+   stats->fd_events = ctx->fd_event_counter;
+   stats->deferred_events = ctx->deferred_counter;
+}
+
+static void evt_visit_timed_stats(ScheduleCB *evt, EVT_event_stats_cb cb,
+      void *arg)
+{
+   const char *name;
+
+   if (!evt || !evt->stats)
+      return;
+
+   name = evt_name_str(evt->name);
+   if (!name)
+      name = get_function_name((void*)evt->callback);
+   (*cb)(arg, name, -1, -1, evt->stats);
+}
+
+/**
+ * Visit the callback timing of every registered event that has run with
+ * stats enabled.  The callback must not add or remove events.
+ *
+ * @param ctx  EVTHandler struct
+ * @param cb  Called for each event.  The fd is -1 for timed events.
+ * @param arg  Passed to the callback.
+ */
+void EVT_iterate_event_stats(EVTHandler *ctx, EVT_event_stats_cb cb,
+      void *arg)
+{
+   const char *name;
+   size_t i;
+   int fd, event;
+
+   assert(ctx);
+
+   evt_wheel_flush(ctx);
+   for (i = 0; i < ctx->batchLen; i++)
+      evt_visit_timed_stats(ctx->batch[i], cb, arg);
+   for (i = 0; i < MH_size(ctx->queue); i++)
+      evt_visit_timed_stats(MH_get(ctx->queue, i), cb, arg);
+   for (i = 0; i < MH_size(ctx->dbg_queue); i++)
+      evt_visit_timed_stats(MH_get(ctx->dbg_queue, i), cb, arg);
+
+   for (fd = 0; fd <= ctx->maxFd; fd++) {
+      if (!ctx->fds[fd].used)
+         continue;
+      for (event = 0; event < EVENT_MAX; event++) {
+         if (!ctx->fdInfo[fd].stats[event])
+            continue;
+         name = evt_name_str(ctx->fdInfo[fd].name);
+         if (!name)
+            name = get_function_name((void*)ctx->fds[fd].cb[event]);
+         (*cb)(arg, name, fd, event, ctx->fdInfo[fd].stats[event]);
+      }
+   }
+}
+
+static void evt_reset_timed_stats(ScheduleCB *evt)
+{
+   if (evt && evt->stats)
+      memset(evt->stats, 0, sizeof(*evt->stats));
+}
+
+/**
+ * Clear the loop utilization and every callback timing histogram.
+ *
+ * @param ctx  EVTHandler struct
+ */
+void EVT_reset_loop_stats(EVTHandler *ctx)
+{
+   size_t i;
+   int fd, event;
+
+   assert(ctx);
+
+   memset(&ctx->stats, 0, sizeof(ctx->stats));
+
+   evt_wheel_flush(ctx);
+   for (i = 0; i < ctx->batchLen; i++)
+      evt_reset_timed_stats(ctx->batch[i]);
+   for (i = 0; i < MH_size(ctx->queue); i++)
+      evt_reset_timed_stats(MH_get(ctx->queue, i));
+   for (i = 0; i < MH_size(ctx->dbg_queue); i++)
+      evt_reset_timed_stats(MH_get(ctx->dbg_queue, i));
+
+   for (fd = 0; fd <= ctx->maxFd; fd++)
+      for (event = 0; event < EVENT_MAX; event++)
+         if (ctx->fdInfo[fd].stats[event])
+            memset(ctx->fdInfo[fd].stats[event], 0,
+                  sizeof(struct EVTEventStats));
 }
 
 /**
@@ -786,9 +1746,31 @@ static void edbg_breakpoint(EVTHandler *ctx)
    edbg_report_state(ctx, ctx->full_dump_format);
 }
 
+static void evt_timed_event_stats(EVTHandler *ctx, ScheduleCB *evt,
+      struct timeval *start)
+{
+   struct EVTEventStats *stats;
+   struct timeval end;
+   uint64_t dur, late;
+
+   ctx->evt_timer->get_monotonic_time(ctx->evt_timer, &end);
+   dur = evt_elapsed_usec(start, &end);
+   late = evt_elapsed_usec(&evt->nextAwake, start);
+
+   evt_hist_add(&ctx->stats.timed.duration, dur);
+   evt_hist_add(&ctx->stats.timed.lateness, late);
+   if (evt != &ctx->null_evt && (stats = evt_event_stats(&evt->stats))) {
+      evt_hist_add(&stats->duration, dur);
+      evt_hist_add(&stats->lateness, late);
+   }
+}
+
 static int evt_process_timed_event(EVTHandler *ctx,
       ScheduleCB *curProc, struct timeval curTime, int stepping)
 {
+   struct timeval start;
+   int keep;
+
    if (!stepping && (ctx->break_on_next || curProc->breakpoint) ) {
       if (--ctx->steps_to_break <= 0) {
          ctx->next_timed_event = curProc;
@@ -803,73 +1785,120 @@ static int evt_process_timed_event(EVTHandler *ctx,
 
    // Call the callback and see if it wants to be kept
    curProc->inCallback = 1;
-   if (curProc->callback(curProc->arg) == EVENT_KEEP) {
+   if (ctx->event_stats)
+      ctx->evt_timer->get_monotonic_time(ctx->evt_timer, &start);
+   keep = curProc->callback(curProc->arg);
+   if (ctx->event_stats)
+      evt_timed_event_stats(ctx, curProc, &start);
+
+   if (keep == EVENT_KEEP) {
       if (curProc->inCallback == 1) {
          curProc->scheduleTime = curTime;
          timeradd(&curProc->nextAwake,
             &curProc->timeStep, &curProc->nextAwake);
       }
       curProc->inCallback = 0;
-      ps_pqueue_insert(curProc->queue, curProc);
+      evt_sched_enqueue(ctx, curProc);
    } else {
       if (curProc->critical)
          ctx->critical_sched_count--;
 
       if (curProc != &ctx->null_evt) {
-         free(curProc);
+         evt_sched_free(ctx, curProc);
       }
    }
 
    return 1;
 }
 
-int evt_process_fd_event(EVTHandler *ctx, struct EventCB **evtCurr, int event,
-      int stepping)
+static void evt_fd_event_stats(EVTHandler *ctx, int fd, int event,
+      struct timeval *start)
+{
+   struct EVTEventStats *stats;
+   struct timeval end;
+   uint64_t dur;
+
+   ctx->evt_timer->get_monotonic_time(ctx->evt_timer, &end);
+   dur = evt_elapsed_usec(start, &end);
+
+   evt_hist_add(&ctx->stats.fd.duration, dur);
+   // The callback may have removed itself
+   if (ctx->fds[fd].cb[event] &&
+         (stats = evt_event_stats(&ctx->fdInfo[fd].stats[event])))
+      evt_hist_add(&stats->duration, dur);
+}
+
+// Runs the callback for a ready fd event.  ran, when not NULL, is set to
+//  whether a callback actually ran.
+int evt_process_fd_event(EVTHandler *ctx, int fd, int event, int stepping,
+      int *ran)
 {
+   struct timeval start;
    int keep = EVENT_KEEP;
+   EventCB *evtCurr = evt_fd_lookup(ctx, fd);
 
-   if (!evtCurr || !*evtCurr)
+   if (ran)
+      *ran = 0;
+
+   // A one-shot fd already reported since it was last armed, possibly for
+   //  another event type in the same wakeup
+   if (!evtCurr || evtCurr->disarmed)
       return 1;
 
-   if (!stepping && (*evtCurr)->pausable &&
-         (ctx->break_on_next || (*evtCurr)->breakpoint[event])) {
+   if (!stepping && evtCurr->pausable &&
+         (ctx->break_on_next || ctx->fdInfo[fd].breakpoint[event])) {
       if (--ctx->steps_to_break <= 0) {
-         ctx->next_fd_event = *evtCurr;
+         ctx->next_fd_event = fd;
          ctx->next_fd_event_evt = event;
          edbg_breakpoint(ctx);
          return 0;
       }
    }
 
-   if ((*evtCurr)->cb[event]) {
-      (*evtCurr)->counts[event]++;
-      (*evtCurr)->inCallback[event] = 1;
-      keep = (*(*evtCurr)->cb[event])((*evtCurr)->fd, event,
-                        (*evtCurr)->arg[event]);
+   if (evtCurr->cb[event]) {
+      // Disarm before the callback so it can rearm.  Pollers that implement
+      //  one-shot mode have already disarmed the fd themselves, leaving the
+      //  stale mask in polled so rearming has to force a sync.
+      if ((evtCurr->mode & EVT_FD_ONESHOT) && !evtCurr->disarmed) {
+         evtCurr->disarmed = 1;
+         if (!(ctx->poller->native & EP_ONESHOT))
+            evt_fd_sync(ctx, fd, 0);
+      }
+      evtCurr->counts[event]++;
+      evtCurr->inCallback[event] = 1;
+      if (ran)
+         *ran = 1;
+      if (ctx->event_stats)
+         ctx->evt_timer->get_monotonic_time(ctx->evt_timer, &start);
+      keep = (*evtCurr->cb[event])(fd, event, evtCurr->arg[event]);
+      if (ctx->event_stats)
+         evt_fd_event_stats(ctx, fd, event, &start);
       ctx->fd_event_counter++;
+      // The callback may have grown the table
+      evtCurr = &ctx->fds[fd];
    }
 
-   if ((*evtCurr)->inCallback[event] == 3 || 
-         (EVENT_REMOVE == keep && (*evtCurr)->inCallback[event] == 1)) {
-      (*evtCurr)->inCallback[event] = 0;
-      EVT_remove_internal(ctx, evtCurr, event);
+   if (evtCurr->inCallback[event] == 3 || 
+         (EVENT_REMOVE == keep && evtCurr->inCallback[event] == 1)) {
+      evtCurr->inCallback[event] = 0;
+      EVT_remove_internal(ctx, fd, event);
    }
    else
-      (*evtCurr)->inCallback[event] = 0;
+      evtCurr->inCallback[event] = 0;
 
    return 1;
 }
 
-struct EVT_select_cb_args {
-   fd_set *eventSetPtrs[EVENT_MAX];
-   int maxFd;
+struct EVT_poll_cb_args {
+   struct EventPoller *poller;
+   struct EP_ready *ready;
    struct timeval *mono_to;
 };
 
-static int select_event_loop_cb(struct EventTimer *et,
+static int poll_event_loop_cb(struct EventTimer *et,
     struct timeval *nextAwake, void *opaque)
 {
-   struct EVT_select_cb_args *args = (struct EVT_select_cb_args*)opaque;
+   struct EVT_poll_cb_args *args = (struct EVT_poll_cb_args*)opaque;
    struct timeval *to = nextAwake, now, diff;
 
    if (args->mono_to) {
@@ -883,9 +1912,7 @@ static int select_event_loop_cb(struct EventTimer *et,
          to = &diff;
    }
 
-   return select(args->maxFd, args->eventSetPtrs[EVENT_FD_READ],
-                  args->eventSetPtrs[EVENT_FD_WRITE],
-                  args->eventSetPtrs[EVENT_FD_ERROR], to);
+   return (*args->poller->wait)(args->poller, to, &args->ready);
 }
 
 static int edbg_response_timeout(void *arg)
@@ -897,6 +1924,12 @@ static int edbg_response_timeout(void *arg)
    return EVENT_KEEP;
 }
 
+// Checks whether a class may run another callback this iteration
+static int evt_prio_budget_left(EVTHandler *ctx, int prio)
+{
+   return !ctx->budget[prio] || ctx->dispatched[prio] < ctx->budget[prio];
+}
+
 char EVT_start_loop(EVTHandler *ctx)
 {
    return EVT_start_loop_auto_exit(ctx, EVT_NEVER_EXIT);
@@ -904,26 +1937,34 @@ char EVT_start_loop(EVTHandler *ctx)
 
 char EVT_start_loop_auto_exit(EVTHandler *ctx, int auto_exit)
 {
-   fd_set eventSets[EVENT_MAX];
-   struct EVT_select_cb_args args;
-   int i;
+   struct EVT_poll_cb_args args;
+   int i, first;
+   size_t b;
    int retval;
-   int event, fd;
-   struct EventCB **evtCurr;
+   int event;
+   struct EP_ready *ready;
    int startEvent = EVENT_FD_READ;
    int startFd = 0;
-   struct timeval curTime, *nextAwake;
+   struct timeval curTime, *nextAwake, wheelAwake, blockStart, dbgTime;
+   uint64_t wheelTick;
    ScheduleCB *curProc;
    int time_paused = 0;
    int fd_paused = 0;
+   int timing;
    int real_event;
    int remaining_work;
-   struct DeferredEvent *def;
+   int prio, fd, ran;
+   unsigned int classes;
+
+   // The loop may run on a different thread than created the handler
+   global_evt = ctx;
+   DBG_set_timer(ctx->evt_timer);
 
    ctx->in_loop = 1;
    ctx->keepGoing = 1;
    ctx->break_on_next = ctx->initialDebuggerState == EDBG_STOPPED;
    edbg_init(ctx);
+   ctx->evt_timer->get_monotonic_time(ctx->evt_timer, &ctx->stats_mark);
 
    while(ctx->keepGoing) {
       PT_run_all();
@@ -939,49 +1980,56 @@ char EVT_start_loop_auto_exit(EVTHandler *ctx, int auto_exit)
          ctx->debuggerState = EDBG_ENABLED;
          real_event = 1;
       }
-      if (ctx->dbg_step && ctx->next_fd_event) {
-         evt_process_fd_event(ctx, &ctx->next_fd_event,
-               ctx->next_fd_event_evt, 1);
-         ctx->next_fd_event = NULL;
+      if (ctx->dbg_step && ctx->next_fd_event >= 0) {
+         evt_process_fd_event(ctx, ctx->next_fd_event,
+               ctx->next_fd_event_evt, 1, NULL);
+         ctx->next_fd_event = -1;
          ctx->debuggerState = EDBG_ENABLED;
          real_event = 1;
       }
       ctx->dbg_step = 0;
 
-      time_paused = fd_paused = ctx->next_timed_event || ctx->next_fd_event ||
+      time_paused = fd_paused = ctx->next_timed_event ||
+         ctx->next_fd_event >= 0 ||
          ctx->dbg_reply_evt;
 
-      for (i = 0; i < EVENT_MAX; i++) {
-         if (ctx->eventCnt[i] > 0) {
-            args.eventSetPtrs[i] = &eventSets[i];
-            if (fd_paused)
-				   memcpy(args.eventSetPtrs[i], &ctx->blockedSet[i],
-                     sizeof(*(&ctx->blockedSet[i])));
-            else
-				   memcpy(args.eventSetPtrs[i], &ctx->eventSet[i],
-                     sizeof(*(&ctx->eventSet[i])));
-         }
-         else
-            args.eventSetPtrs[i] = NULL;
+      // Only watch the unpaused fds while the debugger has us stopped
+      if (fd_paused != ctx->fds_paused) {
+         ctx->fds_paused = fd_paused;
+         for (i = 0; i <= ctx->maxFd; i++)
+            if (ctx->fds[i].used)
+               evt_fd_sync(ctx, i, 0);
       }
 
-      args.maxFd = ctx->maxFd + 1;
+      args.poller = ctx->poller;
+      args.ready = NULL;
       args.mono_to = NULL;
 
-      curProc = ps_pqueue_peek(ctx->queue);
+      curProc = MH_peek(ctx->queue);
       if (!time_paused && curProc)
-         nextAwake = &curProc->nextAwake;
+         nextAwake = &curProc->expires;
       else
          nextAwake = NULL;
 
-      curProc = ps_pqueue_peek(ctx->dbg_queue);
+      // Wake up when the next wheel slot starts so its events can be moved
+      //  to the exact queue
+      if (!time_paused && ctx->wheel &&
+            (wheelTick = TW_next(ctx->wheel)) != UINT64_MAX) {
+         wheelTick *= ctx->wheel_res;
+         wheelAwake.tv_sec = wheelTick / 1000000;
+         wheelAwake.tv_usec = wheelTick % 1000000;
+         if (!nextAwake || timercmp(&wheelAwake, nextAwake, <))
+            nextAwake = &wheelAwake;
+      }
+
+      curProc = MH_peek(ctx->dbg_queue);
       if (curProc)
-         args.mono_to = &curProc->nextAwake;
+         args.mono_to = &curProc->expires;
 
       // Check to see if we need to auto-stop the event loop
       if (ctx->critical_sched_count > 0)
          remaining_work |= EVT_EXIT_SCHED;
-      if (ctx->critical_fd_count > 0)
+      if (ctx->critical_fd_count > 0 || ctx->critical_post_count > 0)
          remaining_work |= EVT_EXIT_FD;
       
       if (auto_exit && !(auto_exit & remaining_work)) {
@@ -989,70 +2037,115 @@ char EVT_start_loop_auto_exit(EVTHandler *ctx, int auto_exit)
          break;
       }
 
-      // Call blocking function of event timer
+      // Call blocking function of event timer.  Time spent blocked is idle,
+      //  everything between wakeups is busy.
+      timing = ctx->event_stats;
+      if (timing)
+         ctx->evt_timer->get_monotonic_time(ctx->evt_timer, &blockStart);
       retval = ctx->evt_timer->block(ctx->evt_timer, nextAwake, time_paused,
-                     &select_event_loop_cb, &args);
-
-      // Process Timed Events
-      while (!time_paused && (curProc = ps_pqueue_peek(ctx->queue))) {
-         ctx->evt_timer->get_monotonic_time(ctx->evt_timer, &curTime);
+                     &poll_event_loop_cb, &args);
+      ctx->evt_timer->get_monotonic_time(ctx->evt_timer, &curTime);
+      if (timing) {
+         ctx->stats.busy_usec += evt_elapsed_usec(&ctx->stats_mark,
+               &blockStart);
+         ctx->stats.idle_usec += evt_elapsed_usec(&blockStart, &curTime);
+      }
+      ctx->stats_mark = curTime;
+
+      // Process Timed Events.  The clock is read once and every due event
+      //  is collected before any callback runs.  Events rescheduled by the
+      //  callbacks wait for the next iteration.
+      if (!time_paused) {
+         if (ctx->wheel)
+            TW_advance(ctx->wheel, evt_wheel_tick(ctx, &curTime),
+                  &evt_wheel_release, ctx);
+         evt_sched_collect(ctx, &curTime);
+      }
 
-         if (timercmp(&curProc->nextAwake, &curTime, >)) {
+      ET_default_monotonic(NULL, &dbgTime);
+      while ((curProc = MH_peek(ctx->dbg_queue))) {
+         if (timercmp(&curProc->nextAwake, &dbgTime, >)) {
             // Event is not yet ready
             break;
          }
-         ps_pqueue_pop(ctx->queue);
-         curProc->pos = SIZE_MAX;
-         if (!evt_process_timed_event(ctx, curProc, curTime, 0))
-            goto next_loop_iteration;
-         real_event = 1;
+         MH_pop(ctx->dbg_queue);
+         evt_process_timed_event(ctx, curProc, dbgTime, 1);
       }
 
-      while ((curProc = ps_pqueue_peek(ctx->dbg_queue))) {
-         ET_default_monotonic(NULL, &curTime);
+      classes = 0;
+      first = 0;
+      if (retval > 0 && args.ready) {
+         // Rotate the starting fd and event type to keep dispatch fair
+         startFd = (startFd + 1) % (ctx->maxFd + 1);
+         for (first = 0; first < retval && args.ready[first].fd < startFd;
+               first++)
+            ;
+         if (first == retval)
+            first = 0;
+
+         for (i = 0; i < retval; i++)
+            if ((fd = args.ready[i].fd) < ctx->fdCap)
+               classes |= 1 << ctx->fds[fd].prio;
+      }
 
-         if (timercmp(&curProc->nextAwake, &curTime, >)) {
-            // Event is not yet ready
-            break;
+      // Each priority class runs its due timed events and then its ready
+      //  fds before the next class starts, so a higher class never waits on
+      //  a lower class's work.  Each class runs at most its budget of
+      //  callbacks per iteration, timed and fd events combined.
+      memset(ctx->dispatched, 0, sizeof(ctx->dispatched));
+      for (prio = 0; prio < EVT_PRIO_CLASSES; prio++) {
+         for (b = 0; b < ctx->batchLen; b++) {
+            // Skip events removed or rescheduled by an earlier callback
+            if (!(curProc = ctx->batch[b]) || curProc->prio != prio)
+               continue;
+            if (!evt_prio_budget_left(ctx, prio))
+               break;
+            ctx->batch[b] = NULL;
+            curProc->batched = 0;
+            curProc->pos = MH_NOT_QUEUED;
+            ctx->dispatched[prio]++;
+            if (!evt_process_timed_event(ctx, curProc, curTime, 0)) {
+               evt_sched_requeue_batch(ctx, 0);
+               goto next_loop_iteration;
+            }
+            real_event = 1;
          }
-         curProc->pos = SIZE_MAX;
-         ps_pqueue_pop(ctx->dbg_queue);
-         evt_process_timed_event(ctx, curProc, curTime, 1);
-      }
 
-      /* Process FD events */
-      if (retval > 0) {
+         if (!(classes & (1 << prio)))
+            continue;
          event = startEvent;
-         startFd = (startFd + 1) % args.maxFd;
-
          do {
-            if (args.eventSetPtrs[event]) {
-               fd = startFd;
-               do {
-                  if (FD_ISSET(fd, args.eventSetPtrs[event])) {
-                     retval--;
-                     for(evtCurr = &ctx->events[fd % ctx->hashSize];
-                           *evtCurr; evtCurr = &(*evtCurr)->next) {
-                        if ((*evtCurr)->fd != fd)
-                           continue;
-                        if (!evt_process_fd_event(ctx, evtCurr, event, 0))
-                           goto next_loop_iteration;
-                        real_event = 1;
-                        break;
-                     }
-                  }
-                  fd = (fd + 1) % args.maxFd;
-               } while (retval > 0 && fd != startFd);
+            for (i = 0; i < retval; i++) {
+               ready = &args.ready[(first + i) % retval];
+               fd = ready->fd;
+               if (!(ready->events & EP_MASK(event)) ||
+                     fd >= ctx->fdCap || ctx->fds[fd].prio != prio)
+                  continue;
+               // Level-triggered fds over budget are reported again by
+               //  the next wait.  The others wouldn't be, so they run.
+               if (!evt_prio_budget_left(ctx, prio) && !ctx->fds[fd].mode)
+                  continue;
+               if (!evt_process_fd_event(ctx, fd, event, 0, &ran)) {
+                  evt_sched_requeue_batch(ctx, 0);
+                  goto next_loop_iteration;
+               }
+               if (ran) {
+                  ctx->dispatched[prio]++;
+                  real_event = 1;
+               }
             }
 
             event = (event + 1) % EVENT_MAX;
-         } while (retval > 0 && event != startEvent);
-         startEvent = (startEvent + 1) % EVENT_MAX;
+         } while (event != startEvent);
       }
+      // Events over budget are still due, so the next wait won't block
+      evt_sched_requeue_batch(ctx, 0);
+      if (classes)
+         startEvent = (startEvent + 1) % EVENT_MAX;
 
       /* Recover from a select few errors.  Stop the event loop and
          gripe for all others */
-      else if (retval == -1) {
+      if (retval == -1) {
          if (errno == 0 || errno == EINTR) {
             ctx->loop_counter++;
             continue;
@@ -1070,13 +2163,7 @@ char EVT_start_loop_auto_exit(EVTHandler *ctx, int auto_exit)
       }
 
 next_loop_iteration:
-      // Run the deferred events
-      while ((def = ctx->deferred)) {
-         ctx->deferred = def->next;
-         if (def->cb)
-            def->cb(def->arg);
-         free(def);
-      }
+      ctx->deferred_last = evt_run_deferred(ctx);
 
       if (ctx->debuggerState != EDBG_DISABLED && ctx->evt_timer->virt_get_pause
             && ctx->cmds_pending) {
@@ -1105,6 +2192,11 @@ next_loop_iteration:
          edbg_report_state(ctx, ctx->full_dump_format);
    }
 
+   // Count the time since the last wakeup
+   if (ctx->event_stats) {
+      ctx->evt_timer->get_monotonic_time(ctx->evt_timer, &curTime);
+      ctx->stats.busy_usec += evt_elapsed_usec(&ctx->stats_mark, &curTime);
+   }
    ctx->in_loop = 0;
 
    return 0;
@@ -1127,14 +2219,18 @@ next_loop_iteration:
  */
 void *EVT_defer_add(EVTHandler *handler, EVT_sched_cb cb, void *arg)
 {
-   if (handler->in_loop) {
-      struct DeferredEvent *def = (struct DeferredEvent*)malloc(sizeof(*def));
+   struct DeferredEvent *def;
+   uintptr_t seq;
+
+   if (handler->in_loop && (def = evt_defer_slot(handler))) {
       def->cb = cb;
       def->arg = arg;
-      def->next = handler->deferred;
-      handler->deferred = def;
+      seq = handler->defer_tail++;
+      if (handler->defer_tail - handler->defer_head > handler->defer_peak)
+         handler->defer_peak = handler->defer_tail - handler->defer_head;
 
-      return def;
+      // Keys are sequence numbers offset by one so they are never NULL
+      return (void*)(seq + 1);
    }
 
    cb(arg);
@@ -1150,10 +2246,12 @@ void *EVT_defer_add(EVTHandler *handler, EVT_sched_cb cb, void *arg)
  */
 void EVT_defer_cancel(EVTHandler *handler, void *arg)
 {
-   struct DeferredEvent *def = (struct DeferredEvent*)arg;
+   uintptr_t seq = (uintptr_t)arg - 1;
 
-   if (def)
-      def->cb = NULL;
+   // Callbacks that already ran are outside the ring's window
+   if (arg && seq - handler->defer_head < handler->defer_tail -
+         handler->defer_head)
+      handler->defer_ring[seq & (handler->defer_cap - 1)].cb = NULL;
 }
 
 /**
@@ -1172,11 +2270,10 @@ void *EVT_sched_add(EVTHandler *handler, struct timeval time,
 {
    ScheduleCB *newSchedCB;
 
-   newSchedCB = malloc(sizeof(ScheduleCB));
+   newSchedCB = evt_sched_alloc(handler);
    if (!newSchedCB){
      return NULL;
    }
-   memset(newSchedCB, 0, sizeof(*newSchedCB));
 
    handler->evt_timer->get_monotonic_time(handler->evt_timer, &newSchedCB->scheduleTime);
    newSchedCB->timeStep = time;
@@ -1186,12 +2283,12 @@ void *EVT_sched_add(EVTHandler *handler, struct timeval time,
    newSchedCB->queue = handler->queue;
    newSchedCB->critical = 1;
 
-   if (0 == ps_pqueue_insert(newSchedCB->queue, newSchedCB)){
+   if (0 == evt_sched_enqueue(handler, newSchedCB)){
      handler->critical_sched_count++;
      return newSchedCB;
    }
 
-   free(newSchedCB);
+   evt_sched_free(handler, newSchedCB);
    return NULL;
 }
 
@@ -1212,10 +2309,9 @@ void *EVT_sched_add_with_timestep(EVTHandler *handler, struct timeval time,
 {
    ScheduleCB *newSchedCB;
 
-   newSchedCB = malloc(sizeof(ScheduleCB));
+   newSchedCB = evt_sched_alloc(handler);
    if (!newSchedCB)
       return NULL;
-   memset(newSchedCB, 0, sizeof(*newSchedCB));
 
    handler->evt_timer->get_monotonic_time(handler->evt_timer, &newSchedCB->scheduleTime);
    newSchedCB->timeStep = timestep;
@@ -1225,12 +2321,12 @@ void *EVT_sched_add_with_timestep(EVTHandler *handler, struct timeval time,
    newSchedCB->queue = handler->queue;
    newSchedCB->critical = 1;
 
-   if (0 == ps_pqueue_insert(newSchedCB->queue, newSchedCB)){
+   if (0 == evt_sched_enqueue(handler, newSchedCB)){
       handler->critical_sched_count++;
       return newSchedCB;
    }
 
-   free(newSchedCB);
+   evt_sched_free(handler, newSchedCB);
    return NULL;
 }
 
@@ -1272,21 +2368,58 @@ void *EVT_sched_remove(EVTHandler *handler, void *eventId)
    if (handler->next_timed_event == evt)
       handler->next_timed_event = &handler->null_evt;
 
-   if (SIZE_MAX == evt->pos) {
-      result = evt->arg;
-      if (evt != &handler->null_evt)
-         free(evt);
-   }
-   else if (0 == ps_pqueue_remove(evt->queue, eventId)) {
-      evt->pos = SIZE_MAX;
-      result = evt->arg;
-      if (evt != &handler->null_evt)
-         free(evt);
-   }
+   evt_sched_dequeue(handler, evt);
+   result = evt->arg;
+   if (evt != &handler->null_evt)
+      evt_sched_free(handler, evt);
 
    return result;
 }
 
+EVT_sched_handle EVT_sched_get_handle(EVTHandler *handler, void *eventId)
+{
+   ScheduleCB *evt = (ScheduleCB*)eventId;
+
+   if (!evt || evt->slot == SCHED_NO_SLOT)
+      return EVT_SCHED_HANDLE_NONE;
+
+   return ((uint64_t)handler->slots[evt->slot].gen << 32) | evt->slot;
+}
+
+void *EVT_sched_lookup(EVTHandler *handler, EVT_sched_handle handle)
+{
+   uint32_t slot = (uint32_t)handle;
+
+   if (slot >= handler->slotCap ||
+         handler->slots[slot].gen != (uint32_t)(handle >> 32))
+      return NULL;
+
+   return handler->slots[slot].evt;
+}
+
+void *EVT_sched_remove_handle(EVTHandler *handler, EVT_sched_handle handle)
+{
+   return EVT_sched_remove(handler, EVT_sched_lookup(handler, handle));
+}
+
+char EVT_sched_update_handle(EVTHandler *handler, EVT_sched_handle handle,
+      struct timeval time)
+{
+   return EVT_sched_update(handler, EVT_sched_lookup(handler, handle), time);
+}
+
+char EVT_sched_remaining_handle(EVTHandler *handler, EVT_sched_handle handle,
+      struct timeval *remaining)
+{
+   void *evt = EVT_sched_lookup(handler, handle);
+
+   if (!evt)
+      return 1;
+
+   *remaining = EVT_sched_remaining(handler, evt);
+   return 0;
+}
+
 /**
  * Update event callback time.  The new full time will elapse before
  *   the callback is called.
@@ -1313,8 +2446,10 @@ char EVT_sched_update(EVTHandler *handler, void *eventId, struct timeval time)
 
    timeradd(&evt->scheduleTime, &time, &evt->nextAwake);
    evt->timeStep = time;
-   if (!evt->inCallback)
-      ps_pqueue_change_priority(evt->queue, evt->nextAwake, evt);
+   if (!evt->inCallback) {
+      if (0 == evt_sched_dequeue(handler, evt))
+         evt_sched_enqueue(handler, evt);
+   }
    else
       evt->inCallback = 2;
 
@@ -1339,11 +2474,11 @@ char EVT_sched_move_to_mono(EVTHandler *handler, void *eventId)
       return 1;
    }
 
-   ps_pqueue_remove(evt->queue, eventId);
+   evt_sched_dequeue(handler, evt);
    ET_default_monotonic(NULL, &evt->scheduleTime);
    timeradd(&evt->scheduleTime, &evt->timeStep, &evt->nextAwake);
    evt->queue = handler->dbg_queue;
-   ps_pqueue_insert(evt->queue, evt);
+   evt_sched_enqueue(handler, evt);
    if (evt->critical)
       handler->critical_sched_count--;
    evt->critical = 0;
@@ -1381,52 +2516,100 @@ char EVT_sched_update_partial_credit(EVTHandler *handler, void *eventId,
       evt->nextAwake = now;
 
    evt->timeStep = time;
-   if (!evt->inCallback)
-      ps_pqueue_change_priority(evt->queue, evt->nextAwake, evt);
+   if (!evt->inCallback) {
+      if (0 == evt_sched_dequeue(handler, evt))
+         evt_sched_enqueue(handler, evt);
+   }
    else
       evt->inCallback = 2;
 
    return 0;
 }
 
+/**
+ * Allow a scheduled event to run late so its wakeup can be shared with
+ * other events.
+ *
+ * @param handler The event handler.
+ * @param eventId The event to change.
+ * @param slack The longest the event may be delayed past its deadline.
+ *
+ * @return 0 on success, other value on failure
+ */
+char EVT_sched_set_slack(EVTHandler *handler, void *eventId,
+      struct timeval slack)
+{
+   ScheduleCB *evt = (ScheduleCB*)eventId;
+   uint64_t usec;
+
+   if (!evt || slack.tv_sec < 0 || slack.tv_usec < 0)
+      return -1;
+
+   usec = (uint64_t)slack.tv_sec * 1000000 + slack.tv_usec;
+   evt->slack = usec > UINT32_MAX ? UINT32_MAX : usec;
+
+   // Events in a callback are requeued, and pick up the slack, afterwards
+   if (!evt->inCallback && 0 == evt_sched_dequeue(handler, evt))
+      evt_sched_enqueue(handler, evt);
+
+   return 0;
+}
+
 void EVT_sched_set_name(void *eventId, const char *fmt, ...)
 {
    va_list ap;
    ScheduleCB *evt = (ScheduleCB*)eventId;
 
    va_start(ap, fmt);
-   vsnprintf(evt->name, sizeof(evt->name), fmt, ap);
+   evt_name_vset(&evt->name, fmt, ap);
    va_end(ap);
-   evt->name[sizeof(evt->name) - 1] = 0;
 }
 
 void EVT_fd_set_critical(EVTHandler *ctx, int fd, int critical)
 {
-   struct EventCB *curr;
+   EventCB *curr = evt_fd_lookup(ctx, fd);
 
-   for (curr = ctx->events[fd % ctx->hashSize]; curr; curr = curr->next) {
-      if (curr->fd == fd) {
-         if (curr->critical && !critical)
-            ctx->critical_fd_count--;
-         else if (!curr->critical && critical)
-            ctx->critical_fd_count++;
-         curr->critical = critical;
-      }
+   if (curr) {
+      if (curr->critical && !critical)
+         ctx->critical_fd_count--;
+      else if (!curr->critical && critical)
+         ctx->critical_fd_count++;
+      curr->critical = critical;
    }
 }
 
+void EVT_fd_set_priority(EVTHandler *ctx, int fd, int prio)
+{
+   EventCB *curr = evt_fd_lookup(ctx, fd);
+
+   if (curr && prio >= 0 && prio < EVT_PRIO_CLASSES)
+      curr->prio = prio;
+}
+
+void EVT_sched_set_priority(EVTHandler *ctx, void *eventId, int prio)
+{
+   ScheduleCB *evt = (ScheduleCB*)eventId;
+
+   if (evt && prio >= 0 && prio < EVT_PRIO_CLASSES)
+      evt->prio = prio;
+}
+
+void EVT_set_priority_budget(EVTHandler *ctx, int prio, unsigned int budget)
+{
+   if (prio >= 0 && prio < EVT_PRIO_CLASSES)
+      ctx->budget[prio] = budget;
+}
+
 void EVT_fd_set_name(EVTHandler *ctx, int fd, const char *fmt, ...)
 {
    va_list ap;
-   struct EventCB *curr;
-
-   for (curr = ctx->events[fd % ctx->hashSize]; curr; curr = curr->next) {
-      if (curr->fd == fd) {
-         va_start(ap, fmt);
-         vsnprintf(curr->name, sizeof(curr->name), fmt, ap);
-         va_end(ap);
-         curr->name[sizeof(curr->name) - 1] = 0;
-      }
+   struct EventCBInfo *info;
+
+   if (evt_fd_lookup(ctx, fd)) {
+      info = &ctx->fdInfo[fd];
+      va_start(ap, fmt);
+      evt_name_vset(&info->name, fmt, ap);
+      va_end(ap);
    }
 }
 
@@ -1688,18 +2871,19 @@ static int edbg_client_msg(struct ZMQLClient *client, const void *data,
    else if (!strcasecmp(cmd, "set_timed_breakpoint") || 
             !strcasecmp(cmd, "clear_timed_breakpoint") ) {
       evt = NULL;
+      evt_wheel_flush(ctx);
       if (json_get_ptr_prop(data, dataLen, "id", &id) >= 0) {
-         for (i = 1; !evt && i <=  ps_pqueue_size(ctx->queue); i++)
-            if (ctx->queue->d[i] == id)
+         for (i = 0; !evt && i < MH_size(ctx->queue); i++)
+            if (MH_get(ctx->queue, i) == id)
                evt = id;
       }
       else if (json_get_string_prop(data, dataLen, "function", &func) >= 0) {
          if (func) {
             id = dlsym(RTLD_DEFAULT, func);
             free(func);
-            for (i = 1; id && !evt && i <=  ps_pqueue_size(ctx->queue); i++)
-               if ( ((ScheduleCB*)ctx->queue->d[i])->callback == id)
-                  evt = ctx->queue->d[i];
+            for (i = 0; id && !evt && i < MH_size(ctx->queue); i++)
+               if ( ((ScheduleCB*)MH_get(ctx->queue, i))->callback == id)
+                  evt = MH_get(ctx->queue, i);
          }
       }
 
@@ -1762,13 +2946,8 @@ static void edbg_init(EVTHandler *ctx)
          et = ET_rtdebug_init();
 
       if (et) {
-         if (ctx->evt_timer) {
-            DBG_set_timer(NULL);
-            ctx->evt_timer->cleanup(ctx->evt_timer);
-         }
-   
-         ctx->evt_timer = et;
-         DBG_set_timer(et);
+         evt_timer_detach(ctx);
+         evt_timer_attach(ctx, et);
       }
    }
 
@@ -1804,6 +2983,7 @@ static void edbg_report_timed_event(struct IPCBuffer *json, ScheduleCB *data,
 {
    struct timeval remain;
    const char *rem_sign = "";
+   const char *name = evt_name_str(data->name);
 
    if (timercmp(&data->nextAwake, cur_time, >=))
       timersub(&data->nextAwake, cur_time, &remain);
@@ -1823,7 +3003,7 @@ static void edbg_report_timed_event(struct IPCBuffer *json, ScheduleCB *data,
          "      \"function\":\"%s\",\n"
          "      \"critical\":%d,\n",
          (uintptr_t)data,
-         data->name[0] ? data->name : get_function_name((void *)data->callback),
+         name ? name : get_function_name((void *)data->callback),
          get_function_name((void *)data->callback), data->critical);
 
    ipc_printf_buffer(json,
@@ -1856,22 +3036,26 @@ static void edbg_report_timed_events(struct IPCBuffer *json, EVTHandler *ctx,
       first = 0;
    }
 
-   for (i = 1; i <=  ps_pqueue_size(ctx->queue); i++) {
-      edbg_report_timed_event(json, (ScheduleCB *)ctx->queue->d[i],
+   evt_wheel_flush(ctx);
+   for (i = 0; i < MH_size(ctx->queue); i++) {
+      edbg_report_timed_event(json, MH_get(ctx->queue, i),
             cur_time, first);
       first = 0;
    }
    ipc_printf_buffer(json, "\n  ],\n");
 }
 
-static void edbg_report_fd_event(struct IPCBuffer *json, struct EventCB *data,
-      int first)
+static void edbg_report_fd_event(struct IPCBuffer *json, EVTHandler *ctx,
+      int fd, int first)
 {
    char fd_path_buff[32];
    char filename[1024];
    int len;
+   EventCB *data = &ctx->fds[fd];
+   struct EventCBInfo *info = &ctx->fdInfo[fd];
+   const char *name = evt_name_str(info->name);
 
-   sprintf(fd_path_buff, "/proc/self/fd/%d", data->fd);
+   sprintf(fd_path_buff, "/proc/self/fd/%d", fd);
    if ((len = readlink(fd_path_buff, filename, 1023)) < 0)
       return;
    filename[len] = 0;
@@ -1886,7 +3070,7 @@ static void edbg_report_fd_event(struct IPCBuffer *json, struct EventCB *data,
          "      \"name\":\"%s\",\n"
          "      \"filename\":\"%s\",\n"
          "      \"arg_pointer\":%"PRIdPTR",\n",
-         (uintptr_t)data, data->name[0] ? data->name : filename,
+         (uintptr_t)fd, name ? name : filename,
          filename, (uintptr_t)data->arg);
 
    if (data->cb[EVENT_FD_READ])
@@ -1909,9 +3093,9 @@ static void edbg_report_fd_event(struct IPCBuffer *json, struct EventCB *data,
          "      \"error_breakpoint\":%s,\n",
          json_bool(data->pausable),
          data->critical,
-         json_bool(data->breakpoint[EVENT_FD_READ]),
-         json_bool(data->breakpoint[EVENT_FD_WRITE]),
-         json_bool(data->breakpoint[EVENT_FD_ERROR]));
+         json_bool(info->breakpoint[EVENT_FD_READ]),
+         json_bool(info->breakpoint[EVENT_FD_WRITE]),
+         json_bool(info->breakpoint[EVENT_FD_ERROR]));
 
    ipc_printf_buffer(json,
          "      \"read_count\":%u,\n"
@@ -1920,19 +3104,18 @@ static void edbg_report_fd_event(struct IPCBuffer *json, struct EventCB *data,
          "      \"fd\":%d\n"
          "    }",
          data->counts[EVENT_FD_READ], data->counts[EVENT_FD_WRITE],
-         data->counts[EVENT_FD_ERROR], data->fd);
+         data->counts[EVENT_FD_ERROR], fd);
 }
 
 static void edbg_report_fd_events(struct IPCBuffer *json, EVTHandler *ctx)
 {
-   int i, first = 1;
-   struct EventCB *curr;
+   int fd, first = 1;
 
    ipc_printf_buffer(json, "  \"fd_events\": [\n");
 
-   for (i = 0; i < ctx->hashSize; i++)
-      for (curr = ctx->events[i]; curr; curr = curr->next) {
-         edbg_report_fd_event(json, curr, first);
+   for (fd = 0; fd <= ctx->maxFd; fd++)
+      if (ctx->fds[fd].used) {
+         edbg_report_fd_event(json, ctx, fd, first);
          first = 0;
       }
 
@@ -1957,10 +3140,12 @@ static void edbg_report_state(EVTHandler *ctx, uint8_t full_format)
    ipc_printf_buffer(ctx->dbgBuffer,
          "{\n  \"loop_steps\": %llu,\n  \"dbg_state\": \"%s\",\n  "
          "\"port\":%u,\n  \"timed_events\":%llu,\n  \"fd_events\":%llu,\n"
+         "  \"deferred_events\":%llu,  \"deferred_last_loop\":%u,\n"
          "  \"critical_sched_count\":%ld,  \"critical_fd_count\":%ld,\n",
          ctx->loop_counter, 
          ctx->debuggerState == EDBG_STOPPED ? "stopped" : "running",
          ctx->dbgPort, ctx->timed_event_counter, ctx->fd_event_counter,
+         ctx->deferred_counter, ctx->deferred_last,
          ctx->critical_sched_count, ctx->critical_fd_count);
 
    if (ctx->debuggerStateCB)
@@ -1971,7 +3156,7 @@ static void edbg_report_state(EVTHandler *ctx, uint8_t full_format)
          ipc_printf_buffer(ctx->dbgBuffer,
             "  \"next_step\" : { \"type\":\"Timed Event\", \"id\":%"PRIdPTR" },\n",
             (uintptr_t)ctx->next_timed_event );
-      else if (ctx->next_fd_event) {
+      else if (ctx->next_fd_event >= 0) {
          ipc_printf_buffer(ctx->dbgBuffer,
             "  \"next_step\" : { \"type\":\"FD Event\", \"id\":%"PRIdPTR" },\n",
             (uintptr_t)ctx->next_fd_event );
@@ -1997,39 +3182,21 @@ void EVT_set_debugger_port(EVTHandler *handler, int port)
 
 void evt_fd_set_pausable(EVTHandler *ctx, int fd, char pausable)
 {
-   struct EventCB *curr;
-   int event;
-
-   for (curr = ctx->events[fd % ctx->hashSize]; curr; curr = curr->next) {
-      if (curr->fd == fd) {
-         curr->pausable = pausable;
+   EventCB *curr = evt_fd_lookup(ctx, fd);
 
-         for (event = 0; event < EVENT_MAX; event++) {
-            if (curr->cb[event] &&
-                      (!curr->pausable || !curr->breakpoint[event]) )
-               FD_SET(fd, &ctx->blockedSet[event]);
-            else
-               FD_CLR(fd, &ctx->blockedSet[event]);
-         }
-      }
+   if (curr) {
+      curr->pausable = pausable;
+      evt_fd_sync(ctx, fd, 0);
    }
 }
 
 void evt_fd_set_paused(EVTHandler *ctx, int fd, char paused)
 {
-   struct EventCB *curr;
    int event;
 
-   for (curr = ctx->events[fd % ctx->hashSize]; curr; curr = curr->next) {
-      if (curr->fd == fd) {
-         for (event = 0; event < EVENT_MAX; event++) {
-            curr->breakpoint[event] = paused;
-            if (curr->cb[event] &&
-                      (!curr->pausable || !curr->breakpoint[event]) )
-               FD_SET(fd, &ctx->blockedSet[event]);
-            else
-               FD_CLR(fd, &ctx->blockedSet[event]);
-         }
-      }
+   if (evt_fd_lookup(ctx, fd)) {
+      for (event = 0; event < EVENT_MAX; event++)
+         ctx->fdInfo[fd].breakpoint[event] = paused;
+      evt_fd_sync(ctx, fd, 0);
    }
 }
@@ -25,11 +25,13 @@
 #define EVENTS_H
 
 #include <time.h>
+#include <stdint.h>
 #include <sys/select.h>
 
 #include "priorityQueue.h"
 #include "ipc.h"
 #include "zmqlite.h"
+#include "slabPool.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -60,9 +62,25 @@ enum EVTDebuggerState {
 // A callback for a file descriptor event
 typedef int (*EVT_fd_cb)(int fd, char type, void *arg);
 
+// Registration modes for EVT_fd_add_flags
+#define EVT_FD_EDGE 1
+#define EVT_FD_ONESHOT 2
+
+// Dispatch priority classes, see EVT_fd_set_priority
+#define EVT_PRIO_REALTIME 0
+#define EVT_PRIO_NORMAL 1
+#define EVT_PRIO_BULK 2
+#define EVT_PRIO_CLASSES 3
+
 // A callback for a scheduled event
 typedef int (*EVT_sched_cb)(void *arg);
 
+// A generation tagged handle for a scheduled event, see EVT_sched_get_handle
+typedef uint64_t EVT_sched_handle;
+
+// A handle that never refers to an event
+#define EVT_SCHED_HANDLE_NONE 0
+
 // Type which contains event handler information
 struct EventState;
 typedef struct EventState EVTHandler;
@@ -74,6 +92,16 @@ typedef struct EventState EVTHandler;
  * @return The event handler.
  */
 EVTHandler *EVT_create_handler(EVT_debug_state_cb debug_cb, void *arg);
+
+/**
+ * Create an event handler with a size hint.  The fd table grows as needed,
+ * so the hint only avoids reallocation when many fds are registered.
+ * @param hashSize The number of fds and timed events to initially make room
+ *    for.
+ * @param arg Context parameter passed to debugging related functions.
+ *
+ * @return The event handler.
+ */
 struct EventState *EVT_initWithSize(int hashSize, EVT_debug_state_cb debug_cb,
         void *arg);
 
@@ -100,6 +128,44 @@ void EVT_free_handler(EVTHandler *handler);
 char EVT_fd_add(EVTHandler *handler, int fd, int type, EVT_fd_cb cb,
                   void *arg);
 
+/**
+ * Add event callback for a file descriptor and event type with a
+ * registration mode.  The mode applies to every event type registered on
+ * the fd and stays in effect until the fd is removed or the mode is set
+ * again.  Pollers without native support emulate the modes.
+ *
+ * EVT_FD_EDGE only calls back when the fd becomes ready, rather than every
+ * time the loop finds it ready, so the callback must drain the fd until it
+ * would block.  The select poller treats edge-triggered fds as
+ * level-triggered, which is compatible with callbacks that drain.
+ *
+ * EVT_FD_ONESHOT disarms the fd after a callback runs.  No further events
+ * are reported for the fd until EVT_fd_rearm is called or a callback is
+ * added again, which can be done from within the callback.
+ *
+ * @param handler The event handler.
+ * @param fd The file descriptor.
+ * @param type Type of file descriptor event (EVENT_FD_READ, EVENT_FD_WRITE,
+ * or EVENT_FD_ERROR).
+ * @param cb The event callback.
+ * @param arg The callback argument.
+ * @param flags Zero for level-triggered, or EVT_FD_EDGE and EVT_FD_ONESHOT.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+char EVT_fd_add_flags(EVTHandler *handler, int fd, int type, EVT_fd_cb cb,
+      void *arg, unsigned int flags);
+
+/**
+ * Rearm a one-shot fd disarmed after its last callback.
+ *
+ * @param handler The event handler.
+ * @param fd The file descriptor.
+ *
+ * @return 1 on success, 0 if the fd isn't registered or the poller failed.
+ */
+char EVT_fd_rearm(EVTHandler *handler, int fd);
+
 /**
  * Add event and cleanup callback for a file descriptor and event type.
  * Event callback behaves like described in EVT_fd_add.
@@ -151,6 +217,33 @@ void EVT_fd_remove(EVTHandler *handler, int fd, int type);
 
 void EVT_fd_force_remove(EVTHandler *handler, int fd, int type);
 
+/**
+ * Set the dispatch priority class of a file descriptor.  Each loop
+ * iteration runs the due timed events and then the ready fd callbacks of
+ * the EVT_PRIO_REALTIME class first, then EVT_PRIO_NORMAL, then
+ * EVT_PRIO_BULK.  Once a class has used its budget for the iteration, see
+ * EVT_set_priority_budget, its remaining level-triggered fds wait for the
+ * next iteration.  Edge-triggered and one-shot fds always run when
+ * reported.  New fds are EVT_PRIO_NORMAL.
+ *
+ * @param handler The event handler.
+ * @param fd The file descriptor.
+ * @param prio The priority class, one of EVT_PRIO_*.
+ */
+void EVT_fd_set_priority(EVTHandler *handler, int fd, int prio);
+
+/**
+ * Set the maximum number of callbacks a priority class runs per loop
+ * iteration, counting both timed and fd events.  A budget of 0 is
+ * unlimited.  Only EVT_PRIO_BULK has a budget by default.
+ *
+ * @param handler The event handler.
+ * @param prio The priority class, one of EVT_PRIO_*.
+ * @param budget The number of callbacks, or 0 for no limit.
+ */
+void EVT_set_priority_budget(EVTHandler *handler, int prio,
+      unsigned int budget);
+
 /**
  * Provide a debugging name for a file descriptor
  *
@@ -256,6 +349,22 @@ char EVT_sched_update(EVTHandler *handler, void *eventId, struct timeval time);
  */
 char EVT_sched_update_partial_credit(EVTHandler *handler, void *eventId, struct timeval time);
 
+/**
+ * Allow a scheduled event to run up to slack late.  While an event is
+ * within its slack window it runs the next time the loop wakes up for any
+ * other reason, so nearby deadlines share a single wakeup.  The loop only
+ * wakes up on the event's account once the slack has elapsed.  The slack
+ * is kept when the event is rescheduled.  Events have no slack by default.
+ *
+ * @param handler The event handler.
+ * @param event The event to change.
+ * @param slack The longest the event may be delayed past its deadline.
+ *
+ * @return 0 on success, other value on failure
+ */
+char EVT_sched_set_slack(EVTHandler *handler, void *eventId,
+      struct timeval slack);
+
 /**
  * Provide a debugging name for a scheduled event.
  *
@@ -266,6 +375,18 @@ char EVT_sched_update_partial_credit(EVTHandler *handler, void *eventId, struct
 void EVT_sched_set_name(void *eventId, const char *fmt, ...)
                      __attribute__ ((format (printf, 2, 3)));
 
+/**
+ * Set the dispatch priority class of a scheduled event.  Due events run in
+ * class order and within their class's budget, see EVT_fd_set_priority.
+ * Events over budget run in the next loop iteration.  New events are
+ * EVT_PRIO_NORMAL.
+ *
+ * @param handler The event handler.
+ * @param event The event to change.
+ * @param prio The priority class, one of EVT_PRIO_*.
+ */
+void EVT_sched_set_priority(EVTHandler *handler, void *eventId, int prio);
+
 /**
  * Sets the critical flag for a scheduled event.  Non-critical events don't
  * count for event loop auto-exit criteria.
@@ -276,13 +397,64 @@ void EVT_sched_set_name(void *eventId, const char *fmt, ...)
  */
 void EVT_sched_set_critical(EVTHandler *handler, void *eventId, int critical);
 
+/**
+ * Get a handle for a scheduled event.  Unlike the event identifier, a
+ *   handle remains safe to use after the event has been removed or has run
+ *   for the last time.  Every EVT_sched_*_handle call made with such a stale
+ *   handle fails without touching the event's memory, which may have been
+ *   reused by a newer event.  Handles are only valid with the handler that
+ *   created the event.
+ *
+ * @param handler The event handler.
+ * @param eventId The event, as returned by EVT_sched_add.
+ *
+ * @return The handle, or EVT_SCHED_HANDLE_NONE if eventId is NULL.
+ */
+EVT_sched_handle EVT_sched_get_handle(EVTHandler *handler, void *eventId);
+
+/**
+ * Find the event a handle refers to.
+ *
+ * @param handler The event handler.
+ * @param handle The handle to look up.
+ *
+ * @return The event identifier, or NULL if the event no longer exists.
+ */
+void *EVT_sched_lookup(EVTHandler *handler, EVT_sched_handle handle);
+
+/**
+ * Remove a scheduled event by handle.  See EVT_sched_remove.
+ *
+ * @return The arg provided when registering the event, or NULL if the
+ *  handle is stale.
+ */
+void *EVT_sched_remove_handle(EVTHandler *handler, EVT_sched_handle handle);
+
+/**
+ * Update a scheduled event by handle.  See EVT_sched_update.
+ *
+ * @return 0 on success, other value if the handle is stale.
+ */
+char EVT_sched_update_handle(EVTHandler *handler, EVT_sched_handle handle,
+      struct timeval time);
+
+/**
+ * Retrieve the time until a scheduled event occurs by handle.  See
+ *   EVT_sched_remaining.
+ *
+ * @return 0 on success, other value if the handle is stale.
+ */
+char EVT_sched_remaining_handle(EVTHandler *handler, EVT_sched_handle handle,
+      struct timeval *remaining);
+
 /**
  * Add a deferred callback to the event loop.  Deferred callbacks always
  *  happen at the end of the event loop.  They are guaranteed to be called
  *  even if the loop is exiting.  There is no way to keep a deferred event
  *  in the loop for the next iteration (EVENT_KEEP is ignored).  The event
  *  is called from a context that is safe to modify both scheduled events
- *  and FD events.
+ *  and FD events.  Deferred callbacks run in the order they were added,
+ *  including callbacks deferred by other deferred callbacks.
  *
  * @param handler The event handler.
  * @param cb The event callback.
@@ -302,6 +474,39 @@ void *EVT_defer_add(EVTHandler *handler, EVT_sched_cb cb, void *arg);
  */
 void EVT_defer_cancel(EVTHandler *handler, void *arg);
 
+/**
+ * Run a callback on another handler's event loop.  This is the only EVT_*
+ *  call that is safe to make from a thread other than the one running the
+ *  target loop.  Callbacks run in the order they were posted by each
+ *  thread, from the target loop's fd processing, and are always run exactly
+ *  once, including when the target handler is freed.
+ *
+ * A process may run several event loops, each on its own pthread with its
+ *  own EVTHandler from EVT_create_handler.  Each loop owns its fds and
+ *  timed events, and must only be used from its own thread.  Use EVT_post
+ *  to hand work to another loop, including asking it to EVT_exit_loop.
+ *  The ProcessData from PROC_init, with its command socket and signal
+ *  handling, belongs to the loop on the thread that created it.
+ *
+ * @param target The event handler to run the callback on.
+ * @param cb The callback.  Its return value is ignored.
+ * @param arg The callback argument.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int EVT_post(EVTHandler *target, EVT_sched_cb cb, void *arg);
+
+/**
+ * Count work that will finish with an EVT_post as a critical fd, so that
+ *  EVT_EXIT_FD keeps the loop running until the work is released.  Both
+ *  functions must be called from the loop's own thread, normally when the
+ *  work is handed off and from the posted callback.
+ *
+ * @param handler The event handler the work will post back to.
+ */
+void EVT_post_hold(EVTHandler *handler);
+void EVT_post_release(EVTHandler *handler);
+
 /**
  * Starts the main event loop.  Control of the program is given to the
  * event handler, which will block until an event occurs, and call the
@@ -399,6 +604,145 @@ struct EventTimer *EVT_get_evt_timer(EVTHandler *ctx);
  */
 void EVT_set_evt_timer(EVTHandler *ctx, struct EventTimer *et);
 
+struct EventPoller;
+
+/**
+ * Set the EventPoller used to wait for fd events.  The poller defaults to
+ * epoll on Linux and select elsewhere, and can be overridden by setting
+ * the LIBPROC_POLLER environment variable to "select", "epoll" or
+ * "io_uring".  An unavailable poller falls back to the default.
+ *
+ * @param ctx  EVTHandler struct
+ * @param ep   The EventPoller instance.  The handler takes ownership on
+ *               success.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+char EVT_set_poller(EVTHandler *ctx, struct EventPoller *ep);
+
+/**
+ * Enable a hierarchical timing wheel for timed events.  Events due more
+ * than one resolution tick in the future are held in the wheel, where
+ * adding and removing them is constant time, and are moved into the
+ * priority queue shortly before they expire.  This is beneficial when many
+ * long timeouts are scheduled and later cancelled.  Callback ordering and
+ * timing is unchanged.  The wheel is disabled by default.
+ *
+ * @param ctx  EVTHandler struct
+ * @param resolution  Width of the finest wheel slot, or NULL to disable
+ *               the wheel and move all events back to the priority queue.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+char EVT_set_timer_wheel(EVTHandler *ctx, struct timeval *resolution);
+
+/**
+ * Occupancy of the pools that scheduled and deferred events are allocated
+ * from.  Deferred events are kept in a single growable ring, reported as
+ * one slab.  File descriptor callbacks are stored in a table indexed by fd
+ * and don't use a pool.
+ */
+struct EVTPoolStats {
+   struct SP_stats sched;     // Scheduled events
+   struct SP_stats deferred;  // Deferred events
+};
+
+/**
+ * Read the occupancy of the handler's event storage pools.
+ *
+ * @param ctx  EVTHandler struct
+ * @param stats  Filled in with the pool counters.
+ */
+void EVT_get_pool_stats(EVTHandler *ctx, struct EVTPoolStats *stats);
+
+/** Number of buckets in an EVTHistogram */
+#define EVT_HIST_BUCKETS 20
+
+/**
+ * Power of two histogram of times in microseconds.  Bucket 0 counts times
+ * under 1us, bucket n counts times from 2^(n-1) up to 2^n us, and the last
+ * bucket also counts everything longer.
+ */
+struct EVTHistogram {
+   uint32_t buckets[EVT_HIST_BUCKETS];
+   uint32_t count;
+   uint32_t max_usec;
+   uint64_t total_usec;
+};
+
+/**
+ * Timing of an event's callbacks.
+ */
+struct EVTEventStats {
+   struct EVTHistogram duration;    // Time spent in the callback
+   struct EVTHistogram lateness;    // Timed events only, time past due
+};
+
+/**
+ * Event loop utilization.  The busy to idle ratio is
+ * busy_usec / (busy_usec + idle_usec).  Busy and idle time are only counted
+ * while EVT_set_event_stats is enabled.
+ */
+struct EVTLoopStats {
+   uint64_t busy_usec;              // Time spent outside the poller
+   uint64_t idle_usec;              // Time spent blocked in the poller
+   unsigned long long loops;
+   unsigned long long timed_events;
+   unsigned long long fd_events;
+   unsigned long long deferred_events;
+   struct EVTEventStats timed;      // Every timed callback, including removed
+   struct EVTEventStats fd;         // Every fd callback, including removed
+};
+
+/**
+ * Enable or disable timing of individual event callbacks and of loop
+ * utilization.  Timing costs two clock reads per callback and one per loop
+ * iteration, and is disabled by default.  It can also be enabled by setting
+ * the LIBPROC_EVT_STATS environment variable.
+ *
+ * @param ctx  EVTHandler struct
+ * @param enable  Non-zero to time callbacks.
+ */
+void EVT_set_event_stats(EVTHandler *ctx, int enable);
+
+/**
+ * Read the loop utilization and the callback timing totals.
+ *
+ * @param ctx  EVTHandler struct
+ * @param stats  Filled in with the loop statistics.
+ */
+void EVT_get_loop_stats(EVTHandler *ctx, struct EVTLoopStats *stats);
+
+/**
+ * Clear the loop utilization and every callback timing histogram.
+ *
+ * @param ctx  EVTHandler struct
+ */
+void EVT_reset_loop_stats(EVTHandler *ctx);
+
+/**
+ * Callback for EVT_iterate_event_stats.
+ *
+ * @param arg  The argument passed to EVT_iterate_event_stats.
+ * @param name  The event's name, or its callback's symbol name.
+ * @param fd  The event's file descriptor, or -1 for timed events.
+ * @param event  The EVENT_FD_* type, or -1 for timed events.
+ * @param stats  The event's callback timing.
+ */
+typedef void (*EVT_event_stats_cb)(void *arg, const char *name, int fd,
+      int event, const struct EVTEventStats *stats);
+
+/**
+ * Visit the callback timing of every registered event that has run with
+ * stats enabled.  The callback must not add or remove events.
+ *
+ * @param ctx  EVTHandler struct
+ * @param cb  Called for each event.
+ * @param arg  Passed to the callback.
+ */
+void EVT_iterate_event_stats(EVTHandler *ctx, EVT_event_stats_cb cb,
+      void *arg);
+
 /**
  * Subracts one timeval struct from another and stores the result.
  *
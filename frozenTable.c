@@ -0,0 +1,215 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frozenTable.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct FT_snapshot {
+   size_t len;
+   struct FT_snapshot *next;    // Retired list linkage
+   void **data;
+   uint32_t *keys;
+};
+
+// Published after FT_clear so lookups made by later exit handlers don't
+//  allocate a snapshot that is never freed
+static struct FT_snapshot ft_empty = { 0, NULL, NULL, NULL };
+
+void FT_init(struct FrozenTable *ft)
+{
+   memset(ft, 0, sizeof(*ft));
+   pthread_mutex_init(&ft->lock, NULL);
+}
+
+// Index of the first master entry with a key not less than key
+static size_t ft_lower_bound(struct FrozenTable *ft, uint32_t key)
+{
+   size_t lo = 0, hi = ft->len, mid;
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (ft->entries[mid].key < key)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return lo;
+}
+
+// Must be called with the lock held
+static void ft_unpublish(struct FrozenTable *ft)
+{
+   struct FT_snapshot *old = ft->current;
+
+   __atomic_store_n(&ft->current, NULL, __ATOMIC_RELEASE);
+   if (old && old != &ft_empty) {
+      old->next = ft->retired;
+      ft->retired = old;
+   }
+}
+
+int FT_insert(struct FrozenTable *ft, uint32_t key, void *data, int replace)
+{
+   struct FT_entry *tmp;
+   size_t pos;
+   int res = 0;
+
+   if (!data)
+      return -2;
+
+   pthread_mutex_lock(&ft->lock);
+
+   pos = ft_lower_bound(ft, key);
+   if (pos < ft->len && ft->entries[pos].key == key) {
+      if (!replace)
+         res = -1;
+      else
+         ft->entries[pos].data = data;
+   }
+   else {
+      if (ft->len == ft->avail) {
+         tmp = realloc(ft->entries,
+               (ft->avail ? ft->avail * 2 : 32) * sizeof(*tmp));
+         if (!tmp) {
+            pthread_mutex_unlock(&ft->lock);
+            return -2;
+         }
+         ft->entries = tmp;
+         ft->avail = ft->avail ? ft->avail * 2 : 32;
+      }
+      memmove(&ft->entries[pos + 1], &ft->entries[pos],
+            (ft->len - pos) * sizeof(*ft->entries));
+      ft->entries[pos].key = key;
+      ft->entries[pos].data = data;
+      ft->len++;
+   }
+
+   if (!res)
+      ft_unpublish(ft);
+   pthread_mutex_unlock(&ft->lock);
+
+   return res;
+}
+
+static struct FT_snapshot *ft_publish(struct FrozenTable *ft)
+{
+   struct FT_snapshot *snap;
+   size_t i;
+
+   pthread_mutex_lock(&ft->lock);
+
+   // Another reader may have published while we waited for the lock
+   snap = ft->current;
+   if (!snap) {
+      // Keys are stored apart from the data so the search only touches keys
+      snap = malloc(sizeof(*snap) +
+            ft->len * (sizeof(*snap->data) + sizeof(*snap->keys)));
+      if (snap) {
+         snap->len = ft->len;
+         snap->next = NULL;
+         snap->data = (void**)(snap + 1);
+         snap->keys = (uint32_t*)(snap->data + ft->len);
+         for (i = 0; i < ft->len; i++) {
+            snap->keys[i] = ft->entries[i].key;
+            snap->data[i] = ft->entries[i].data;
+         }
+         __atomic_store_n(&ft->current, snap, __ATOMIC_RELEASE);
+      }
+   }
+
+   pthread_mutex_unlock(&ft->lock);
+
+   return snap;
+}
+
+static struct FT_snapshot *ft_snapshot(struct FrozenTable *ft)
+{
+   struct FT_snapshot *snap = __atomic_load_n(&ft->current, __ATOMIC_ACQUIRE);
+
+   if (!snap)
+      snap = ft_publish(ft);
+   return snap;
+}
+
+void *FT_find(struct FrozenTable *ft, uint32_t key)
+{
+   struct FT_snapshot *snap = ft_snapshot(ft);
+   const uint32_t *base;
+   size_t n, half;
+
+   if (!snap || !snap->len)
+      return NULL;
+
+   // Fixed trip count search.  The compare becomes a conditional move, so
+   //  there is no data dependent branch to mispredict.
+   base = snap->keys;
+   for (n = snap->len; n > 1; n -= half) {
+      half = n / 2;
+      base = (base[half] <= key) ? base + half : base;
+   }
+
+   if (*base != key)
+      return NULL;
+   return snap->data[base - snap->keys];
+}
+
+void FT_iterate(struct FrozenTable *ft, FT_iterate_cb cb, void *arg)
+{
+   struct FT_snapshot *snap = ft_snapshot(ft);
+   size_t i;
+
+   if (!snap)
+      return;
+
+   for (i = 0; i < snap->len; i++)
+      if ((*cb)(snap->data[i], arg))
+         break;
+}
+
+size_t FT_size(struct FrozenTable *ft)
+{
+   size_t len;
+
+   pthread_mutex_lock(&ft->lock);
+   len = ft->len;
+   pthread_mutex_unlock(&ft->lock);
+
+   return len;
+}
+
+void FT_clear(struct FrozenTable *ft)
+{
+   struct FT_snapshot *snap;
+
+   pthread_mutex_lock(&ft->lock);
+
+   ft_unpublish(ft);
+   while ((snap = ft->retired)) {
+      ft->retired = snap->next;
+      free(snap);
+   }
+
+   free(ft->entries);
+   ft->entries = NULL;
+   ft->len = ft->avail = 0;
+   __atomic_store_n(&ft->current, &ft_empty, __ATOMIC_RELEASE);
+
+   pthread_mutex_unlock(&ft->lock);
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file frozenTable.h Read-mostly table keyed by 32-bit integers.
+ *
+ * Registrations go into a sorted master array under a mutex.  Lookups never
+ * take the lock.  They binary search an immutable snapshot of the master
+ * array that is published through an atomic pointer.  Every registration
+ * unpublishes the current snapshot and the next lookup builds and publishes
+ * a fresh one, so a burst of registrations at startup costs a single build.
+ * Readers may still be searching an unpublished snapshot, so superseded
+ * snapshots are kept on a retired list until FT_clear.  Late registrations,
+ * such as from plugins, are rare enough that this costs little memory.
+ */
+
+#ifndef FROZEN_TABLE_H
+#define FROZEN_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct FT_entry {
+   uint32_t key;
+   void *data;
+};
+
+struct FT_snapshot;
+
+struct FrozenTable {
+   pthread_mutex_t lock;
+   struct FT_entry *entries;        // Sorted master copy, guarded by lock
+   size_t len, avail;
+   struct FT_snapshot *current;     // Published snapshot, NULL when stale
+   struct FT_snapshot *retired;     // Superseded snapshots, guarded by lock
+};
+
+/** Static initializer for a FrozenTable */
+#define FT_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, NULL, NULL }
+
+/** Callback invoked for each element visited by FT_iterate */
+typedef int (*FT_iterate_cb)(void *data, void *arg);
+
+/**
+ * Initialize an empty table.  Equivalent to FT_INITIALIZER.
+ */
+void FT_init(struct FrozenTable *ft);
+
+/**
+ * Add an element to the table.  Safe to call while other threads are
+ * looking up elements.
+ *
+ * @param ft The table.
+ * @param key The element's key.
+ * @param data The element.  Must not be NULL.
+ * @param replace Non-zero to replace an existing element with the same key.
+ *
+ * @return 0 on success, -1 if the key is already present and replace is 0,
+ *    -2 for insufficient memory.
+ */
+int FT_insert(struct FrozenTable *ft, uint32_t key, void *data, int replace);
+
+/**
+ * Find the element with the given key without locking.
+ *
+ * @return The element or NULL if the key isn't present.
+ */
+void *FT_find(struct FrozenTable *ft, uint32_t key);
+
+/**
+ * Visit every element in key order.  Iteration stops early if the callback
+ * returns non-zero.  The callback may register new elements, which aren't
+ * visited.
+ */
+void FT_iterate(struct FrozenTable *ft, FT_iterate_cb cb, void *arg);
+
+/**
+ * @return The number of elements in the table.
+ */
+size_t FT_size(struct FrozenTable *ft);
+
+/**
+ * Remove every element and free all snapshots.  No other thread may be
+ * using the table.
+ */
+void FT_clear(struct FrozenTable *ft);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
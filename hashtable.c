@@ -28,85 +28,193 @@
 #include <errno.h>
 #include <string.h>
 #include "hashtable.h"
+#include <stdint.h>
 
-typedef size_t (*hash_func_cb)(void *key);
-typedef int (*cmp_keys_cb)(void *key1, void *key2);
-typedef void *(*key_for_data_cb)(void *data);
-typedef void (*iterator_cb)(void *data);
-typedef void (*extractor_cb)(void *data);
+// Open addressing with Robin Hood probing.  Each entry is kept at most as far
+//  from its home slot as the entries it displaced, so lookups stop as soon as
+//  they pass a slot closer to home than the key being searched for.
+//  Removal shifts the following entries back instead of leaving tombstones.
 
-typedef struct HashNode
+#define HASH_MIN_CAP 8
+// The table grows when more than 7/8 full and shrinks when under 1/8 full
+#define HASH_LOAD_NUM 7
+#define HASH_LOAD_DEN 8
+#define HASH_SHRINK_DEN 8
+
+struct HashSlot
 {
-   size_t hash;
+   size_t hash;               // Cached result of hashFunc
    void *key;
-   void *data;
-   struct HashNode *next;
-} *HashNodePtr;
+   void *data;                // NULL when the slot is empty
+};
 
 /* A structure which contains information regarding the state of the event handler */
 struct HashTable
 {
-   int hashSize;				    	                        /* The hash size of the event handler */
+   size_t mask;                                  /* Number of slots - 1 */
+   size_t count;
+   size_t minCap;                                /* Never shrink below this */
+   int shift;                                    /* Bits dropped from hashes */
+   int iterating;                                /* Nesting depth of iterators */
    HASH_hash_func_cb hashFunc;
    HASH_cmp_keys_cb keyCmp;
    HASH_key_for_data_cb keyForData;
-
-   HashNodePtr buckets[1];				                      /* List of pointers to event callbacks */
+   struct HashSlot *slots;
 };
 
+// Spreads the caller's hash over the table.  Many callers hash small
+//  integers directly, which would otherwise fill a run of adjacent slots.
+static inline size_t hash_home(struct HashTable *table, size_t hash)
+{
+   return (size_t)(((uint64_t)hash * 0x9E3779B97F4A7C15ULL) >> table->shift) &
+      table->mask;
+}
+
+static inline size_t hash_dist(struct HashTable *table, size_t slot)
+{
+   return (slot - hash_home(table, table->slots[slot].hash)) & table->mask;
+}
+
+static int hash_set_cap(struct HashTable *table, size_t cap)
+{
+   table->slots = calloc(cap, sizeof(struct HashSlot));
+   if (!table->slots)
+      return -1;
+
+   table->mask = cap - 1;
+   for (table->shift = 64; cap > 1; cap >>= 1)
+      table->shift--;
+
+   return 0;
+}
+
+// Places an entry known not to be in the table
+static void hash_insert_slot(struct HashTable *table, struct HashSlot entry)
+{
+   struct HashSlot tmp;
+   size_t slot, dist = 0, cur;
+
+   slot = hash_home(table, entry.hash);
+   for (;; slot = (slot + 1) & table->mask, dist++) {
+      if (!table->slots[slot].data) {
+         table->slots[slot] = entry;
+         table->count++;
+         return;
+      }
+
+      // Take the slot from an entry closer to its home
+      cur = hash_dist(table, slot);
+      if (cur < dist) {
+         tmp = table->slots[slot];
+         table->slots[slot] = entry;
+         entry = tmp;
+         dist = cur;
+      }
+   }
+}
+
+static int hash_resize(struct HashTable *table, size_t cap)
+{
+   struct HashSlot *old = table->slots;
+   size_t i, oldCap = table->mask + 1;
+
+   if (hash_set_cap(table, cap) < 0) {
+      table->slots = old;
+      return -1;
+   }
+
+   table->count = 0;
+   for (i = 0; i < oldCap; i++)
+      if (old[i].data)
+         hash_insert_slot(table, old[i]);
+   free(old);
+
+   return 0;
+}
+
 struct HashTable *HASH_create_table(int hashSize, HASH_hash_func_cb hashFunc,
       HASH_cmp_keys_cb keyCmp, HASH_key_for_data_cb keyForData)
 {
    struct HashTable *res = NULL;
-   int i;
+   size_t cap = HASH_MIN_CAP;
+
+   // Size the table so hashSize entries fit without growing
+   while (hashSize > 0 && cap * HASH_LOAD_NUM / HASH_LOAD_DEN < (size_t)hashSize)
+      cap <<= 1;
 
-   res = (struct HashTable*)malloc(
-         sizeof(struct HashTable) + hashSize * sizeof(HashNodePtr));
+   res = (struct HashTable*)malloc(sizeof(struct HashTable));
    if (!res)
       return NULL;
 
-   res->hashSize = hashSize;
+   res->count = 0;
+   res->iterating = 0;
+   res->minCap = cap;
    res->hashFunc = hashFunc;
    res->keyCmp = keyCmp;
    res->keyForData = keyForData;
-   for (i = 0; i < res->hashSize; i++)
-      res->buckets[i] = NULL;
+   if (hash_set_cap(res, cap) < 0) {
+      free(res);
+      return NULL;
+   }
 
    return res;
 }
 
-static struct HashNode **HASH_search_internal(struct HashTable *table, void *key)
+static ssize_t HASH_search_internal(struct HashTable *table, void *key)
 {
-   size_t hash;
-   struct HashNode **curr;
+   size_t hash, slot, dist;
+   struct HashSlot *curr;
 
    hash = (*table->hashFunc)(key);
-   for( curr = &table->buckets[hash % table->hashSize];
-         *curr; curr = &((*curr)->next) ) {
-      if ((*curr)->key && (*table->keyCmp)((*curr)->key, key))
-         return curr;
+   slot = hash_home(table, hash);
+   for (dist = 0; ; dist++, slot = (slot + 1) & table->mask) {
+      curr = &table->slots[slot];
+      if (!curr->data || hash_dist(table, slot) < dist)
+         return -1;
+      if (curr->hash == hash && (*table->keyCmp)(curr->key, key))
+         return slot;
    }
+}
+
+// Empties a slot by shifting the rest of its cluster back one slot
+static void *hash_remove_slot(struct HashTable *table, size_t slot)
+{
+   void *res = table->slots[slot].data;
+   size_t next;
+
+   for (next = (slot + 1) & table->mask;
+         table->slots[next].data && hash_dist(table, next) > 0;
+         slot = next, next = (next + 1) & table->mask)
+      table->slots[slot] = table->slots[next];
+
+   memset(&table->slots[slot], 0, sizeof(struct HashSlot));
+   table->count--;
 
-   return NULL;
+   return res;
+}
+
+// Shrinks a mostly empty table.  Not done while iterating because the
+//  iterators depend on entries only moving backwards.
+static void hash_maybe_shrink(struct HashTable *table)
+{
+   size_t cap = table->mask + 1;
+
+   if (!table->iterating && cap > table->minCap &&
+         table->count < cap / HASH_SHRINK_DEN)
+      hash_resize(table, cap / 2);
 }
 
 static void *HASH_remove_key_internal(struct HashTable *table,
       void *key)
 {
-   struct HashNode **nodePtr = HASH_search_internal(table, key);
-   struct HashNode *node;
+   ssize_t slot = HASH_search_internal(table, key);
    void *res;
 
-   if (!nodePtr)
+   if (slot < 0)
       return NULL;
 
-   node = *nodePtr;
-   if (!nodePtr)
-      return NULL;
-
-   *nodePtr = node->next;
-   res = node->data;
-   free(node);
+   res = hash_remove_slot(table, slot);
+   hash_maybe_shrink(table);
 
    return res;
 }
@@ -130,39 +238,48 @@ void *HASH_remove_data(struct HashTable *table, void *data)
    return HASH_remove_key_internal(table, key);
 }
 
-void HASH_free_table(struct HashTable *table)
+void *HASH_replace_data(struct HashTable *table, void *data)
 {
-   int i;
-   struct HashNode *node;
+   ssize_t slot;
+   void *key, *res;
+
+   if (!table || !data)
+      return NULL;
+
+   key = (*table->keyForData)(data);
+   slot = HASH_search_internal(table, key);
+   if (slot < 0)
+      return NULL;
+
+   // Equal keys hash the same, so the cached hash stays valid
+   res = table->slots[slot].data;
+   table->slots[slot].key = key;
+   table->slots[slot].data = data;
 
+   return res;
+}
+
+void HASH_free_table(struct HashTable *table)
+{
    if (!table)
       return;
 
-   for(i = 0; i < table->hashSize; i++)
-      while((node = table->buckets[i])) {
-         table->buckets[i] = node->next;
-         free(node);
-      }
-
+   free(table->slots);
    free(table);
 }
 
 void *HASH_find_key(struct HashTable *table, void *key)
 {
-   size_t hash;
-   struct HashNode *curr;
+   ssize_t slot;
 
    if (!table)
       return NULL;
 
-   hash = (*table->hashFunc)(key);
-   for( curr = table->buckets[hash % table->hashSize];
-         curr; curr = curr->next) {
-      if ((*table->keyCmp)(curr->key, key))
-         return curr->data;
-   }
+   slot = HASH_search_internal(table, key);
+   if (slot < 0)
+      return NULL;
 
-   return NULL;
+   return table->slots[slot].data;
 }
 
 void *HASH_find_data(struct HashTable *table, void *data)
@@ -178,90 +295,94 @@ void *HASH_find_data(struct HashTable *table, void *data)
 
 int HASH_add_data(struct HashTable *table, void *data)
 {
-   struct HashNode *curr;
-   void *key;
+   struct HashSlot entry;
+   size_t cap;
 
    if (!data)
       return -1;
 
-   key = (*table->keyForData)(data);
-
-   if (HASH_find_key(table, key))
+   entry.key = (*table->keyForData)(data);
+   if (HASH_find_key(table, entry.key))
       return -3;
 
-   curr = (struct HashNode*)malloc(sizeof(struct HashNode));
-   if (!curr)
+   cap = table->mask + 1;
+   if ((table->count + 1) * HASH_LOAD_DEN > cap * HASH_LOAD_NUM &&
+         hash_resize(table, cap * 2) < 0)
       return -4;
 
-   curr->key = key;
-   curr->data = data;
-   curr->hash = (*table->hashFunc)(key);
-   curr->next = table->buckets[curr->hash % table->hashSize];
-   table->buckets[curr->hash % table->hashSize] = curr;
+   entry.data = data;
+   entry.hash = (*table->hashFunc)(entry.key);
+   hash_insert_slot(table, entry);
 
    return 0;
 }
 
+// Iteration starts at an empty slot.  No cluster wraps past it, so entries
+//  shifted back by a removal always come from slots not yet visited.
+static size_t hash_iter_start(struct HashTable *table)
+{
+   size_t slot;
+
+   for (slot = 0; table->slots[slot].data; slot++)
+      ;
+
+   return slot;
+}
+
 void HASH_iterate_arg_table(struct HashTable *table,
       HASH_iterator_arg_cb iterator, void *arg)
 {
-   int i;
+   size_t i, slot, start;
+
    if (!table)
       return;
 
-   struct HashNode **ptr;
-   struct HashNode *goner;
-   for(i = 0; i < table->hashSize; i++)
-   {
-      ptr = &table->buckets[i];
-      while(ptr && *ptr)
-      {
-         if ((*iterator)((*ptr)->data, arg)) {
-            goner = *ptr;
-            *ptr = goner->next;
-            goner->next = NULL;
-            free(goner);
-         }
-         else
-            ptr = &(*ptr)->next;
-      }
+   table->iterating++;
+   start = hash_iter_start(table);
+   for (i = 0; i <= table->mask; i++) {
+      slot = (start + i) & table->mask;
+      // Revisit the slot if removing its entry shifted another into it
+      while (table->slots[slot].data &&
+            (*iterator)(table->slots[slot].data, arg))
+         hash_remove_slot(table, slot);
    }
+   table->iterating--;
+   hash_maybe_shrink(table);
 }
 
 void HASH_iterate_table(struct HashTable *table, HASH_iterator_cb iterator)
 {
-   int i;
+   size_t i, slot, start;
+
    if (!table)
       return;
 
-   struct HashNode **ptr;
-   struct HashNode *goner;
-   for(i = 0; i < table->hashSize; i++)
-   {
-      ptr = &table->buckets[i];
-      while(ptr && *ptr)
-      {
-         if ((*iterator)((*ptr)->data)) {
-            goner = *ptr;
-            *ptr = goner->next;
-            goner->next = NULL;
-            free(goner);
-         }
-         else
-            ptr = &(*ptr)->next;
-      }
+   table->iterating++;
+   start = hash_iter_start(table);
+   for (i = 0; i <= table->mask; i++) {
+      slot = (start + i) & table->mask;
+      while (table->slots[slot].data &&
+            (*iterator)(table->slots[slot].data))
+         hash_remove_slot(table, slot);
    }
+   table->iterating--;
+   hash_maybe_shrink(table);
 }
 
 void HASH_extract(struct HashTable *table, HASH_extractor_cb extractor)
 {
-   int i;
+   size_t i, slot, start;
 
    if (!table)
       return;
 
-   for(i = 0; i < table->hashSize; i++)
-      while(table->buckets[i])
-         (*extractor)(HASH_remove_key(table, table->buckets[i]->key));
+   table->iterating++;
+   start = hash_iter_start(table);
+   for (i = 0; i <= table->mask; i++) {
+      slot = (start + i) & table->mask;
+      while (table->slots[slot].data)
+         (*extractor)(hash_remove_slot(table, slot));
+   }
+   table->iterating--;
+   hash_maybe_shrink(table);
 }
-
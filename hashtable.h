@@ -18,6 +18,8 @@
 #ifndef HASHTABLE_H
 #define HASHTABLE_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -33,8 +35,10 @@ struct HashTable;
 
 /**
  * Initializes a HashTable with a given hash size and function pointers.
+ * The table uses open addressing and grows or shrinks to keep its load
+ * factor between 1/8 and 7/8.
  *
- * @param hashSize The hash size of the event handler.
+ * @param hashSize The number of entries to size the table for initially.
  * @param hashFunc A pointer to a function that takes a key and returns an int hash value.
  * @param keyCmp A pointer to a function that takes two keys and returns true if they are identical, false otherwise.
  * @param keyForData A pointer to a function that takes a data pointer and returns a pointer to the key.
@@ -54,6 +58,18 @@ void *HASH_find_data(struct HashTable *table, void *data);
 void *HASH_remove_key(struct HashTable *table, void *key);
 void *HASH_remove_data(struct HashTable *table, void *data);
 
+/**
+ * Replaces the entry whose key matches the key of data with data, in place.
+ * Never allocates, so it can't fail once the key is in the table.
+ *
+ * @return The replaced entry, or NULL if no entry has the key.
+ */
+void *HASH_replace_data(struct HashTable *table, void *data);
+
+/**
+ * Calls the iterator with every entry in the table.  Entries for which the
+ * iterator returns non-zero are removed.  The iterator must not add entries.
+ */
 void HASH_iterate_table(struct HashTable *table, HASH_iterator_cb iterator);
 void HASH_iterate_arg_table(struct HashTable *table,
       HASH_iterator_arg_cb iterator, void *arg);
@@ -40,9 +40,15 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdarg.h>
+#include <pthread.h>
 #include "proclib.h"
 #include "cmd-pkt.h"
 
+// Send helpers internal to proclib
+extern char *proc_encode_arena(ProcessData *proc, size_t len);
+extern int proc_cmd_sockaddr_copy_internal(ProcessData *proc, int fd,
+      const void *data, size_t dataLen, struct sockaddr_in *dest);
+
 #define WAIT_MS (5 * 1000)
 
 // List of custom services for use if /etc/services lookup fails
@@ -393,69 +399,236 @@ static int read_response(int sock, void *rxResp, size_t rxRespLen)
    return len;
 }
 
-// Uses blocking system calls to setup an IPC port, transmit the given
-//  UDP data, and receive a single response.
-int socket_send_packet_and_read_response(const char *dstAddr,
-      const char *dstProc, void *txCmd, size_t txCmdLen,
-      void *rxResp, size_t rxRespLen, int responseTimeoutMS)
-{
-   int sock;
-   int result = 0;
+// Client sockets idle for longer than this are closed instead of reused
+#define CLIENT_IDLE_MS (30 * 1000)
+// Most idle client sockets kept open at once
+#define CLIENT_CACHE_MAX 16
+
+// A UDP socket connected to a single destination.  Sockets are removed from
+//  the cache while a request is using them.
+struct ClientSock {
    struct sockaddr_in addr;
+   int fd;
+   struct timeval lastUse;
+   struct ClientSock *next;
+};
 
-   sock = socket_init(0);
-   if (sock < 0)
-      return -1;
+// A destination resolved from a host and service name
+struct ClientName {
+   char *host;                // NULL for the local host
+   char *service;
+   struct sockaddr_in addr;
+   struct timeval resolved;
+   struct ClientName *next;
+};
 
-   addr.sin_family = AF_INET;
-   addr.sin_addr.s_addr = 0;
+static pthread_mutex_t clientLock = PTHREAD_MUTEX_INITIALIZER;
+// Most recently used first
+static struct ClientSock *clientSocks = NULL;
+static struct ClientName *clientNames = NULL;
+
+static int client_expired(struct timeval *since, struct timeval *now)
+{
+   struct timeval diff;
+
+   timersub(now, since, &diff);
+   return diff.tv_sec * 1000 + diff.tv_usec / 1000 >= CLIENT_IDLE_MS;
+}
 
-   if (dstAddr) {
-      if (0 == socket_resolve_host(dstAddr, &addr.sin_addr))
+static void client_free_name(struct ClientName *name)
+{
+   free(name->host);
+   free(name->service);
+   free(name);
+}
+
+// Resolves a host and service name, reusing recent lookups
+static int client_resolve(const char *host, const char *service,
+      struct sockaddr_in *addr)
+{
+   struct ClientName **itr, *name;
+   struct timeval now;
+
+   gettimeofday(&now, NULL);
+   pthread_mutex_lock(&clientLock);
+   for (itr = &clientNames; *itr; ) {
+      name = *itr;
+      if (client_expired(&name->resolved, &now)) {
+         *itr = name->next;
+         client_free_name(name);
+         continue;
+      }
+      if (!strcmp(name->service, service) && ((!host && !name->host) ||
+               (host && name->host && !strcmp(name->host, host)))) {
+         *addr = name->addr;
+         pthread_mutex_unlock(&clientLock);
+         return 0;
+      }
+      itr = &name->next;
+   }
+   pthread_mutex_unlock(&clientLock);
+
+   memset(addr, 0, sizeof(*addr));
+   addr->sin_family = AF_INET;
+   addr->sin_addr.s_addr = 0;
+
+   if (host) {
+      if (0 == socket_resolve_host(host, &addr->sin_addr))
          return -1;
    }
 
-   if (0 == addr.sin_addr.s_addr)
-      inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+   if (0 == addr->sin_addr.s_addr)
+      inet_pton(AF_INET, "127.0.0.1", &addr->sin_addr);
 
-   addr.sin_port = htons(socket_get_addr_by_name(dstProc));
+   addr->sin_port = htons(socket_get_addr_by_name(service));
 
-   socket_write(sock, txCmd, txCmdLen, &addr);
+   name = malloc(sizeof(*name));
+   if (!name)
+      return 0;
+   memset(name, 0, sizeof(*name));
+   name->host = host ? strdup(host) : NULL;
+   name->service = strdup(service);
+   if ((host && !name->host) || !name->service) {
+      client_free_name(name);
+      return 0;
+   }
+   name->addr = *addr;
+   name->resolved = now;
 
-   if (rxResp && rxRespLen > 0) {
-      result = wait_for_packet(sock, responseTimeoutMS);
-      if (result == 0) {
-         printf("No response received in %d ms\n", responseTimeoutMS);
-         result = -2;
+   pthread_mutex_lock(&clientLock);
+   name->next = clientNames;
+   clientNames = name;
+   pthread_mutex_unlock(&clientLock);
+
+   return 0;
+}
+
+// Takes a socket connected to addr out of the cache, or creates one
+static int client_sock_get(struct sockaddr_in *addr)
+{
+   struct ClientSock **itr, *sock;
+   struct timeval now;
+   int fd = -1;
+
+   gettimeofday(&now, NULL);
+   pthread_mutex_lock(&clientLock);
+   for (itr = &clientSocks; *itr; ) {
+      sock = *itr;
+      if (fd < 0 && sock->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            sock->addr.sin_port == addr->sin_port) {
+         *itr = sock->next;
+         fd = sock->fd;
+         free(sock);
+         continue;
       }
-      else if (result != 1) {
-         perror("Error waiting for reponse packet");
-         result = -3;
+      if (client_expired(&sock->lastUse, &now)) {
+         *itr = sock->next;
+         close(sock->fd);
+         free(sock);
+         continue;
       }
-      else {
-         result = read_response(sock, rxResp, rxRespLen);
+      itr = &sock->next;
+   }
+   pthread_mutex_unlock(&clientLock);
+
+   if (fd >= 0)
+      return fd;
+
+   fd = socket_init(0);
+   if (fd < 0)
+      return -1;
+   fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+   // Connecting filters out datagrams from other hosts and reports ICMP
+   //  errors from the destination
+   if (connect(fd, (struct sockaddr*)addr, sizeof(*addr)) < 0) {
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+// Returns a socket to the cache, closing the least recently used socket
+//  when the cache is full
+static void client_sock_put(int fd, struct sockaddr_in *addr)
+{
+   struct ClientSock **itr, *sock;
+   int count = 0;
+
+   sock = malloc(sizeof(*sock));
+   if (!sock) {
+      close(fd);
+      return;
+   }
+   sock->addr = *addr;
+   sock->fd = fd;
+   gettimeofday(&sock->lastUse, NULL);
+
+   pthread_mutex_lock(&clientLock);
+   sock->next = clientSocks;
+   clientSocks = sock;
+   for (itr = &clientSocks; *itr; itr = &(*itr)->next) {
+      if (++count > CLIENT_CACHE_MAX) {
+         sock = *itr;
+         *itr = NULL;
+         close(sock->fd);
+         free(sock);
+         break;
       }
    }
+   pthread_mutex_unlock(&clientLock);
+}
+
+void socket_client_cache_flush(void)
+{
+   struct ClientSock *sock;
+   struct ClientName *name;
+
+   pthread_mutex_lock(&clientLock);
+   while ((sock = clientSocks)) {
+      clientSocks = sock->next;
+      close(sock->fd);
+      free(sock);
+   }
+   while ((name = clientNames)) {
+      clientNames = name->next;
+      client_free_name(name);
+   }
+   pthread_mutex_unlock(&clientLock);
+}
 
-   socket_close(sock);
+// Discards responses that arrived after an earlier request gave up on them,
+//  along with any error reported for the earlier request
+static void client_sock_drain(int fd)
+{
+   char byte;
 
-   return result;
+   while (recv(fd, &byte, sizeof(byte), MSG_DONTWAIT) >= 0 ||
+         errno == ECONNREFUSED || errno == EINTR)
+      ;
 }
 
-//  UDP data, and receive a single response.
-int socket_send_packet_and_read_xdr_sa(struct sockaddr_in *addr,
-      void *txCmd, size_t txCmdLen,
-      void *rxResp, size_t rxRespLen, int responseTimeoutMS)
+// Sends txCmd on a cached client socket and waits for a single response.
+//  Unless exact is 0 the response must fill rxResp.
+static int client_send_and_read(struct sockaddr_in *addr,
+      void *txCmd, size_t txCmdLen, void *rxResp, size_t rxRespLen,
+      int responseTimeoutMS, int exact)
 {
    int sock;
    int result = 0;
    struct sockaddr_in src_addr;
 
-   sock = socket_init(0);
+   sock = client_sock_get(addr);
    if (sock < 0)
       return -1;
 
-   socket_write(sock, txCmd, txCmdLen, addr);
+   client_sock_drain(sock);
+   if (send(sock, txCmd, txCmdLen, 0) < 0) {
+      perror("Error sending command packet");
+      close(sock);
+      return -1;
+   }
 
    if (rxResp && rxRespLen > 0) {
       result = wait_for_packet(sock, responseTimeoutMS);
@@ -467,39 +640,183 @@ int socket_send_packet_and_read_xdr_sa(struct sockaddr_in *addr,
          perror("Error waiting for reponse packet");
          result = -3;
       }
+      else if (exact) {
+         result = read_response(sock, rxResp, rxRespLen);
+      }
       else {
          result = socket_read(sock, rxResp, rxRespLen, &src_addr);
       }
    }
 
-   socket_close(sock);
+   // A late or partial response could be taken as the answer to the next
+   //  request, so only sockets that completed their exchange are reused
+   if (result < 0)
+      close(sock);
+   else
+      client_sock_put(sock, addr);
 
    return result;
 }
 
-int socket_send_packet_and_read_xdr(const char *dstAddr,
+// Uses blocking system calls to transmit the given UDP data on a cached
+//  client socket, and receive a single response.
+int socket_send_packet_and_read_response(const char *dstAddr,
       const char *dstProc, void *txCmd, size_t txCmdLen,
       void *rxResp, size_t rxRespLen, int responseTimeoutMS)
 {
    struct sockaddr_in addr;
 
-   addr.sin_family = AF_INET;
-   addr.sin_addr.s_addr = 0;
+   if (client_resolve(dstAddr, dstProc, &addr) < 0)
+      return -1;
 
-   if (dstAddr) {
-      if (0 == socket_resolve_host(dstAddr, &addr.sin_addr))
-         return -1;
-   }
+   return client_send_and_read(&addr, txCmd, txCmdLen, rxResp, rxRespLen,
+         responseTimeoutMS, 1);
+}
 
-   if (0 == addr.sin_addr.s_addr)
-      inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+//  UDP data, and receive a single response.
+int socket_send_packet_and_read_xdr_sa(struct sockaddr_in *addr,
+      void *txCmd, size_t txCmdLen,
+      void *rxResp, size_t rxRespLen, int responseTimeoutMS)
+{
+   return client_send_and_read(addr, txCmd, txCmdLen, rxResp, rxRespLen,
+         responseTimeoutMS, 0);
+}
 
-   addr.sin_port = htons(socket_get_addr_by_name(dstProc));
+int socket_send_packet_and_read_xdr(const char *dstAddr,
+      const char *dstProc, void *txCmd, size_t txCmdLen,
+      void *rxResp, size_t rxRespLen, int responseTimeoutMS)
+{
+   struct sockaddr_in addr;
+
+   if (client_resolve(dstAddr, dstProc, &addr) < 0)
+      return -1;
 
    return socket_send_packet_and_read_xdr_sa(&addr,
       txCmd, txCmdLen, rxResp, rxRespLen, responseTimeoutMS);
 }
 
+// An asynchronous request waiting for its response in an event loop
+struct ClientRequest {
+   EVTHandler *evt;
+   int fd;
+   int failed;                // Close the socket instead of caching it
+   struct sockaddr_in addr;
+   void *timeout_evt;
+   socket_response_cb cb;
+   void *arg;
+};
+
+static int client_request_read_cb(int fd, char type, void *arg)
+{
+   struct ClientRequest *req = (struct ClientRequest*)arg;
+   char rxbuff[MAX_IP_PACKET_SIZE];
+   ssize_t len;
+
+   len = recv(fd, rxbuff, sizeof(rxbuff), 0);
+   if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      return EVENT_KEEP;
+
+   if (req->timeout_evt)
+      EVT_sched_remove(req->evt, req->timeout_evt);
+   req->timeout_evt = NULL;
+
+   if (len < 0) {
+      req->failed = 1;
+      req->cb(req->arg, NULL, -4);
+   }
+   else
+      req->cb(req->arg, rxbuff, len);
+
+   return EVENT_REMOVE;
+}
+
+static int client_request_timeout_cb(void *arg)
+{
+   struct ClientRequest *req = (struct ClientRequest*)arg;
+
+   req->timeout_evt = NULL;
+   req->failed = 1;
+   req->cb(req->arg, NULL, -2);
+   EVT_fd_remove(req->evt, req->fd, EVENT_FD_READ);
+
+   return EVENT_REMOVE;
+}
+
+// Called once the read callback is removed, after the response, the
+//  timeout or when the event loop is freed
+static int client_request_cleanup_cb(int fd, char type, void *arg)
+{
+   struct ClientRequest *req = (struct ClientRequest*)arg;
+
+   if (req->timeout_evt)
+      EVT_sched_remove(req->evt, req->timeout_evt);
+
+   if (req->failed)
+      close(req->fd);
+   else
+      client_sock_put(req->fd, &req->addr);
+   free(req);
+
+   return EVENT_REMOVE;
+}
+
+int socket_send_packet_async_sa(EVTHandler *evt, struct sockaddr_in *addr,
+      void *txCmd, size_t txCmdLen, int responseTimeoutMS,
+      socket_response_cb cb, void *arg)
+{
+   struct ClientRequest *req;
+
+   if (!evt || !cb)
+      return -1;
+
+   req = malloc(sizeof(*req));
+   if (!req)
+      return -1;
+   memset(req, 0, sizeof(*req));
+   req->evt = evt;
+   req->addr = *addr;
+   req->cb = cb;
+   req->arg = arg;
+
+   req->fd = client_sock_get(addr);
+   if (req->fd < 0) {
+      free(req);
+      return -1;
+   }
+
+   client_sock_drain(req->fd);
+   if (send(req->fd, txCmd, txCmdLen, 0) < 0) {
+      close(req->fd);
+      free(req);
+      return -1;
+   }
+
+   req->timeout_evt = EVT_sched_add(evt, EVT_ms2tv(responseTimeoutMS),
+         &client_request_timeout_cb, req);
+   if (!EVT_fd_add_with_cleanup(evt, req->fd, EVENT_FD_READ,
+            &client_request_read_cb, &client_request_cleanup_cb, req)) {
+      EVT_sched_remove(evt, req->timeout_evt);
+      close(req->fd);
+      free(req);
+      return -1;
+   }
+
+   return 0;
+}
+
+int socket_send_packet_async(EVTHandler *evt, const char *dstAddr,
+      const char *dstProc, void *txCmd, size_t txCmdLen,
+      int responseTimeoutMS, socket_response_cb cb, void *arg)
+{
+   struct sockaddr_in addr;
+
+   if (client_resolve(dstAddr, dstProc, &addr) < 0)
+      return -1;
+
+   return socket_send_packet_async_sa(evt, &addr, txCmd, txCmdLen,
+         responseTimeoutMS, cb, arg);
+}
+
 int socket_resolve_host(const char *host, struct in_addr *addr)
 {
    struct hostent *hp;
@@ -704,6 +1021,31 @@ static int ipc_blocking_command(char *txbuff, size_t txlen,
    return CMD_resolve_callback(NULL, cb, arg, cb_type, rxbuff, rxlen);
 }
 
+// Encodes src exactly once, into the process's encode arena or, without a
+//  process, into a buffer the caller frees.  A length only pass of the
+//  encoder sizes the buffer first.
+static char *ipc_encode(ProcessData *proc, XDR_Encoder encoder, void *src,
+      size_t *len)
+{
+   char *buff;
+
+   *len = 0;
+   if (encoder(src, NULL, len, 0, NULL) < 0 || !*len)
+      return NULL;
+
+   buff = proc ? proc_encode_arena(proc, *len) : malloc(*len);
+   if (!buff)
+      return NULL;
+
+   if (encoder(src, buff, len, *len, NULL) < 0) {
+      if (!proc)
+         free(buff);
+      return NULL;
+   }
+
+   return buff;
+}
+
 static int IPC_command_internal(ProcessData *proc, uint32_t command,
       void *params,
       uint32_t param_type,
@@ -715,30 +1057,16 @@ static int IPC_command_internal(ProcessData *proc, uint32_t command,
    char *buff;
    size_t len;
    int res;
-   size_t buff_len = 1024;
     //steps to encode the command
 
    cmd.cmd = command;
    cmd.ipcref = next_cmd_ref++;
    cmd.parameters.type = param_type;
    cmd.parameters.data = params;
-   buff = malloc(buff_len);
 
-   if (IPC_Command_encode(&cmd, buff, &len, buff_len, NULL) < 0) {
-      if (len > buff_len) {
-         free(buff);
-         buff_len = len;
-         buff = malloc(buff_len);
-         if (!buff)
-            return -1;
-         if (IPC_Command_encode(&cmd, buff, &len, len, NULL) < 0) {
-            free(buff);
-            return -1;
-         }
-      }
-      else
-         return -1;
-   }
+   buff = ipc_encode(proc, (XDR_Encoder)&IPC_Command_encode, &cmd, &len);
+   if (!buff)
+      return -1;
 
    if (!proc) {
       res = ipc_blocking_command(buff, len, dest, cb, arg, cb_type, timeout);
@@ -747,7 +1075,7 @@ static int IPC_command_internal(ProcessData *proc, uint32_t command,
    }
     //before this, find address 
 
-   PROC_cmd_raw_sockaddr(proc, buff, len, &dest);
+   proc_cmd_sockaddr_copy_internal(proc, proc->cmdFd, buff, len, &dest);
    if (cb)
       CMD_add_response_cb(proc, cmd.ipcref, dest, cb, arg,
             cb_type, timeout);
@@ -936,32 +1264,18 @@ void IPC_response(struct ProcessData *proc, struct IPC_Command *cmd,
    struct IPC_Response resp;
    char *buff;
    size_t len;
-   size_t buff_len = 1024;
 
-   buff = malloc(buff_len);
    resp.cmd = IPC_CMDS_RESPONSE;
    resp.ipcref = cmd->ipcref;
    resp.result = IPC_RESULTCODE_SUCCESS;
    resp.data.type = param_type;
    resp.data.data = params;
 
-   if (IPC_Response_encode(&resp, buff, &len, buff_len, NULL) < 0) {
-      if (len > buff_len) {
-         free(buff);
-         buff_len = len;
-         buff = malloc(buff_len);
-         if (!buff)
-            return;
-         if (IPC_Response_encode(&resp, buff, &len, buff_len, NULL) < 0) {
-            free(buff);
-            return;
-         }
-      }
-      else
-         return;
-   }
+   buff = ipc_encode(proc, (XDR_Encoder)&IPC_Response_encode, &resp, &len);
+   if (!buff)
+      return;
 
-   PROC_cmd_raw_sockaddr(proc, buff, len, dest);
+   proc_cmd_sockaddr_copy_internal(proc, proc->cmdFd, buff, len, dest);
 }
 
 void IPC_success(struct ProcessData *proc, struct IPC_Command *cmd,
@@ -976,19 +1290,16 @@ void IPC_error(struct ProcessData *proc, struct IPC_Command *cmd,
    struct IPC_Response resp;
    char *buff;
    size_t len;
-   size_t buff_len = 128;
 
-   buff = malloc(buff_len);
    resp.cmd = IPC_CMDS_RESPONSE;
    resp.ipcref = cmd->ipcref;
    resp.result = err_code;
    resp.data.type = IPC_TYPES_VOID;
    resp.data.data = NULL;
 
-   if (IPC_Response_encode(&resp, buff, &len, buff_len, NULL) < 0) {
-      free(buff);
+   buff = ipc_encode(proc, (XDR_Encoder)&IPC_Response_encode, &resp, &len);
+   if (!buff)
       return;
-   }
 
-   PROC_cmd_raw_sockaddr(proc, buff, len, dest);
+   proc_cmd_sockaddr_copy_internal(proc, proc->cmdFd, buff, len, dest);
 }
@@ -199,6 +199,41 @@ int socket_send_packet_and_read_response(const char *dstAddr,
 int socket_send_packet_and_read_xdr(const char *dstAddr,
       const char *dstProc, void *txCmd, size_t txCmdLen,
       void *rxResp, size_t rxRespLen, int responseTimeoutMS);
+int socket_send_packet_and_read_xdr_sa(struct sockaddr_in *addr,
+      void *txCmd, size_t txCmdLen,
+      void *rxResp, size_t rxRespLen, int responseTimeoutMS);
+
+/**
+ * The blocking send functions above reuse UDP sockets connected to each
+ * destination, along with the resolved destination addresses.  Sockets idle
+ * for 30 seconds are closed.  This closes all of the cached sockets now.
+ */
+void socket_client_cache_flush(void);
+
+struct EventState;
+
+/**
+ * Callback for socket_send_packet_async.  rxResp holds the response and is
+ * only valid during the callback.  rxLen is the number of bytes in the
+ * response or negative on failure, -2 when no response arrived in time.
+ */
+typedef void (*socket_response_cb)(void *arg, void *rxResp, int rxLen);
+
+/**
+ * Non-blocking version of socket_send_packet_and_read_response.  Transmits
+ * the UDP data on a cached socket and calls cb from the event loop with the
+ * first response, or after the timeout.  The callback is not called if the
+ * event loop is freed first.
+ *
+ * @return  0 when the callback will be called, negative if the data could
+ *             not be sent.
+ */
+int socket_send_packet_async(struct EventState *evt, const char *dstAddr,
+      const char *dstProc, void *txCmd, size_t txCmdLen,
+      int responseTimeoutMS, socket_response_cb cb, void *arg);
+int socket_send_packet_async_sa(struct EventState *evt,
+      struct sockaddr_in *addr, void *txCmd, size_t txCmdLen,
+      int responseTimeoutMS, socket_response_cb cb, void *arg);
 
 /**
   * Resolve a host name or dotted-quad into an in_addr
@@ -0,0 +1,181 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "minHeap.h"
+#include <stdlib.h>
+
+#define MH_ARITY 4
+#define MH_PARENT(i) (((i) - 1) / MH_ARITY)
+#define MH_FIRST_CHILD(i) ((i) * MH_ARITY + 1)
+
+static inline void mh_set_pos(struct MinHeap *h, size_t i)
+{
+   if (h->pos_offset != MH_NO_POS)
+      *(size_t*)((char*)h->d[i].data + h->pos_offset) = i;
+}
+
+static inline void mh_clear_pos(struct MinHeap *h, void *data)
+{
+   if (h->pos_offset != MH_NO_POS)
+      *(size_t*)((char*)data + h->pos_offset) = MH_NOT_QUEUED;
+}
+
+struct MinHeap *MH_init(size_t n, size_t pos_offset)
+{
+   struct MinHeap *h;
+
+   if (n < MH_ARITY)
+      n = MH_ARITY;
+
+   h = malloc(sizeof(struct MinHeap));
+   if (!h)
+      return NULL;
+
+   h->d = malloc(n * sizeof(struct MH_entry));
+   if (!h->d) {
+      free(h);
+      return NULL;
+   }
+   h->size = 0;
+   h->avail = n;
+   h->pos_offset = pos_offset;
+
+   return h;
+}
+
+void MH_free(struct MinHeap *h)
+{
+   if (!h)
+      return;
+
+   free(h->d);
+   free(h);
+}
+
+static void mh_sift_up(struct MinHeap *h, size_t i)
+{
+   struct MH_entry moving = h->d[i];
+   size_t parent;
+
+   // Equal keys stay behind the earlier entry
+   while (i > 0 && h->d[parent = MH_PARENT(i)].key > moving.key) {
+      h->d[i] = h->d[parent];
+      mh_set_pos(h, i);
+      i = parent;
+   }
+
+   h->d[i] = moving;
+   mh_set_pos(h, i);
+}
+
+static void mh_sift_down(struct MinHeap *h, size_t i)
+{
+   struct MH_entry moving = h->d[i];
+   size_t child, last, min;
+
+   while ((child = MH_FIRST_CHILD(i)) < h->size) {
+      last = child + MH_ARITY;
+      if (last > h->size)
+         last = h->size;
+
+      for (min = child++; child < last; child++)
+         if (h->d[child].key < h->d[min].key)
+            min = child;
+
+      if (h->d[min].key >= moving.key)
+         break;
+
+      h->d[i] = h->d[min];
+      mh_set_pos(h, i);
+      i = min;
+   }
+
+   h->d[i] = moving;
+   mh_set_pos(h, i);
+}
+
+int MH_insert(struct MinHeap *h, void *data, int64_t key)
+{
+   struct MH_entry *tmp;
+
+   if (h->size == h->avail) {
+      tmp = realloc(h->d, h->avail * 2 * sizeof(struct MH_entry));
+      if (!tmp)
+         return -1;
+      h->d = tmp;
+      h->avail *= 2;
+   }
+
+   h->d[h->size].key = key;
+   h->d[h->size].data = data;
+   mh_sift_up(h, h->size++);
+
+   return 0;
+}
+
+void *MH_pop(struct MinHeap *h)
+{
+   void *head;
+
+   if (!h->size)
+      return NULL;
+
+   head = h->d[0].data;
+   if (--h->size) {
+      h->d[0] = h->d[h->size];
+      mh_sift_down(h, 0);
+   }
+   mh_clear_pos(h, head);
+
+   return head;
+}
+
+void MH_remove(struct MinHeap *h, size_t pos)
+{
+   void *goner;
+   int64_t key;
+
+   if (pos >= h->size)
+      return;
+
+   goner = h->d[pos].data;
+   key = h->d[pos].key;
+   if (pos != --h->size) {
+      h->d[pos] = h->d[h->size];
+      if (h->d[pos].key < key)
+         mh_sift_up(h, pos);
+      else
+         mh_sift_down(h, pos);
+   }
+   mh_clear_pos(h, goner);
+}
+
+void MH_update(struct MinHeap *h, size_t pos, int64_t key)
+{
+   int64_t old;
+
+   if (pos >= h->size)
+      return;
+
+   old = h->d[pos].key;
+   h->d[pos].key = key;
+   if (key < old)
+      mh_sift_up(h, pos);
+   else
+      mh_sift_down(h, pos);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file minHeap.h 4-ary min heap with inline 64-bit keys.
+ *
+ * Each heap entry stores its key next to the element pointer, so sifting
+ * compares integers in the heap array without calling back into or loading
+ * the elements.  Four children per node halves the depth of a binary heap
+ * and keeps siblings in the same cache line.  Elements may optionally carry
+ * a size_t position field, given as a byte offset when the heap is created,
+ * which the heap keeps up to date so elements can be removed or rekeyed.
+ * The ps_pqueue API in priorityQueue.h remains for callers that need a
+ * custom comparison.
+ */
+
+#ifndef MIN_HEAP_H
+#define MIN_HEAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Position offset for elements that don't track their position */
+#define MH_NO_POS SIZE_MAX
+
+/** Position of an element that isn't in a heap */
+#define MH_NOT_QUEUED SIZE_MAX
+
+struct MH_entry {
+   int64_t key;
+   void *data;
+};
+
+struct MinHeap {
+   size_t size;
+   size_t avail;
+   size_t pos_offset;      // Offset of the element's position, or MH_NO_POS
+   struct MH_entry *d;
+};
+
+/**
+ * Create an empty heap.
+ *
+ * @param n The number of entries to preallocate.
+ * @param pos_offset Offset of a size_t position field within each element,
+ *    or MH_NO_POS.
+ *
+ * @return The heap or NULL for insufficient memory.
+ */
+struct MinHeap *MH_init(size_t n, size_t pos_offset);
+
+/**
+ * Free the heap.  Elements still in the heap are not touched.
+ */
+void MH_free(struct MinHeap *h);
+
+/**
+ * Add an element to the heap.
+ *
+ * @return 0 on success, -1 for insufficient memory.
+ */
+int MH_insert(struct MinHeap *h, void *data, int64_t key);
+
+/**
+ * Remove and return the element with the smallest key, or NULL if the heap
+ * is empty.
+ */
+void *MH_pop(struct MinHeap *h);
+
+/**
+ * Remove the element at the given position, as stored in its position
+ * field.  The element's position is set to MH_NOT_QUEUED.
+ */
+void MH_remove(struct MinHeap *h, size_t pos);
+
+/**
+ * Change the key of the element at the given position.
+ */
+void MH_update(struct MinHeap *h, size_t pos, int64_t key);
+
+/**
+ * @return The number of elements in the heap.
+ */
+static inline size_t MH_size(struct MinHeap *h)
+{
+   return h->size;
+}
+
+/**
+ * @return The element with the smallest key, or NULL if the heap is empty.
+ */
+static inline void *MH_peek(struct MinHeap *h)
+{
+   return h->size ? h->d[0].data : NULL;
+}
+
+/**
+ * @return The element at a position between 0 and MH_size() - 1.  Elements
+ *    are in heap order, not sorted order.
+ */
+static inline void *MH_get(struct MinHeap *h, size_t pos)
+{
+   return h->d[pos].data;
+}
+
+/**
+ * Convert a time to a heap key in nanoseconds.
+ */
+static inline int64_t MH_tv2key(const struct timeval *tv)
+{
+   return (int64_t)tv->tv_sec * 1000000000 + (int64_t)tv->tv_usec * 1000;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -44,17 +44,30 @@
 #include <time.h>
 #include "critical.h"
 #include <pthread.h>
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
 #include "ipc.h"
 #include "pseudo_threads.h"
 #include "cmd-pkt.h"
+#include "workerPool.h"
 
 #define READ_BUFF_MIN 4096
 #define READ_BUFF_MAX (READ_BUFF_MIN * 4)
 #define WATCHDOG_VALIDATE_SECS 30
+// Most signals read from the signal fd or pipe per system call
+#define SIGNAL_BATCH 16
+// Most queued datagrams sent per sendmmsg call
+#define SEND_BATCH 64
+// Delay between flushes of a queue whose fd the event loop can't watch
+#define SEND_RETRY_MS 10
 
 static int signalWriteFD = -1;
+// Signals blocked for the signalfd, unblocked again in forked children
+static sigset_t routedSigs;
+static pthread_once_t routedSigsOnce = PTHREAD_ONCE_INIT;
 
-static int sigchld_handler(int, void*);
+static int sigchld_handler(const siginfo_t*, void*);
 static int setup_signal_fd(ProcessData *proc);
 
 //When a socket is written to, this is the call back that is called
@@ -64,10 +77,11 @@ static int socket_write_cb(int fd, char type, void * arg);
 struct ProcSignalCB
 {
    PROC_signal_cb cb;      /* A pointer to the signal callback function */
+   PROC_siginfo_cb infoCb; /* Used instead of cb when set */
    void *arg;                /* The arguments to pass */
    int sigNum;             /* The signal number to respond to */
    int recvdCnt;
-   struct ProcSignalCB *next;  /* The next signal callback */
+   struct ProcSignalCB *next;  /* The next callback for the same signal */
 };
 
 #define FREE_DATA_AFTER_WRITE 1
@@ -88,6 +102,27 @@ struct ProcWriteNode {
    struct ProcWriteNode *next;
 };
 
+struct MsgData {
+   ProcessData *proc;
+   char *data;
+   size_t dataLen;
+   struct sockaddr_in dest;
+   struct MsgData *next;
+};
+
+/* Datagrams waiting to be sent together on one socket */
+struct ProcSendQueue {
+   ProcessData *proc;
+   int fd;
+   struct MsgData *head, **tail;
+   int scheduled;             // A deferred flush is pending
+   void *flush_evt;           // Cancel key of the pending flush
+   int blocked;               // Waiting for the socket to become writable
+   void *retry_evt;           // Timed flush when the fd can't be watched
+   struct ProcSendQueue *next;
+};
+
+static void proc_send_queue_free(struct ProcSendQueue *q);
 
 /** Returns the EVTHandler context for the process.  Needed to directly call
   * EVT_* functions.
@@ -110,6 +145,8 @@ static ProcessData *watchProc = NULL;
 static int proc_cmd_sockaddr_internal(ProcessData *proc, int fd, unsigned char cmd, void *data, size_t dataLen, struct sockaddr_in *dest);
 int proc_cmd_sockaddr_raw_internal(ProcessData *proc, int fd, void *data,
       size_t dataLen, struct sockaddr_in *dest);
+int proc_cmd_sockaddr_copy_internal(ProcessData *proc, int fd,
+      const void *data, size_t dataLen, struct sockaddr_in *dest);
 
 static void watchdog_reg_info(int fd, unsigned char cmd, void *data,
    size_t dataLen, struct sockaddr_in *src)
@@ -341,14 +378,17 @@ ProcessData *PROC_init_xdr_hashsize(const char *procName, enum WatchdogMode wdMo
    EVT_fd_add(proc->evtHandler, proc->cmdFd, EVENT_FD_READ, cmd_handler_cb, proc);
    EVT_fd_set_name(proc->evtHandler, proc->cmdFd, "UDP Command Socket");
    EVT_fd_set_critical(proc->evtHandler, proc->cmdFd, 0);
+   // Keep command latency bounded when other fds carry bulk traffic
+   EVT_fd_set_priority(proc->evtHandler, proc->cmdFd, EVT_PRIO_REALTIME);
    //Event for when something (probably a command response) appears on the fd
    EVT_fd_add(proc->evtHandler, proc->txFd, EVENT_FD_READ, tx_cmd_handler_cb, proc);
    EVT_fd_set_name(proc->evtHandler, proc->txFd, "UDP Request Socket");
    EVT_fd_set_critical(proc->evtHandler, proc->txFd, 0);
+   EVT_fd_set_priority(proc->evtHandler, proc->txFd, EVT_PRIO_REALTIME);
    EVT_set_cmds_pending(proc->evtHandler,
          (int (*)(void*))&CMD_pending_responses, proc->cmds);
    //Set up SIGCHLD signal handler
-   PROC_signal(proc, SIGCHLD, &sigchld_handler, proc);
+   PROC_signal_info(proc, SIGCHLD, &sigchld_handler, proc);
 
    // Register process with the s/w watchdog (make sure to send null byte!)
    PROC_wd_enable(proc);
@@ -381,6 +421,7 @@ void PROC_wd_enable(ProcessData *proc) {
 void PROC_cleanup(ProcessData *proc)
 {
    char filepath[80];
+   struct ProcSendQueue *sendq;
 
    if (!proc) //Already clean
       return;
@@ -389,9 +430,29 @@ void PROC_cleanup(ProcessData *proc)
    if (proc->wdMode != WD_NOTSAT)
       critical_state_cleanup(&proc->criticalState);
 
+   // Finish running work and cancel queued work before its completions are
+   //  delivered below
+   WP_destroy(proc->workers);
+   proc->workers = NULL;
+
+   // Send queued datagrams while the loop and sockets still exist
+   while ((sendq = proc->sendQueues)) {
+      proc->sendQueues = sendq->next;
+      proc_send_queue_free(sendq);
+   }
+
    // Clear errno to prevent false errors
    errno = 0;
    EVT_free_handler(proc->evtHandler);
+   // Stop the handler writing to the pipe before unblocking delivers any
+   //  pending signals and before the pipe is closed
+   signalWriteFD = -1;
+   if (proc->sigFd >= 0) {
+      pthread_sigmask(SIG_UNBLOCK, &proc->sigMask, NULL);
+      sigemptyset(&routedSigs);
+      close(proc->sigFd);
+      ERRNO_WARN("close sigFd error: ");
+   }
    close(proc->sigPipe[0]);
    ERRNO_WARN("close sigPipe[0] error: ");
    close(proc->sigPipe[1]);
@@ -400,7 +461,6 @@ void PROC_cleanup(ProcessData *proc)
    ERRNO_WARN("close cmdFd error: ");
    close(proc->txFd);
    ERRNO_WARN("close txFd error: ");
-   signalWriteFD = -1;
 
    if (proc->name) {
       //** Remove the .pid and .proc files **
@@ -421,14 +481,18 @@ void PROC_cleanup(ProcessData *proc)
    }
 
    struct ProcSignalCB *curr;
+   int sig;
 
-   while((curr = proc->signalCBHead)) {
-      proc->signalCBHead = curr->next;
-      free(curr);
+   for (sig = 0; sig < NSIG; sig++) {
+      while((curr = proc->signalCBs[sig])) {
+         proc->signalCBs[sig] = curr->next;
+         free(curr);
+      }
    }
 
    cmd_handler_cleanup(&proc->cmds);
 
+   free(proc->encodeBuff);
    free(proc);
 }
 
@@ -464,52 +528,93 @@ static void validate_pipe_flush(ProcChild *child)
    }
 }
 
-static int sigchld_handler(int signum, void *param)
+// Reaps the given child, or any child if pid is -1.  Returns the reaped pid.
+static pid_t proc_reap_child(ProcessData *proc, pid_t pid)
 {
-   ProcessData *proc = (ProcessData*)param;
-   int more;
    pid_t cpid;
    struct rusage rusage;
    int exitStatus;
    struct ProcChild *curr, *tmp;
 
-   do {
-      cpid = wait4(-1, &exitStatus, WNOHANG, &rusage);
-      more = 0 < cpid;
-      if (cpid < 0) {
-         if (ECHILD != errno)
-            ERRNO_WARN("Error with wait4");
-      }
-      else if (cpid > 0) {
-         for(curr = proc->childHead; curr; curr = tmp) {
-            // Use tmp for iteration in case child is deallocated
-            tmp = curr->next;
-            if (curr->procId != cpid || curr->state == CHILD_STATE_DONE)
-               continue;
-
-            curr->rusage = rusage;
-            curr->exitStatus = exitStatus;
-            curr->state = CHILD_STATE_FLUSH_PIPES;
-            validate_pipe_flush(curr);
-         }
-      }
-   } while(more);
+   cpid = wait4(pid, &exitStatus, WNOHANG, &rusage);
+   if (cpid < 0) {
+      if (ECHILD != errno)
+         ERRNO_WARN("Error with wait4");
+      return cpid;
+   }
+   if (0 == cpid)
+      return cpid;
+
+   for(curr = proc->childHead; curr; curr = tmp) {
+      // Use tmp for iteration in case child is deallocated
+      tmp = curr->next;
+      if (curr->procId != cpid || curr->state == CHILD_STATE_DONE)
+         continue;
+
+      curr->rusage = rusage;
+      curr->exitStatus = exitStatus;
+      curr->state = CHILD_STATE_FLUSH_PIPES;
+      validate_pipe_flush(curr);
+   }
+
+   return cpid;
+}
+
+static int sigchld_handler(const siginfo_t *info, void *param)
+{
+   ProcessData *proc = (ProcessData*)param;
+
+   // Reap the child named in the siginfo directly.  Pending SIGCHLDs are
+   //  merged, so other children may have exited too.  Sweep for them, which
+   //  normally costs a single wait4 that finds nothing.
+   if (info->si_pid > 0)
+      proc_reap_child(proc, info->si_pid);
+   while (proc_reap_child(proc, -1) > 0)
+      ;
+
    return EVENT_KEEP;
 }
 
-int signal_fd_cb(int fd, char type, void *arg)
+// Runs every callback registered for the signal
+static void proc_dispatch_signal(ProcessData *proc, const siginfo_t *info)
 {
-   ProcessData *proc = (ProcessData*)arg;
-   int rd, signum;
-   static char rdBuff[sizeof(signum)];
-   static int rdLen = 0;
    struct ProcSignalCB **curr, *sigTmp;
+   int signum = info->si_signo;
    int keep;
 
+   if (signum <= 0 || signum >= NSIG)
+      return;
+
+   for (curr = &proc->signalCBs[signum]; *curr; ) {
+      sigTmp = *curr;
+      sigTmp->recvdCnt++;
+      //cb is assigned in PROC_signal
+      if (sigTmp->infoCb)
+         keep = (*sigTmp->infoCb)(info, sigTmp->arg);
+      else
+         keep = (*sigTmp->cb)(signum, sigTmp->arg);
+
+      if (EVENT_REMOVE == keep) {
+         *curr = sigTmp->next;
+         free(sigTmp);
+      }
+      else
+         curr = &sigTmp->next;
+   }
+}
+
+int signal_fd_cb(int fd, char type, void *arg)
+{
+   ProcessData *proc = (ProcessData*)arg;
+   siginfo_t buff[SIGNAL_BATCH];
+   ssize_t rd;
+   int i;
+
+   // The handler writes whole siginfo_t records, which is atomic for pipes,
+   //  so reads never split a record
    do {
-      rd = read(proc->sigPipe[0], &rdBuff[rdLen], sizeof(rdBuff) - rdLen);
-      // more = rd > 0 || (-1 == rd && EAGAIN == errno);
-      if (-1 >= rd && EAGAIN != errno) {
+      rd = read(fd, buff, sizeof(buff));
+      if (-1 >= rd && EAGAIN != errno && EINTR != errno) {
          ERRNO_WARN("signal fd error, closing:");
          return EVENT_REMOVE;
       }
@@ -518,57 +623,100 @@ int signal_fd_cb(int fd, char type, void *arg)
          return EVENT_REMOVE;
       }
 
-      rdLen += rd;
-      if (rdLen == sizeof(rdBuff)) {
-         rdLen = 0;
-         memcpy(&signum, rdBuff, sizeof(rdBuff));
-
-         for (curr = &proc->signalCBHead; *curr; ) {
-            sigTmp = *curr;
-
-            if (sigTmp->sigNum == signum) {
-               sigTmp->recvdCnt++;
-               //cb is assigned in PROC_signal
-               keep = (*sigTmp->cb)(signum, sigTmp->arg);
-
-               if (EVENT_REMOVE == keep) {
-                  *curr = sigTmp->next;
-                  free(sigTmp);
-               }
-               else
-                  curr = &sigTmp->next;
-            }
-            else
-               curr = &sigTmp->next;
-         }
+      for (i = 0; rd > 0 && i < rd / sizeof(buff[0]); i++)
+         proc_dispatch_signal(proc, &buff[i]);
+   } while(rd == sizeof(buff));
+
+   return EVENT_KEEP;
+}
+
+#ifdef __linux__
+static void sigfd_to_siginfo(const struct signalfd_siginfo *ssi,
+      siginfo_t *info)
+{
+   memset(info, 0, sizeof(*info));
+   info->si_signo = ssi->ssi_signo;
+   info->si_errno = ssi->ssi_errno;
+   info->si_code = ssi->ssi_code;
+   info->si_pid = ssi->ssi_pid;
+   info->si_uid = ssi->ssi_uid;
+   if (SIGCHLD == ssi->ssi_signo) {
+      info->si_status = ssi->ssi_status;
+      info->si_utime = ssi->ssi_utime;
+      info->si_stime = ssi->ssi_stime;
+   }
+   else
+      info->si_value.sival_ptr = (void*)(uintptr_t)ssi->ssi_ptr;
+}
+
+static int signal_sigfd_cb(int fd, char type, void *arg)
+{
+   ProcessData *proc = (ProcessData*)arg;
+   struct signalfd_siginfo buff[SIGNAL_BATCH];
+   siginfo_t info;
+   ssize_t rd;
+   int i;
+
+   do {
+      rd = read(fd, buff, sizeof(buff));
+      if (-1 >= rd && EAGAIN != errno && EINTR != errno) {
+         ERRNO_WARN("signalfd error, closing:");
+         return EVENT_REMOVE;
       }
-   } while(0);
+
+      for (i = 0; rd > 0 && i < rd / sizeof(buff[0]); i++) {
+         sigfd_to_siginfo(&buff[i], &info);
+         proc_dispatch_signal(proc, &info);
+      }
+   } while(rd == sizeof(buff));
 
    return EVENT_KEEP;
 }
+#endif
 
 static void PROC_signal_handler(int sigNum, siginfo_t *si, void *p)
 {
+   int err = errno;
+
    if (signalWriteFD != -1)
-      if(write(signalWriteFD, &sigNum, sizeof(sigNum)) < sizeof(sigNum) )
+      if(write(signalWriteFD, si, sizeof(*si)) < sizeof(*si) )
       	ERRNO_WARN("Write error");
+   errno = err;
+}
+
+// The blocked mask survives fork and exec, so give every forked child back
+//  the signals routed through the signalfd
+static void proc_fork_child_unblock(void)
+{
+   sigprocmask(SIG_UNBLOCK, &routedSigs, NULL);
+}
+
+static void proc_routed_sigs_init(void)
+{
+   sigemptyset(&routedSigs);
+   pthread_atfork(NULL, NULL, &proc_fork_child_unblock);
 }
 
 static int setup_signal_fd(ProcessData *proc)
 {
    int currFlags;
    int res;
+   const char *mode;
+
+   proc->sigFd = -1;
+   sigemptyset(&proc->sigMask);
    if (-1 != signalWriteFD)
       return 0;
+   pthread_once(&routedSigsOnce, &proc_routed_sigs_init);
 
    if (0 != pipe(proc->sigPipe))
       return errno;
 
    // Set the read end of the pipe to non-blocking
-   currFlags = fcntl(proc->sigPipe[0], F_GETFD);
+   currFlags = fcntl(proc->sigPipe[0], F_GETFL);
    if (-1 == currFlags)
       return -1;
-   if (-1 == fcntl(proc->sigPipe[0], F_SETFD, O_NONBLOCK))
+   if (-1 == fcntl(proc->sigPipe[0], F_SETFL, currFlags | O_NONBLOCK))
       return -1;
 
    signalWriteFD = proc->sigPipe[1];
@@ -576,14 +724,35 @@ static int setup_signal_fd(ProcessData *proc)
          EVENT_FD_READ, signal_fd_cb, proc);
    EVT_fd_set_name(proc->evtHandler, proc->sigPipe[0], "Signal Pipe");
    EVT_fd_set_critical(proc->evtHandler, proc->sigPipe[0], 0);
+
+#ifdef __linux__
+   // The pipe stays in place for signals delivered to threads that don't
+   //  have them blocked
+   mode = getenv("LIBPROC_SIGNAL");
+   if (!mode || strcasecmp(mode, "pipe")) {
+      proc->sigFd = signalfd(-1, &proc->sigMask, SFD_NONBLOCK | SFD_CLOEXEC);
+      if (proc->sigFd < 0)
+         ERRNO_WARN("signalfd failed, using signal pipe: ");
+      else {
+         EVT_fd_add(proc->evtHandler, proc->sigFd, EVENT_FD_READ,
+               signal_sigfd_cb, proc);
+         EVT_fd_set_name(proc->evtHandler, proc->sigFd, "Signal FD");
+         EVT_fd_set_critical(proc->evtHandler, proc->sigFd, 0);
+      }
+   }
+#else
+   (void)mode;
+#endif
+
    return res;
 }
 
-int PROC_signal(struct ProcessData *proc, int sigNum, PROC_signal_cb cb,
-            void *p)
+static int proc_add_signal(struct ProcessData *proc, int sigNum,
+      PROC_signal_cb cb, PROC_siginfo_cb infoCb, void *p)
 {
    struct ProcSignalCB *curr;
    struct sigaction sa;
+   sigset_t sigs;
 
    if (-1 == signalWriteFD) {
       DBG_print(DBG_LEVEL_WARN, "Failed to add signal because ProcessData"
@@ -597,28 +766,64 @@ int PROC_signal(struct ProcessData *proc, int sigNum, PROC_signal_cb cb,
       return -1;
    }
 
+   if (sigNum <= 0 || sigNum >= NSIG)
+      return -1;
+
    curr = malloc(sizeof(struct ProcSignalCB));
    if (!curr)
       return -1;
 
    curr->cb = cb;
+   curr->infoCb = infoCb;
    curr->arg = p;
    curr->sigNum = sigNum;
    curr->recvdCnt = 0;
-   curr->next = proc->signalCBHead;
-   proc->signalCBHead = curr;
+   curr->next = proc->signalCBs[sigNum];
+   proc->signalCBs[sigNum] = curr;
 
    sa.sa_sigaction = PROC_signal_handler;
    sigfillset(&sa.sa_mask); //Catch all signals
    sa.sa_flags = SA_SIGINFO;
    if (-1 == sigaction(sigNum, &sa, NULL)) {
+      proc->signalCBs[sigNum] = curr->next;
       free(curr);
       return -1;
    }
 
+#ifdef __linux__
+   // Route the signal through the signalfd.  Threads created from here on
+   //  inherit the blocked mask.
+   if (proc->sigFd >= 0 && !sigismember(&proc->sigMask, sigNum)) {
+      sigaddset(&proc->sigMask, sigNum);
+      if (-1 == signalfd(proc->sigFd, &proc->sigMask, 0)) {
+         ERRNO_WARN("signalfd update failed: ");
+         sigdelset(&proc->sigMask, sigNum);
+         return 0;
+      }
+      sigemptyset(&sigs);
+      sigaddset(&sigs, sigNum);
+      sigaddset(&routedSigs, sigNum);
+      pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+   }
+#else
+   (void)sigs;
+#endif
+
    return 0;
 }
 
+int PROC_signal(struct ProcessData *proc, int sigNum, PROC_signal_cb cb,
+            void *p)
+{
+   return proc_add_signal(proc, sigNum, cb, NULL, p);
+}
+
+int PROC_signal_info(struct ProcessData *proc, int sigNum, PROC_siginfo_cb cb,
+            void *p)
+{
+   return proc_add_signal(proc, sigNum, NULL, cb, p);
+}
+
 static int next_param(char *str, char **start, char **end)
 {
    int inQuote = 0;
@@ -1192,13 +1397,6 @@ char CHLD_stderr_reader(ProcChild *child, CHLD_buf_stream_cb_t cb, void *arg)
    return res;
 }
 
-struct MsgData {
-   ProcessData *proc;
-   char *data;
-   size_t dataLen;
-   struct sockaddr_in dest;
-};
-
 int socket_write_cb(int fd, char type, void * arg)
 {
    // by default, should remove the event
@@ -1208,12 +1406,12 @@ int socket_write_cb(int fd, char type, void * arg)
    errno = 0;
    socket_write(fd, msg->data, msg->dataLen, &(msg->dest));
 
-   if (errno == 0) {
-      free(msg->data);
-      free(msg);
-   } else if (errno == EAGAIN) {
+   if (errno == EAGAIN) {
       // if for some reason it's still trying to block, keep the event
       retval = EVENT_KEEP;
+   } else {
+      free(msg->data);
+      free(msg);
    }
 
    return retval;
@@ -1292,12 +1490,202 @@ int PROC_cmd_sockaddr_secondary(ProcessData *proc, unsigned char cmd, void *data
    return proc_cmd_sockaddr_internal(proc, proc->txFd, cmd, data, dataLen, dest);
 }
 
+static struct ProcSendQueue *proc_send_queue(ProcessData *proc, int fd)
+{
+   struct ProcSendQueue *q;
+
+   for (q = proc->sendQueues; q; q = q->next)
+      if (q->fd == fd)
+         return q;
+
+   return NULL;
+}
+
+// Sends queued datagrams until the queue is empty or the socket would
+//  block.  Returns -1 if it would block.
+static int proc_send_flush(struct ProcSendQueue *q)
+{
+   struct MsgData *msg;
+   int sent, i, n;
+#ifdef __linux__
+   struct mmsghdr msgs[SEND_BATCH];
+   struct iovec iov[SEND_BATCH];
+
+   while (q->head) {
+      memset(msgs, 0, sizeof(msgs));
+      msg = q->head;
+      for (n = 0; msg && n < SEND_BATCH; msg = msg->next, n++) {
+         iov[n].iov_base = msg->data;
+         iov[n].iov_len = msg->dataLen;
+         msgs[n].msg_hdr.msg_name = &msg->dest;
+         msgs[n].msg_hdr.msg_namelen = sizeof(msg->dest);
+         msgs[n].msg_hdr.msg_iov = &iov[n];
+         msgs[n].msg_hdr.msg_iovlen = 1;
+      }
+
+      sent = sendmmsg(q->fd, msgs, n, MSG_DONTWAIT);
+#else
+   while (q->head) {
+      n = 1;
+      sent = sendto(q->fd, q->head->data, q->head->dataLen, MSG_DONTWAIT,
+            (struct sockaddr*)&q->head->dest, sizeof(q->head->dest));
+      if (sent >= 0)
+         sent = 1;
+#endif
+      if (sent < 0) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -1;
+         if (errno == EINTR)
+            continue;
+         // Drop the datagram that failed, like an immediate send would
+         ERRNO_WARN("send queue - sendmmsg\n");
+         sent = 1;
+      }
+
+      for (i = 0; i < sent; i++) {
+         msg = q->head;
+         q->head = msg->next;
+         free(msg->data);
+         free(msg);
+      }
+      if (!q->head)
+         q->tail = &q->head;
+   }
+
+   return 0;
+}
+
+static int proc_send_writable_cb(int fd, char type, void *arg)
+{
+   struct ProcSendQueue *q = (struct ProcSendQueue*)arg;
+
+   if (proc_send_flush(q) < 0)
+      return EVENT_KEEP;
+
+   q->blocked = 0;
+   return EVENT_REMOVE;
+}
+
+static int proc_send_flush_cb(void *arg)
+{
+   struct ProcSendQueue *q = (struct ProcSendQueue*)arg;
+   int retrying = q->retry_evt != NULL;
+
+   q->scheduled = 0;
+   q->flush_evt = NULL;
+   q->retry_evt = NULL;
+   if (q->blocked || proc_send_flush(q) == 0)
+      return EVENT_REMOVE;
+
+   q->blocked = 1;
+   if (EVT_fd_add(PROC_evt(q->proc), q->fd, EVENT_FD_WRITE,
+            proc_send_writable_cb, q))
+      return EVENT_REMOVE;
+
+   // Fall back to polling for room in the socket buffer.  If that can't be
+   //  scheduled either, the next datagram queued tries again.
+   if (!retrying)
+      DBG_print(DBG_LEVEL_WARN, "send queue - can't watch fd %d for writes, "
+            "retrying every %d ms\n", q->fd, SEND_RETRY_MS);
+   q->blocked = 0;
+   q->retry_evt = EVT_sched_add(PROC_evt(q->proc), EVT_ms2tv(SEND_RETRY_MS),
+         proc_send_flush_cb, q);
+   if (q->retry_evt)
+      q->scheduled = 1;
+
+   return EVENT_REMOVE;
+}
+
+static void proc_send_enqueue(struct ProcSendQueue *q, struct MsgData *msg)
+{
+   void *key;
+
+   msg->next = NULL;
+   *q->tail = msg;
+   q->tail = &msg->next;
+
+   if (q->scheduled || q->blocked)
+      return;
+
+   // Runs the flush right away when called outside the event loop
+   q->scheduled = 1;
+   key = EVT_defer_add(PROC_evt(q->proc), proc_send_flush_cb, q);
+   if (q->scheduled)
+      q->flush_evt = key;
+}
+
+// Sends what can be sent without blocking and frees the queue
+static void proc_send_queue_free(struct ProcSendQueue *q)
+{
+   struct MsgData *msg;
+
+   if (q->retry_evt)
+      EVT_sched_remove(PROC_evt(q->proc), q->retry_evt);
+   else if (q->scheduled)
+      EVT_defer_cancel(PROC_evt(q->proc), q->flush_evt);
+   if (q->blocked)
+      EVT_fd_remove(PROC_evt(q->proc), q->fd, EVENT_FD_WRITE);
+   proc_send_flush(q);
+
+   while ((msg = q->head)) {
+      q->head = msg->next;
+      free(msg->data);
+      free(msg);
+   }
+   free(q);
+}
+
+int PROC_set_send_queue(ProcessData *proc, int fd, int enable)
+{
+   struct ProcSendQueue *q, **curr;
+
+   if (!proc || fd < 0)
+      return -1;
+
+   if (!enable) {
+      for (curr = &proc->sendQueues; *curr; curr = &(*curr)->next) {
+         if ((*curr)->fd == fd) {
+            q = *curr;
+            *curr = q->next;
+            proc_send_queue_free(q);
+            break;
+         }
+      }
+      return 0;
+   }
+
+   if (proc_send_queue(proc, fd))
+      return 0;
+
+   q = malloc(sizeof(*q));
+   if (!q)
+      return -1;
+   memset(q, 0, sizeof(*q));
+   q->proc = proc;
+   q->fd = fd;
+   q->tail = &q->head;
+   q->next = proc->sendQueues;
+   proc->sendQueues = q;
+
+   return 0;
+}
+
 int proc_cmd_sockaddr_raw_internal(ProcessData *proc, int fd, void *data,
       size_t dataLen, struct sockaddr_in *dest)
 {
    int retval = 0;
+   struct ProcSendQueue *q;
    struct MsgData *msg = (struct MsgData*)malloc(sizeof(struct MsgData));
 
+   if ((q = proc_send_queue(proc, fd))) {
+      msg->proc = proc;
+      msg->data = data;
+      msg->dataLen = dataLen;
+      msg->dest = *dest;
+      proc_send_enqueue(q, msg);
+      return dataLen;
+   }
+
    // create buffer large enough to fit data + command
    msg->data = data;
    msg->dataLen = dataLen;
@@ -1306,12 +1694,12 @@ int proc_cmd_sockaddr_raw_internal(ProcessData *proc, int fd, void *data,
    errno = 0;
    retval = socket_write(fd, (void*)(msg->data), msg->dataLen, dest);
 
-   // If it executed error free, it succeeded!
-   if (errno == 0) {
+   // Unless the send would block the data is done with, even on error
+   if (errno != EAGAIN) {
       // free temporary data
       free(msg->data);
       free(msg);
-   } else if (errno == EAGAIN) {
+   } else {
       // EAGAIN indicates the operation would block
       // DBG("Socket is going to block, FYI!\n");
       msg->proc = proc;
@@ -1325,6 +1713,44 @@ int proc_cmd_sockaddr_raw_internal(ProcessData *proc, int fd, void *data,
    return retval;
 }
 
+char *proc_encode_arena(ProcessData *proc, size_t len)
+{
+   char *buff;
+
+   if (len > proc->encodeLen) {
+      buff = realloc(proc->encodeBuff, len);
+      if (!buff)
+         return NULL;
+      proc->encodeBuff = buff;
+      proc->encodeLen = len;
+   }
+
+   return proc->encodeBuff;
+}
+
+// Sends data the caller keeps, such as the encode arena.  The data is only
+//  copied when the datagram has to outlive the call.
+int proc_cmd_sockaddr_copy_internal(ProcessData *proc, int fd,
+      const void *data, size_t dataLen, struct sockaddr_in *dest)
+{
+   char *copy;
+   int retval;
+
+   if (!proc_send_queue(proc, fd)) {
+      errno = 0;
+      retval = socket_write(fd, (void*)data, dataLen, dest);
+      if (errno != EAGAIN)
+         return retval;
+   }
+
+   copy = malloc(dataLen);
+   if (!copy)
+      return -1;
+   memcpy(copy, data, dataLen);
+
+   return proc_cmd_sockaddr_raw_internal(proc, fd, copy, dataLen, dest);
+}
+
 int proc_cmd_sockaddr_internal(ProcessData *proc, int fd, unsigned char cmd, void *data, size_t dataLen, struct sockaddr_in *dest)
 {
    char *d;
@@ -1448,8 +1874,8 @@ int PROC_nonblocking_write_callback(struct ProcessData *proc, int fd, uint8_t *d
 
    // Register the write callback
    if (!writePending) {
-      if (EVT_fd_add(proc->evtHandler, newNode->fd, EVENT_FD_WRITE,
-               &write_event_callback, proc) < 0) {
+      if (!EVT_fd_add(proc->evtHandler, newNode->fd, EVENT_FD_WRITE,
+               &write_event_callback, proc)) {
          *curr = NULL;
          if (newNode->freeMem && newNode->data)
             free(newNode->data);
@@ -1462,87 +1888,48 @@ int PROC_nonblocking_write_callback(struct ProcessData *proc, int fd, uint8_t *d
    return 0;
 }
 
-struct thread_data{
-   int write_fd;
-   int read_fd;
-   pthread_t thread;
-   int (*fcn)(void *arg);
-   void *fcn_arg;
-   int (*cb_fcn)(void *arg, int retval);
-   void *cb_arg;
-   int retval;
-};
-
-void *thread_main(void *arg)
+// Creates the worker pool on first use
+static struct WorkerPool *proc_workers(ProcessData *proc)
 {
-   struct thread_data *data = (struct thread_data *)arg;
-
-   data->retval = data->fcn(data->fcn_arg);
-
-   //write data to trigger callback in event loop
-   char letter = 'q';
-   if(write(data->write_fd, &letter, sizeof(letter)) < sizeof(letter)) {
-      ERRNO_WARN("Failed to write callback\n");
-   }
+   if (!proc->workers)
+      proc->workers = WP_init(PROC_evt(proc), PROC_WORKER_THREADS,
+            PROC_WORKER_QUEUE_LEN);
 
-   pthread_exit(data);
+   return proc->workers;
 }
 
-static int thread_cb(int fd, char type, void *data)
+int PROC_set_workers(ProcessData *proc, int threads, int queue_len)
 {
-   struct thread_data *ret = (struct thread_data *)data;
+   struct WorkerPool *pool;
 
-   //join thread
-   pthread_join(ret->thread, (void **)&ret);
+   pool = WP_init(PROC_evt(proc), threads, queue_len);
+   if (!pool)
+      return -1;
 
-   ret->cb_fcn(ret->cb_arg, ret->retval);
+   WP_destroy(proc->workers);
+   proc->workers = pool;
 
-   //clean up pipe
-   close(ret->read_fd);
-   close(ret->write_fd);
-   free(ret);
+   return 0;
+}
 
-   return EVENT_REMOVE;
+int PROC_set_recv_batch(ProcessData *proc, int count)
+{
+   if (!proc || count < 1)
+      return -1;
+
+   return CMD_set_recv_batch(proc->cmds, count);
 }
 
 int thread_function(ProcessData *proc, void *fcn_ptr, void *arg, void *cb_fcn,
 void *cb_arg)
 {
-   //wrap data needed for thread in struct
-   struct thread_data *data = malloc(sizeof(struct thread_data));
-   data->cb_fcn = cb_fcn;
-   data->cb_arg = cb_arg;
-   pthread_attr_t attr;
-
-   //create pipe
-   int fd[2];
-   if(pipe(fd)) {
-      ERRNO_WARN("Error creating pipe");
-      goto cleanup;
-   }
-   data->write_fd = fd[1];
-   data->read_fd = fd[0];
-
-   //wrap info for function to thread in struct
-   data->fcn = fcn_ptr;
-   data->fcn_arg = arg;
-
-   if (pthread_attr_init(&attr) != 0)
-      goto cleanup;
- 
-   if (pthread_attr_setstacksize(&attr, 0x80000) != 0)
-      goto cleanup;
-
-   if(pthread_create(&data->thread, &attr, thread_main, data)){
-      //error creating thread
-      goto cleanup;
-   }
+   struct WorkerPool *pool = proc_workers(proc);
 
-   //register pipe read with event loop
-   EVT_fd_add(PROC_evt(proc), data->read_fd, EVENT_FD_READ, &thread_cb, data);
+   if (!pool || WP_submit(pool, (WP_work_cb)fcn_ptr, arg, (WP_done_cb)cb_fcn,
+            cb_arg) < 0) {
+      ERRNO_WARN("Failed to queue work for a worker thread");
+      return 1;
+   }
 
    return 0;
-cleanup:
-   free(data);
-   return 1;
 }
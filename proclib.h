@@ -34,6 +34,7 @@
 #include <stdarg.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <signal.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -47,6 +48,11 @@ extern "C" {
 #define SCHEDULE_KEY_MAX 128
 #define NOT_SCHEDULED -1
 
+/// Default number of worker threads used by thread_function
+#define PROC_WORKER_THREADS 4
+/// Default number of work items that may wait for a worker thread
+#define PROC_WORKER_QUEUE_LEN 256
+
 
 enum WatchdogMode {
    /// Constant for disabling the watchdog and critical state
@@ -66,9 +72,14 @@ typedef struct ProcessData {
    //Socket
    int cmdFd, txFd;
    int sigPipe[2];
-   struct ProcSignalCB *signalCBHead;
+   int sigFd;                 // signalfd(2) descriptor, -1 if not in use
+   sigset_t sigMask;          // Signals blocked and read from sigFd
+   struct ProcSignalCB *signalCBs[NSIG];
    struct ProcChild *childHead;
    struct ProcWriteNode *writeListHead;
+   struct ProcSendQueue *sendQueues;
+   char *encodeBuff;          // Reused buffer that outgoing IPC is encoded in
+   size_t encodeLen;
    char *name;
    int cmdPort;
    void *callbackContext;
@@ -76,6 +87,7 @@ typedef struct ProcessData {
    struct CommandCbArg *cmds;
    struct CSState criticalState;
    enum WatchdogMode wdMode;
+   struct WorkerPool *workers;
 } ProcessData;
 
 /** Returns the EVTHandler context for the process.  Needed to directly call
@@ -234,7 +246,13 @@ void PROC_cleanup(ProcessData *proc);
 /** Signal callback **/
 typedef int (*PROC_signal_cb)(int sig, void *p);
 
-/** Register a signal handler
+/** Signal callback that receives the signal's siginfo **/
+typedef int (*PROC_siginfo_cb)(const siginfo_t *info, void *p);
+
+/** Register a signal handler.  On Linux the signal is blocked and read
+ * from a signalfd.  Forked children get the signal unblocked again, but
+ * children started with posix_spawn need the mask set through
+ * posix_spawnattr_setsigmask.
  * @param ctx The event state
  * @param sigNum The signal number
  * @param cb The signal callback
@@ -243,6 +261,19 @@ typedef int (*PROC_signal_cb)(int sig, void *p);
 int PROC_signal(struct ProcessData *proc, int sigNum, PROC_signal_cb cb,
       void *p);
 
+/** Register a signal handler that receives the signal's siginfo.  On Linux
+ * registered signals are blocked and read in batches from a signalfd, and
+ * otherwise they are forwarded through a self-pipe.  Either way the
+ * sender's pid and, for SIGCHLD, the child's status are preserved.  Set
+ * LIBPROC_SIGNAL=pipe in the environment to always use the self-pipe.
+ * @param proc The process state
+ * @param sigNum The signal number
+ * @param cb The signal callback
+ * @param p The parameters
+ */
+int PROC_signal_info(struct ProcessData *proc, int sigNum, PROC_siginfo_cb cb,
+      void *p);
+
 /** Replace the command handler for the given command with a new one.
  * @param proc The process state
  * @param cmdNum The command number to replace
@@ -461,14 +492,58 @@ char CHLD_stderr_reader(ProcChild *child, CHLD_buf_stream_cb_t, void *arg);
 
 
 /*
-* Runs the specified function in a different thread
+* Runs the specified function on one of the process's worker threads.  When
+* the function returns cb_fcn is called from the event loop with cb_arg and
+* the function's return value.  The worker pool is created on first use
+* with PROC_WORKER_THREADS threads, unless PROC_set_workers was called.
+* Queued and running work keeps EVT_EXIT_FD loops from exiting.
 * @param proc The process data pointer
-* @param fcn_ptr Pointer to the function that will be run
+* @param fcn_ptr Pointer to the function that will be run,
+*    int (*)(void *arg)
 * @param arg Opaque argument that will be passed to the function
+* @param cb_fcn Completion callback, int (*)(void *cb_arg, int retval), or NULL
+* @param cb_arg Opaque argument that will be passed to the callback
+* @return 0 on success, non-zero if the work couldn't be queued, including
+*    when PROC_WORKER_QUEUE_LEN items are already waiting for a worker
 */
 int thread_function(ProcessData *proc, void *fcn_ptr, void *arg, void *cb_fcn,
 void *cb_arg);
 
+/*
+* Replace the process's worker pool used by thread_function.  Must be
+* called from the event loop.  Work queued in the old pool that hasn't
+* started is cancelled, and its callback is called with a return value of -1
+* and errno set to ECANCELED before this returns.
+* @param proc The process data pointer
+* @param threads The number of worker threads
+* @param queue_len The most work items that may wait for a worker
+* @return 0 on success, -1 on failure
+*/
+int PROC_set_workers(ProcessData *proc, int threads, int queue_len);
+
+/*
+* Set the most datagrams read from the command socket per event loop
+* wakeup.  Larger batches cut system calls and loop iterations under
+* bursts of small packets.  Takes effect on the next read.
+* @param proc The process data pointer
+* @param count Batch size between 1 and 1024, 16 by default
+* @return 0 on success, -1 on failure
+*/
+int PROC_set_recv_batch(ProcessData *proc, int count);
+
+/*
+* Queue datagrams sent on a socket by PROC_cmd_raw_sockaddr, IPC_response
+* and the other PROC_cmd functions instead of sending each immediately.
+* Queued datagrams are sent together with sendmmsg when the event loop
+* reaches its deferred events, in the order they were queued.  Outside the
+* event loop datagrams are still sent immediately.
+* @param proc The process data pointer
+* @param fd The socket, usually the process's cmdFd or txFd
+* @param enable Non-zero to queue, zero to flush and stop queueing
+* @return 0 on success, -1 on failure
+*/
+int PROC_set_send_queue(ProcessData *proc, int fd, int enable);
+
 #ifdef __cplusplus
 }
 
@@ -29,7 +29,8 @@ struct PseudoThreadState {
    struct EventState *evt;
 };
 
-static struct PseudoThreadState state;
+// Each event loop thread has its own set of pseudo threads
+static __thread struct PseudoThreadState state;
 
 void PT_init(struct EventState *evt)
 {
@@ -0,0 +1,139 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "slabPool.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SP_ALIGN 16
+
+struct SP_slab {
+   struct SP_slab *next;
+   // Pad so the first object keeps SP_ALIGN alignment
+   char pad[SP_ALIGN - sizeof(struct SP_slab*)];
+};
+
+struct SP_free_obj {
+   struct SP_free_obj *next;
+};
+
+struct SlabPool {
+   size_t obj_size, per_slab;
+   struct SP_slab *slabs;
+   struct SP_free_obj *free;
+   struct SP_stats stats;
+};
+
+struct SlabPool *SP_init(size_t obj_size, size_t per_slab)
+{
+   struct SlabPool *pool;
+
+   if (!per_slab)
+      return NULL;
+
+   pool = malloc(sizeof(struct SlabPool));
+   if (!pool)
+      return NULL;
+   memset(pool, 0, sizeof(struct SlabPool));
+
+   if (obj_size < sizeof(struct SP_free_obj))
+      obj_size = sizeof(struct SP_free_obj);
+   pool->obj_size = (obj_size + SP_ALIGN - 1) & ~(size_t)(SP_ALIGN - 1);
+   pool->per_slab = per_slab;
+   pool->stats.obj_size = pool->obj_size;
+
+   return pool;
+}
+
+void SP_destroy(struct SlabPool *pool)
+{
+   struct SP_slab *slab;
+
+   if (!pool)
+      return;
+
+   while ((slab = pool->slabs)) {
+      pool->slabs = slab->next;
+      free(slab);
+   }
+   free(pool);
+}
+
+static int sp_grow(struct SlabPool *pool)
+{
+   struct SP_slab *slab;
+   struct SP_free_obj *obj;
+   char *base;
+   size_t i;
+
+   slab = malloc(sizeof(struct SP_slab) + pool->obj_size * pool->per_slab);
+   if (!slab)
+      return -1;
+
+   slab->next = pool->slabs;
+   pool->slabs = slab;
+
+   // Thread the objects onto the free list in address order
+   base = (char*)(slab + 1);
+   for (i = pool->per_slab; i > 0; i--) {
+      obj = (struct SP_free_obj*)(base + (i - 1) * pool->obj_size);
+      obj->next = pool->free;
+      pool->free = obj;
+   }
+
+   pool->stats.slabs++;
+   pool->stats.total += pool->per_slab;
+
+   return 0;
+}
+
+void *SP_alloc(struct SlabPool *pool)
+{
+   struct SP_free_obj *obj;
+
+   if (!pool->free && sp_grow(pool) < 0)
+      return NULL;
+
+   obj = pool->free;
+   pool->free = obj->next;
+
+   if (++pool->stats.in_use > pool->stats.peak)
+      pool->stats.peak = pool->stats.in_use;
+
+   return obj;
+}
+
+void SP_free(struct SlabPool *pool, void *ptr)
+{
+   struct SP_free_obj *obj = (struct SP_free_obj*)ptr;
+
+   if (!obj)
+      return;
+
+   obj->next = pool->free;
+   pool->free = obj;
+   pool->stats.in_use--;
+}
+
+void SP_get_stats(struct SlabPool *pool, struct SP_stats *stats)
+{
+   if (pool)
+      *stats = pool->stats;
+   else
+      memset(stats, 0, sizeof(*stats));
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file slabPool.h Fixed size object pool.
+ *
+ * A slab pool hands out objects of a single size from large slabs kept on
+ * a free list.  Freed objects are reused by the next allocation, so steady
+ * state allocation and release never call malloc or free.  Slabs are only
+ * returned to the system when the pool is destroyed.
+ */
+
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct SlabPool;
+
+/** Pool occupancy counters */
+struct SP_stats {
+   size_t obj_size;     // Bytes per object, after alignment
+   size_t slabs;        // Number of slabs allocated
+   size_t total;        // Objects in all slabs
+   size_t in_use;       // Objects currently allocated
+   size_t peak;         // Largest in_use seen
+};
+
+/**
+ * Create a pool.
+ *
+ * @param obj_size Size of each object in bytes.
+ * @param per_slab Number of objects allocated at once when the pool is empty.
+ *
+ * @return The pool or NULL for insufficient memory.
+ */
+struct SlabPool *SP_init(size_t obj_size, size_t per_slab);
+
+/**
+ * Destroy the pool and every object allocated from it.
+ */
+void SP_destroy(struct SlabPool *pool);
+
+/**
+ * Allocate an object.  The contents are undefined.
+ *
+ * @return The object or NULL for insufficient memory.
+ */
+void *SP_alloc(struct SlabPool *pool);
+
+/**
+ * Return an object to the pool.  NULL is ignored.
+ */
+void SP_free(struct SlabPool *pool, void *obj);
+
+/**
+ * Read the pool's occupancy counters.
+ */
+void SP_get_stats(struct SlabPool *pool, struct SP_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Measures HashTable lookup latency for hits and misses as the table grows
+ * from its initial size.  Tables are created with a small size hint, like
+ * the command and struct registries.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "../../hashtable.h"
+
+#define LOOKUPS 2000000
+
+struct Entry {
+   uintptr_t key;
+};
+
+static size_t int_hash(void *key)
+{
+   return (size_t)(uintptr_t)key;
+}
+
+static int int_cmp(void *key1, void *key2)
+{
+   return key1 == key2;
+}
+
+static void *entry_key(void *data)
+{
+   return (void*)((struct Entry*)data)->key;
+}
+
+static double elapsed(struct timespec *start, struct timespec *end)
+{
+   return (end->tv_sec - start->tv_sec) +
+      (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int run(size_t count)
+{
+   struct HashTable *table;
+   struct Entry *entries;
+   struct timespec t0, t1, t2;
+   uint32_t seed = 1;
+   size_t i, found = 0;
+
+   entries = malloc(count * sizeof(struct Entry));
+   table = HASH_create_table(37, &int_hash, &int_cmp, &entry_key);
+   if (!entries || !table)
+      return -1;
+
+   // Keys resemble command and type numbers: a base plus a small offset
+   for (i = 0; i < count; i++) {
+      entries[i].key = 0x01000100 + i * 2;
+      if (HASH_add_data(table, &entries[i]))
+         return -1;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   for (i = 0; i < LOOKUPS; i++) {
+      seed = seed * 1103515245 + 12345;
+      if (HASH_find_key(table, (void*)entries[(seed >> 4) % count].key))
+         found++;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   for (i = 0; i < LOOKUPS; i++) {
+      seed = seed * 1103515245 + 12345;
+      if (HASH_find_key(table, (void*)(entries[(seed >> 4) % count].key + 1)))
+         found++;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &t2);
+
+   printf("hash %8zu entries: hit %7.1f ns  miss %7.1f ns\n", count,
+         elapsed(&t0, &t1) * 1e9 / LOOKUPS, elapsed(&t1, &t2) * 1e9 / LOOKUPS);
+
+   HASH_free_table(table);
+   free(entries);
+
+   return found == LOOKUPS ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+   static const size_t sizes[] = { 100, 10000, 1000000 };
+   size_t s;
+
+   for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+      if (run(sizes[s]))
+         return 1;
+
+   return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Compares the 4-ary MinHeap with the callback based ps_pqueue.  Each run
+ * inserts random deadlines, removes a quarter of them by position, and pops
+ * the rest.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/time.h>
+#include "../../priorityQueue.h"
+#include "../../minHeap.h"
+
+struct Item {
+   struct timeval pri;
+   size_t pos;
+};
+
+struct Result {
+   double insert, remove, pop;
+};
+
+static int cmp_pri(struct timeval next, struct timeval curr)
+{
+   return timercmp(&next, &curr, >=);
+}
+
+static struct timeval get_pri(void *a)
+{
+   return ((struct Item*)a)->pri;
+}
+
+static void set_pri(void *a, struct timeval pri)
+{
+   ((struct Item*)a)->pri = pri;
+}
+
+static size_t get_pos(void *a)
+{
+   return ((struct Item*)a)->pos;
+}
+
+static void set_pos(void *a, size_t pos)
+{
+   ((struct Item*)a)->pos = pos;
+}
+
+static double elapsed(struct timespec *start, struct timespec *end)
+{
+   return (end->tv_sec - start->tv_sec) +
+      (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void fill(struct Item *items, size_t count)
+{
+   uint32_t seed = 1;
+   size_t i;
+
+   for (i = 0; i < count; i++) {
+      seed = seed * 1103515245 + 12345;
+      items[i].pri.tv_sec = 1000 + (seed >> 8) % 1000;
+      seed = seed * 1103515245 + 12345;
+      items[i].pri.tv_usec = (seed >> 8) % 1000000;
+   }
+}
+
+static int run_pqueue(struct Item *items, size_t count, struct Result *res)
+{
+   struct timespec t0, t1, t2, t3;
+   ps_pqueue_t *q;
+   size_t i;
+
+   q = ps_pqueue_init(count, cmp_pri, get_pri, set_pri, get_pos, set_pos);
+   if (!q)
+      return -1;
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   for (i = 0; i < count; i++)
+      ps_pqueue_insert(q, &items[i]);
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   for (i = 0; i < count; i += 4)
+      ps_pqueue_remove(q, &items[i]);
+   clock_gettime(CLOCK_MONOTONIC, &t2);
+   while (ps_pqueue_pop(q))
+      ;
+   clock_gettime(CLOCK_MONOTONIC, &t3);
+
+   res->insert = count / elapsed(&t0, &t1);
+   res->remove = (count + 3) / 4 / elapsed(&t1, &t2);
+   res->pop = (count - (count + 3) / 4) / elapsed(&t2, &t3);
+   ps_pqueue_free(q);
+
+   return 0;
+}
+
+static int run_minheap(struct Item *items, size_t count, struct Result *res)
+{
+   struct timespec t0, t1, t2, t3;
+   struct MinHeap *h;
+   size_t i;
+
+   h = MH_init(count, offsetof(struct Item, pos));
+   if (!h)
+      return -1;
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   for (i = 0; i < count; i++)
+      MH_insert(h, &items[i], MH_tv2key(&items[i].pri));
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   for (i = 0; i < count; i += 4)
+      MH_remove(h, items[i].pos);
+   clock_gettime(CLOCK_MONOTONIC, &t2);
+   while (MH_pop(h))
+      ;
+   clock_gettime(CLOCK_MONOTONIC, &t3);
+
+   res->insert = count / elapsed(&t0, &t1);
+   res->remove = (count + 3) / 4 / elapsed(&t1, &t2);
+   res->pop = (count - (count + 3) / 4) / elapsed(&t2, &t3);
+   MH_free(h);
+
+   return 0;
+}
+
+static void report(const char *name, size_t count, struct Result *res)
+{
+   printf("%-8s %8zu entries: insert %11.0f/s  remove %11.0f/s  "
+         "pop %11.0f/s\n", name, count, res->insert, res->remove, res->pop);
+}
+
+int main(int argc, char **argv)
+{
+   static const size_t sizes[] = { 10000, 1000000 };
+   struct Result res;
+   struct Item *items;
+   size_t s;
+
+   for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      items = malloc(sizes[s] * sizeof(struct Item));
+      if (!items)
+         return 1;
+
+      fill(items, sizes[s]);
+      if (run_pqueue(items, sizes[s], &res))
+         return 1;
+      report("pqueue", sizes[s], &res);
+
+      fill(items, sizes[s]);
+      if (run_minheap(items, sizes[s], &res))
+         return 1;
+      report("minheap", sizes[s], &res);
+
+      free(items);
+   }
+
+   return 0;
+}
@@ -0,0 +1,439 @@
+/*
+ * Event loop microbenchmarks.  Measures timer add/cancel/fire throughput,
+ * fd dispatch latency across many socketpairs, deferred event throughput,
+ * XDR encode/decode of IPC_Command and loopback IPC round trip time.
+ * Results are printed as a single JSON object so runs from different
+ * releases can be compared by scripts.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../../events.h"
+#include "../../proclib.h"
+#include "../../ipc.h"
+#include "../../cmd.h"
+#include "../../xdr.h"
+#include "../../cmd-pkt.h"
+
+#define TIMER_EVENTS 200000
+#define DEFERRED_EVENTS 1000000
+#define XDR_ITERATIONS 1000000
+#define FD_ROUNDS 20000
+#define IPC_ROUNDS 5000
+#define IPC_TIMEOUT_MS 1000
+#define DEADLINE_SPREAD_MS 1000
+
+static const int fd_counts[] = { 10, 100, 1000 };
+
+// Types requested by the IPC_DataReq carried in benchmark commands
+static uint32_t data_reqs[] = { IPC_TYPES_HEARTBEAT, IPC_TYPES_LOOP_STATS };
+
+static int first_result = 1;
+
+static double elapsed(struct timespec *start, struct timespec *end)
+{
+   return (end->tv_sec - start->tv_sec) +
+      (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static double now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void print_throughput(const char *name, unsigned long ops, double secs)
+{
+   printf("%s\n    { \"name\": \"%s\", \"ops\": %lu, \"seconds\": %.6f, "
+         "\"ops_per_sec\": %.0f }", first_result ? "" : ",", name, ops, secs,
+         secs > 0 ? ops / secs : 0);
+   first_result = 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+   double da = *(const double*)a, db = *(const double*)b;
+
+   return (da > db) - (da < db);
+}
+
+// Sorts the samples and prints their mean and percentiles in nanoseconds
+static void print_latency(const char *name, int fds, double *samples,
+      unsigned long count)
+{
+   double sum = 0;
+   unsigned long i;
+
+   if (!count)
+      return;
+
+   qsort(samples, count, sizeof(double), &cmp_double);
+   for (i = 0; i < count; i++)
+      sum += samples[i];
+
+   printf("%s\n    { \"name\": \"%s\", ", first_result ? "" : ",", name);
+   if (fds)
+      printf("\"fds\": %d, ", fds);
+   printf("\"samples\": %lu, \"mean_ns\": %.0f, \"p50_ns\": %.0f, "
+         "\"p99_ns\": %.0f, \"max_ns\": %.0f }", count, sum / count,
+         samples[count / 2], samples[count * 99 / 100], samples[count - 1]);
+   first_result = 0;
+}
+
+/* Timers */
+
+static unsigned long fired = 0;
+
+static int timer_cb(void *arg)
+{
+   fired++;
+   return EVENT_REMOVE;
+}
+
+static int bench_timers(void)
+{
+   EVTHandler *evt;
+   struct timeval vstart = { 1000, 0 };
+   struct timespec t0, t1;
+   void **ids;
+   unsigned long i;
+   uint32_t seed = 1;
+
+   ids = malloc(TIMER_EVENTS * sizeof(void*));
+   evt = EVT_create_handler(NULL, NULL);
+   if (!ids || !evt || EVT_enable_virt(evt, &vstart))
+      return -1;
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   for (i = 0; i < TIMER_EVENTS; i++) {
+      seed = seed * 1103515245 + 12345;
+      ids[i] = EVT_sched_add(evt,
+            EVT_ms2tv((seed >> 8) % DEADLINE_SPREAD_MS), &timer_cb, NULL);
+      if (!ids[i])
+         return -1;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   print_throughput("timer_add", TIMER_EVENTS, elapsed(&t0, &t1));
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   for (i = 0; i < TIMER_EVENTS; i++)
+      EVT_sched_remove(evt, ids[i]);
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   print_throughput("timer_cancel", TIMER_EVENTS, elapsed(&t0, &t1));
+
+   for (i = 0; i < TIMER_EVENTS; i++) {
+      seed = seed * 1103515245 + 12345;
+      if (!EVT_sched_add(evt, EVT_ms2tv((seed >> 8) % DEADLINE_SPREAD_MS),
+               &timer_cb, NULL))
+         return -1;
+   }
+
+   // The loop runs on a virtual clock so no time is spent sleeping
+   fired = 0;
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   EVT_start_loop_auto_exit(evt, EVT_EXIT_SCHED);
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   print_throughput("timer_fire", fired, elapsed(&t0, &t1));
+
+   EVT_free_handler(evt);
+   free(ids);
+
+   return fired == TIMER_EVENTS ? 0 : -1;
+}
+
+/* File descriptor dispatch */
+
+struct FdBench {
+   EVTHandler *evt;
+   int (*pairs)[2];
+   int count;
+   uint32_t seed;
+   double sent;
+   double *samples;
+   unsigned long rounds;
+};
+
+// Writes a byte to a random socketpair and notes when it was sent
+static int fd_send(struct FdBench *fb)
+{
+   int idx;
+
+   fb->seed = fb->seed * 1103515245 + 12345;
+   idx = (fb->seed >> 8) % fb->count;
+   fb->sent = now_ns();
+   return write(fb->pairs[idx][1], "x", 1) == 1 ? 0 : -1;
+}
+
+static int fd_start_cb(void *arg)
+{
+   if (fd_send((struct FdBench*)arg))
+      EVT_exit_loop(((struct FdBench*)arg)->evt);
+   return EVENT_REMOVE;
+}
+
+static int fd_read_cb(int fd, char type, void *arg)
+{
+   struct FdBench *fb = (struct FdBench*)arg;
+   char buff[16];
+
+   fb->samples[fb->rounds++] = now_ns() - fb->sent;
+   if (read(fd, buff, sizeof(buff)) < 1 || fb->rounds >= FD_ROUNDS ||
+         fd_send(fb))
+      EVT_exit_loop(fb->evt);
+
+   return EVENT_KEEP;
+}
+
+static int bench_fd_dispatch(int count)
+{
+   struct FdBench fb;
+   int i, res = -1;
+
+   memset(&fb, 0, sizeof(fb));
+   fb.count = count;
+   fb.seed = 1;
+   fb.evt = EVT_create_handler(NULL, NULL);
+   fb.pairs = malloc(count * sizeof(*fb.pairs));
+   fb.samples = malloc(FD_ROUNDS * sizeof(double));
+   if (!fb.evt || !fb.pairs || !fb.samples)
+      return -1;
+
+   for (i = 0; i < count; i++) {
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, fb.pairs[i]))
+         goto cleanup;
+      if (!EVT_fd_add(fb.evt, fb.pairs[i][0], EVENT_FD_READ, &fd_read_cb,
+               &fb))
+         goto cleanup;
+   }
+
+   EVT_sched_add(fb.evt, EVT_ms2tv(0), &fd_start_cb, &fb);
+   EVT_start_loop(fb.evt);
+   print_latency("fd_dispatch", count, fb.samples, fb.rounds);
+   res = fb.rounds == FD_ROUNDS ? 0 : -1;
+
+cleanup:
+   EVT_free_handler(fb.evt);
+   for (; i > 0; i--) {
+      close(fb.pairs[i - 1][0]);
+      close(fb.pairs[i - 1][1]);
+   }
+   free(fb.pairs);
+   free(fb.samples);
+
+   return res;
+}
+
+/* Deferred events */
+
+static unsigned long deferred = 0;
+
+static int defer_cb(void *arg)
+{
+   if (++deferred == DEFERRED_EVENTS)
+      EVT_exit_loop((EVTHandler*)arg);
+   return EVENT_REMOVE;
+}
+
+// Deferred callbacks are only queued from inside the loop
+static int defer_start_cb(void *arg)
+{
+   EVTHandler *evt = (EVTHandler*)arg;
+   unsigned long i;
+
+   for (i = 0; i < DEFERRED_EVENTS; i++)
+      if (!EVT_defer_add(evt, &defer_cb, evt)) {
+         EVT_exit_loop(evt);
+         break;
+      }
+
+   return EVENT_REMOVE;
+}
+
+static int bench_deferred(void)
+{
+   EVTHandler *evt;
+   struct timespec t0, t1;
+
+   evt = EVT_create_handler(NULL, NULL);
+   if (!evt)
+      return -1;
+
+   EVT_sched_add(evt, EVT_ms2tv(0), &defer_start_cb, evt);
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   EVT_start_loop(evt);
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   print_throughput("deferred", deferred, elapsed(&t0, &t1));
+
+   EVT_free_handler(evt);
+
+   return deferred == DEFERRED_EVENTS ? 0 : -1;
+}
+
+/* XDR */
+
+static int bench_xdr(void)
+{
+   struct IPC_Command cmd, out;
+   struct IPC_DataReq req;
+   struct timespec t0, t1;
+   char buff[256];
+   size_t len, used;
+   unsigned long i;
+
+   req.length = sizeof(data_reqs) / sizeof(data_reqs[0]);
+   req.reqs = data_reqs;
+   cmd.cmd = IPC_CMDS_STATUS;
+   cmd.ipcref = 1;
+   cmd.parameters.type = IPC_TYPES_DATAREQ;
+   cmd.parameters.data = &req;
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   for (i = 0; i < XDR_ITERATIONS; i++) {
+      len = 0;
+      if (IPC_Command_encode(&cmd, buff, &len, sizeof(buff), NULL) < 0)
+         return -1;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   print_throughput("xdr_encode_ipc_command", XDR_ITERATIONS,
+         elapsed(&t0, &t1));
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   for (i = 0; i < XDR_ITERATIONS; i++) {
+      used = 0;
+      if (IPC_Command_decode(buff, &out, &used, len, NULL) < 0)
+         return -1;
+      XDR_free_union(&out.parameters);
+   }
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   print_throughput("xdr_decode_ipc_command", XDR_ITERATIONS,
+         elapsed(&t0, &t1));
+
+   return 0;
+}
+
+/* Loopback IPC */
+
+struct IpcBench {
+   ProcessData *proc;
+   struct sockaddr_in dest;
+   struct IPC_DataReq req;
+   double sent;
+   double *samples;
+   unsigned long rounds;
+};
+
+static void ipc_echo_handler(struct ProcessData *proc, struct IPC_Command *cmd,
+      struct sockaddr_in *fromAddr, void *arg, int fd)
+{
+   IPC_success(proc, cmd, fromAddr);
+}
+
+static int ipc_send(struct IpcBench *ib);
+
+static void ipc_response_cb(struct ProcessData *proc, int timeout, void *arg,
+      char *resp_buff, size_t resp_len, enum IPC_CB_TYPE cb_type)
+{
+   struct IpcBench *ib = (struct IpcBench*)arg;
+
+   if (timeout) {
+      EVT_exit_loop(PROC_evt(proc));
+      return;
+   }
+
+   ib->samples[ib->rounds++] = now_ns() - ib->sent;
+   if (ib->rounds >= IPC_ROUNDS || ipc_send(ib))
+      EVT_exit_loop(PROC_evt(proc));
+}
+
+static int ipc_send(struct IpcBench *ib)
+{
+   ib->sent = now_ns();
+   return IPC_command(ib->proc, IPC_CMDS_STATUS, &ib->req,
+         IPC_TYPES_DATAREQ, ib->dest, &ipc_response_cb, ib,
+         IPC_CB_TYPE_RAW, IPC_TIMEOUT_MS);
+}
+
+static int ipc_start_cb(void *arg)
+{
+   struct IpcBench *ib = (struct IpcBench*)arg;
+
+   if (ipc_send(ib))
+      EVT_exit_loop(PROC_evt(ib->proc));
+   return EVENT_REMOVE;
+}
+
+static int bench_ipc(void)
+{
+   struct IpcBench ib;
+   socklen_t alen = sizeof(ib.dest);
+   int res;
+
+   memset(&ib, 0, sizeof(ib));
+   ib.req.length = sizeof(data_reqs) / sizeof(data_reqs[0]);
+   ib.req.reqs = data_reqs;
+   ib.samples = malloc(IPC_ROUNDS * sizeof(double));
+   ib.proc = PROC_init(NULL, WD_DISABLED);
+   if (!ib.samples || !ib.proc)
+      return -1;
+
+   // Commands go to our own command socket and are answered by the echo
+   //  handler, so each round trip crosses the loopback twice
+   if (getsockname(ib.proc->cmdFd, (struct sockaddr*)&ib.dest, &alen))
+      return -1;
+   ib.dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   CMD_set_xdr_cmd_handler(IPC_CMDS_STATUS, &ipc_echo_handler, NULL);
+
+   EVT_sched_add(PROC_evt(ib.proc), EVT_ms2tv(0), &ipc_start_cb, &ib);
+   EVT_start_loop(PROC_evt(ib.proc));
+   print_latency("ipc_round_trip", 0, ib.samples, ib.rounds);
+   res = ib.rounds == IPC_ROUNDS ? 0 : -1;
+
+   PROC_cleanup(ib.proc);
+   free(ib.samples);
+
+   return res;
+}
+
+int main(int argc, char **argv)
+{
+   const char *poller = getenv("LIBPROC_POLLER");
+   struct rlimit lim;
+   int i, res = 0;
+
+   // Each socketpair uses two descriptors
+   if (!getrlimit(RLIMIT_NOFILE, &lim) && lim.rlim_cur < lim.rlim_max) {
+      lim.rlim_cur = lim.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &lim);
+   }
+
+   printf("{\n  \"benchmark\": \"libproc_event_loop\",\n"
+         "  \"poller\": \"%s\",\n  \"timestamp\": %ld,\n  \"results\": [",
+         poller ? poller : "default", (long)time(NULL));
+
+   if (bench_timers())
+      res = 1;
+   for (i = 0; i < sizeof(fd_counts) / sizeof(fd_counts[0]); i++)
+      if (bench_fd_dispatch(fd_counts[i]))
+         res = 1;
+   if (bench_deferred())
+      res = 1;
+   if (bench_xdr())
+      res = 1;
+   if (bench_ipc())
+      res = 1;
+
+   printf("\n  ]\n}\n");
+   fflush(stdout);
+
+   return res;
+}
@@ -0,0 +1,67 @@
+/*
+ * Measures how quickly the event loop pops and dispatches timed events.
+ * The loop runs on a virtual clock so no time is spent sleeping.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include "../../events.h"
+
+#define DEFAULT_EVENTS 200000
+#define DEADLINE_SPREAD_MS 1000
+
+static unsigned long fired = 0;
+
+static int bench_cb(void *arg)
+{
+   fired++;
+   return EVENT_REMOVE;
+}
+
+static double elapsed(struct timespec *start, struct timespec *end)
+{
+   return (end->tv_sec - start->tv_sec) +
+      (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+   EVTHandler *evt;
+   struct timeval vstart = { 1000, 0 };
+   struct timespec start, end;
+   unsigned long count = DEFAULT_EVENTS, i;
+   uint32_t seed = 1;
+   double secs;
+
+   if (argc > 1)
+      count = strtoul(argv[1], NULL, 0);
+
+   evt = EVT_create_handler(NULL, NULL);
+   if (!evt || EVT_enable_virt(evt, &vstart)) {
+      fprintf(stderr, "Failed to create event handler\n");
+      return 1;
+   }
+
+   for (i = 0; i < count; i++) {
+      seed = seed * 1103515245 + 12345;
+      if (!EVT_sched_add(evt, EVT_ms2tv((seed >> 8) % DEADLINE_SPREAD_MS),
+               &bench_cb, NULL)) {
+         fprintf(stderr, "Failed to schedule event %lu\n", i);
+         return 1;
+      }
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   EVT_start_loop_auto_exit(evt, EVT_EXIT_SCHED);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   secs = elapsed(&start, &end);
+   printf("sched_pop: %lu events in %.3f s, %.0f events/s\n",
+         fired, secs, fired / secs);
+
+   EVT_free_handler(evt);
+
+   return fired == count ? 0 : 1;
+}
@@ -1,8 +1,23 @@
 #include <sys/time.h>
 #include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <pthread.h>
 #include "../../events.h"
 #include "../../eventTimer.h"
+#include "../../eventPoller.h"
+#include "../../minHeap.h"
 #include "../../proclib.h"
+#include "../../cmd.h"
+#include "../../workerPool.h"
+extern "C" {
+#include "../../cmd-pkt.h"
+}
+#include <netinet/in.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
 #include "gtest/gtest.h"
 
 namespace {
@@ -96,6 +111,393 @@ TEST_F(TestEvents, MultipleEvents) {
    EXPECT_EQ(data2.count, data2.max);
 }
 
+// Test scheduled events are recycled through the handler's pool
+TEST_F(TestEvents, SchedPool) {
+   struct EVTPoolStats stats;
+   void *evts[100];
+   size_t slabs;
+   int i;
+
+   for (i = 0; i < 100; i++) {
+      evts[i] = EVT_sched_add(PROC_evt(proc), EVT_ms2tv(1000 + i), handler,
+            NULL);
+      ASSERT_TRUE(evts[i] != NULL);
+   }
+   EVT_get_pool_stats(PROC_evt(proc), &stats);
+   EXPECT_GE(stats.sched.in_use, 100u);
+   EXPECT_GE(stats.sched.total, stats.sched.in_use);
+   slabs = stats.sched.slabs;
+
+   for (i = 0; i < 100; i++)
+      EVT_sched_remove(PROC_evt(proc), evts[i]);
+   EVT_get_pool_stats(PROC_evt(proc), &stats);
+   EXPECT_LE(stats.sched.in_use, stats.sched.peak - 100);
+
+   // Reusing the freed events must not allocate more slabs
+   for (i = 0; i < 100; i++)
+      evts[i] = EVT_sched_add(PROC_evt(proc), EVT_ms2tv(1000 + i), handler,
+            NULL);
+   EVT_get_pool_stats(PROC_evt(proc), &stats);
+   EXPECT_EQ(slabs, stats.sched.slabs);
+   for (i = 0; i < 100; i++)
+      EVT_sched_remove(PROC_evt(proc), evts[i]);
+}
+
+#define FUZZ_TRACKED 64
+#define FUZZ_STALE 256
+
+struct FuzzEvent {
+   EVT_sched_handle handle;
+   int live;
+   int fired;
+};
+
+struct FuzzState {
+   struct FuzzEvent evts[FUZZ_TRACKED];
+   EVT_sched_handle stale[FUZZ_STALE];
+   int staleLen;
+   unsigned int seed;
+   int steps;
+   int errors;
+   struct ProcessData *proc;
+};
+
+static int fuzz_fired(void *arg) {
+   struct FuzzEvent *evt = (struct FuzzEvent *)arg;
+
+   evt->live = 0;
+   evt->fired++;
+   return EVENT_REMOVE;
+}
+
+static unsigned int fuzz_rand(struct FuzzState *st) {
+   st->seed = st->seed * 1103515245 + 12345;
+   return st->seed >> 8;
+}
+
+static void fuzz_retire(struct FuzzState *st, struct FuzzEvent *evt) {
+   if (evt->handle)
+      st->stale[st->staleLen++ % FUZZ_STALE] = evt->handle;
+}
+
+static int fuzz_step(void *arg) {
+   struct FuzzState *st = (struct FuzzState *)arg;
+   EVTHandler *evt = PROC_evt(st->proc);
+   struct FuzzEvent *fe;
+   struct timeval tv;
+   EVT_sched_handle h;
+   int i, op;
+
+   for (i = 0; i < 32; i++) {
+      fe = &st->evts[fuzz_rand(st) % FUZZ_TRACKED];
+      op = fuzz_rand(st) % 5;
+
+      // A handle whose event fired is stale from now on
+      if (!fe->live && fe->handle) {
+         fuzz_retire(st, fe);
+         fe->handle = EVT_SCHED_HANDLE_NONE;
+      }
+
+      if (op == 0 && !fe->live) {
+         fe->handle = EVT_sched_get_handle(evt, EVT_sched_add(evt,
+               EVT_ms2tv(fuzz_rand(st) % 5), &fuzz_fired, fe));
+         fe->live = fe->handle != EVT_SCHED_HANDLE_NONE;
+         if (!fe->live)
+            st->errors++;
+      }
+      else if (op == 1 && fe->live) {
+         if (EVT_sched_remove_handle(evt, fe->handle) != fe)
+            st->errors++;
+         fe->live = 0;
+         fuzz_retire(st, fe);
+         fe->handle = EVT_SCHED_HANDLE_NONE;
+      }
+      else if (op == 2 && fe->live) {
+         if (EVT_sched_update_handle(evt, fe->handle,
+                  EVT_ms2tv(fuzz_rand(st) % 5)))
+            st->errors++;
+      }
+      else if (op == 3 && fe->live) {
+         if (EVT_sched_remaining_handle(evt, fe->handle, &tv) ||
+               !EVT_sched_lookup(evt, fe->handle))
+            st->errors++;
+      }
+      else if (st->staleLen) {
+         // Stale handles must fail, even once their slot has been reused
+         h = st->stale[fuzz_rand(st) %
+            (st->staleLen < FUZZ_STALE ? st->staleLen : FUZZ_STALE)];
+         if (EVT_sched_lookup(evt, h) ||
+               EVT_sched_remove_handle(evt, h) ||
+               !EVT_sched_update_handle(evt, h, EVT_ms2tv(1)) ||
+               !EVT_sched_remaining_handle(evt, h, &tv))
+            st->errors++;
+      }
+   }
+
+   if (--st->steps > 0)
+      return EVENT_KEEP;
+
+   EVT_exit_loop(evt);
+   return EVENT_REMOVE;
+}
+
+// Test add, remove and update by handle with a mix of live and stale handles
+TEST_F(TestEvents, SchedHandleFuzz) {
+   static struct FuzzState st;
+   struct EVTPoolStats stats;
+   size_t in_use;
+   int i, fired = 0;
+
+   memset(&st, 0, sizeof(st));
+   st.seed = 1;
+   st.steps = 300;
+   st.proc = proc;
+
+   EXPECT_TRUE(EVT_sched_lookup(PROC_evt(proc), EVT_SCHED_HANDLE_NONE) == NULL);
+   EXPECT_TRUE(EVT_sched_remove_handle(PROC_evt(proc), 12345) == NULL);
+
+   EVT_get_pool_stats(PROC_evt(proc), &stats);
+   in_use = stats.sched.in_use;
+
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(1), &fuzz_step, &st);
+   EVT_start_loop(PROC_evt(proc));
+   EXPECT_EQ(0, st.errors);
+   EXPECT_GT(st.staleLen, FUZZ_STALE);
+
+   for (i = 0; i < FUZZ_TRACKED; i++) {
+      fired += st.evts[i].fired;
+      if (st.evts[i].live)
+         EXPECT_EQ(&st.evts[i],
+               EVT_sched_remove_handle(PROC_evt(proc), st.evts[i].handle));
+   }
+   EXPECT_GT(fired, 0);
+
+   // Every event the fuzzer created has been released
+   EVT_get_pool_stats(PROC_evt(proc), &stats);
+   EXPECT_EQ(in_use, stats.sched.in_use);
+}
+
+struct DeferData {
+   int order[300];
+   int count;
+   void *keys[200];
+   struct ProcessData *proc;
+};
+
+struct DeferArg {
+   struct DeferData *data;
+   int id;
+};
+
+static int defer_run(void *arg) {
+   struct DeferArg *da = (struct DeferArg *)arg;
+
+   da->data->order[da->data->count++] = da->id;
+   return EVENT_REMOVE;
+}
+
+static int defer_chain(void *arg) {
+   static struct DeferArg last;
+   struct DeferArg *da = (struct DeferArg *)arg;
+
+   defer_run(arg);
+   last.data = da->data;
+   last.id = 1000;
+   EVT_defer_add(PROC_evt(da->data->proc), defer_run, &last);
+   return EVENT_REMOVE;
+}
+
+static int defer_many(void *arg) {
+   static struct DeferArg args[200];
+   struct DeferData *data = (struct DeferData *)arg;
+   EVTHandler *evt = PROC_evt(data->proc);
+   int i;
+
+   for (i = 0; i < 200; i++) {
+      args[i].data = data;
+      args[i].id = i;
+      data->keys[i] = EVT_defer_add(evt, i == 199 ? defer_chain : defer_run,
+            &args[i]);
+      EXPECT_TRUE(data->keys[i] != NULL);
+   }
+   for (i = 0; i < 200; i += 3)
+      EVT_defer_cancel(evt, data->keys[i]);
+
+   EVT_exit_loop(evt);
+   return EVENT_REMOVE;
+}
+
+// Test deferred callbacks run in order, can be canceled, and can defer more
+TEST_F(TestEvents, DeferRing) {
+   static struct DeferData data;
+   struct EVTLoopStats stats;
+   int i, expected = 0;
+
+   memset(&data, 0, sizeof(data));
+   data.proc = proc;
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(1), defer_many, &data);
+   EVT_start_loop(PROC_evt(proc));
+
+   for (i = 0; i < 200; i++)
+      if (i % 3)
+         EXPECT_EQ(i, data.order[expected++]);
+   EXPECT_EQ(1000, data.order[expected++]);
+   EXPECT_EQ(expected, data.count);
+
+   // Canceling a callback that already ran is harmless
+   EVT_defer_cancel(PROC_evt(proc), data.keys[1]);
+
+   EVT_get_loop_stats(PROC_evt(proc), &stats);
+   EXPECT_GE(stats.deferred_events, (unsigned long long)expected);
+}
+
+struct WheelData {
+   int count;
+   int late;
+   struct timeval due;
+   struct ProcessData *proc;
+};
+
+int wheel_handler(void *arg) {
+   struct WheelData *data = (struct WheelData *)arg;
+   struct timeval now, step = EVT_ms2tv(150);
+
+   EVT_get_monotonic_time(PROC_evt(data->proc), &now);
+   if (timercmp(&now, &data->due, <))
+      data->late = -1;
+   data->count++;
+   if (data->count >= 5) {
+      EVT_exit_loop(PROC_evt(data->proc));
+      return EVENT_REMOVE;
+   }
+   timeradd(&data->due, &step, &data->due);
+   return EVENT_KEEP;
+}
+
+int jitter_handler(void *arg) {
+   struct WheelData *data = (struct WheelData *)arg;
+   struct timeval now, late, step = EVT_ms2tv(10);
+
+   EVT_get_monotonic_time(PROC_evt(data->proc), &now);
+   if (timercmp(&now, &data->due, <))
+      data->late = -1;
+   else if (data->late >= 0) {
+      timersub(&now, &data->due, &late);
+      data->late += late.tv_sec * 1000000 + late.tv_usec;
+   }
+   if (++data->count >= 50) {
+      EVT_exit_loop(PROC_evt(data->proc));
+      return EVENT_REMOVE;
+   }
+   timeradd(&data->due, &step, &data->due);
+   return EVENT_KEEP;
+}
+
+// Test periodic events driven by the timerfd EventTimer
+TEST_F(TestEvents, TimerfdTimer) {
+   struct EventTimer *et = ET_timerfd_init();
+   struct timeval step = EVT_ms2tv(10);
+   struct WheelData data;
+
+   ASSERT_TRUE(et != NULL);
+   EVT_set_evt_timer(PROC_evt(proc), et);
+
+   data.count = 0;
+   data.late = 0;
+   data.proc = proc;
+   EVT_get_monotonic_time(PROC_evt(proc), &data.due);
+   timeradd(&data.due, &step, &data.due);
+
+   EVT_sched_add(PROC_evt(proc), step, jitter_handler, &data);
+   EVT_start_loop(PROC_evt(proc));
+
+   EXPECT_EQ(50, data.count);
+   // Never early, and on average well under the poller's 1ms resolution
+   EXPECT_GE(data.late, 0);
+   EXPECT_LT(data.late / data.count, 1000);
+}
+
+int never_handler(void *arg) {
+   *(int*)arg = 1;
+   return EVENT_REMOVE;
+}
+
+// Test timed events held in the timing wheel fire on time and can be removed
+TEST_F(TestEvents, TimerWheel) {
+   struct timeval res = EVT_ms2tv(1), step = EVT_ms2tv(150);
+   struct WheelData data;
+   int fired = 0;
+   void *evt;
+
+   ASSERT_EQ(0, EVT_set_timer_wheel(PROC_evt(proc), &res));
+
+   data.count = 0;
+   data.late = 0;
+   data.proc = proc;
+   EVT_get_monotonic_time(PROC_evt(proc), &data.due);
+   timeradd(&data.due, &step, &data.due);
+
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(150), wheel_handler, &data);
+   evt = EVT_sched_add(PROC_evt(proc), EVT_ms2tv(300), never_handler, &fired);
+   ASSERT_TRUE(evt != NULL);
+   EXPECT_EQ(&fired, EVT_sched_remove(PROC_evt(proc), evt));
+
+   EVT_start_loop(PROC_evt(proc));
+
+   // No callback may run before its deadline
+   EXPECT_EQ(0, data.late);
+   EXPECT_EQ(5, data.count);
+   EXPECT_EQ(0, fired);
+}
+
+struct HeapItem {
+   int64_t key;
+   size_t pos;
+};
+
+// Test the 4-ary heap pops in key order and tracks element positions
+TEST_F(TestEvents, MinHeap) {
+   struct MinHeap *heap;
+   struct HeapItem items[1000], *item;
+   int64_t last = INT64_MIN;
+   uint32_t seed = 1;
+   size_t i, popped = 0;
+
+   heap = MH_init(4, offsetof(struct HeapItem, pos));
+   ASSERT_TRUE(heap != NULL);
+
+   for (i = 0; i < 1000; i++) {
+      seed = seed * 1103515245 + 12345;
+      items[i].key = (seed >> 8) % 500;
+      ASSERT_EQ(0, MH_insert(heap, &items[i], items[i].key));
+   }
+   for (i = 0; i < 1000; i++)
+      EXPECT_EQ(&items[i], MH_get(heap, items[i].pos));
+
+   // Remove every third item and rekey every fifth
+   for (i = 0; i < 1000; i += 3) {
+      MH_remove(heap, items[i].pos);
+      EXPECT_EQ(MH_NOT_QUEUED, items[i].pos);
+   }
+   for (i = 1; i < 1000; i += 5) {
+      if (items[i].pos == MH_NOT_QUEUED)
+         continue;
+      items[i].key = 1000 - items[i].key;
+      MH_update(heap, items[i].pos, items[i].key);
+   }
+   EXPECT_EQ(666u, MH_size(heap));
+
+   while ((item = (struct HeapItem *)MH_pop(heap))) {
+      EXPECT_GE(item->key, last);
+      EXPECT_EQ(MH_NOT_QUEUED, item->pos);
+      last = item->key;
+      popped++;
+   }
+   EXPECT_EQ(666u, popped);
+
+   MH_free(heap);
+}
+
 int sig_handler(int signum, void *arg) {
    struct HandlerData *data = (struct HandlerData *)arg;
 
@@ -133,5 +535,1000 @@ TEST_F(TestEvents, SignalHandler) {
    EXPECT_EQ(data.count, SIGALRM);
 }
 
+struct SigInfoData {
+   siginfo_t info;
+   int status;
+   struct ProcessData *proc;
+};
+
+int siginfo_handler(const siginfo_t *info, void *arg) {
+   struct SigInfoData *data = (struct SigInfoData *)arg;
+
+   data->info = *info;
+   return EVENT_KEEP;
+}
+
+int emit_sigusr1(void *arg) {
+   EXPECT_EQ(0, kill(getpid(), SIGUSR1));
+   return EVENT_REMOVE;
+}
+
+void child_death(struct ProcChild *child, void *arg) {
+   struct SigInfoData *data = (struct SigInfoData *)arg;
+
+   data->status = child->exitStatus;
+   EVT_exit_loop(PROC_evt(data->proc));
+}
+
+// Test that the sender's siginfo reaches the handler and children are reaped
+TEST_F(TestEvents, SignalInfo) {
+   struct SigInfoData data;
+   ProcChild *child;
+   sigset_t mask;
+   pid_t pid;
+   int status;
+
+   memset(&data, 0, sizeof(data));
+   data.status = -1;
+   data.proc = proc;
+
+   ASSERT_EQ(0, PROC_signal_info(proc, SIGUSR1, &siginfo_handler, &data));
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(10), emit_sigusr1, NULL);
+
+   // Children forked outside of PROC_fork_child get the signal unblocked
+   pid = fork();
+   if (pid == 0) {
+      sigprocmask(SIG_SETMASK, NULL, &mask);
+      _exit(sigismember(&mask, SIGUSR1) ? 1 : 0);
+   }
+   ASSERT_EQ(pid, waitpid(pid, &status, 0));
+   EXPECT_EQ(0, status);
+
+   child = PROC_fork_child(proc, "sh -c 'sleep 0.2; exit 3'");
+   ASSERT_TRUE(child != NULL);
+   CHLD_close_stdin(child);
+   CHLD_ignore_stdout(child);
+   CHLD_ignore_stderr(child);
+   CHLD_death_notice(child, &child_death, &data);
+
+   EVT_start_loop(PROC_evt(proc));
+
+   EXPECT_EQ(SIGUSR1, data.info.si_signo);
+   EXPECT_EQ(getpid(), data.info.si_pid);
+   EXPECT_TRUE(WIFEXITED(data.status));
+   EXPECT_EQ(3, WEXITSTATUS(data.status));
+}
+
+struct RecvBatchData {
+   uint32_t next;
+   uint32_t max;
+   int out_of_order;
+   struct ProcessData *proc;
+};
+
+void recv_batch_handler(struct ProcessData *proc, struct IPC_Command *cmd,
+      struct sockaddr_in *fromAddr, void *arg, int fd) {
+   struct RecvBatchData *data = (struct RecvBatchData *)arg;
+
+   if (cmd->ipcref != data->next)
+      data->out_of_order++;
+   data->next = cmd->ipcref + 1;
+   if (data->next >= data->max)
+      EVT_exit_loop(PROC_evt(data->proc));
+}
+
+// Test that a burst of commands is received in batches and handled in order
+TEST_F(TestEvents, RecvBatch) {
+   struct RecvBatchData data;
+   struct sockaddr_in dest;
+   socklen_t alen = sizeof(dest);
+   struct IPC_Command cmd;
+   uint32_t reqs[] = { IPC_TYPES_HEARTBEAT };
+   struct IPC_DataReq req = { 1, reqs };
+   char buff[128];
+   size_t len;
+   int fd;
+
+   memset(&data, 0, sizeof(data));
+   data.max = 50;
+   data.proc = proc;
+
+   EXPECT_EQ(-1, PROC_set_recv_batch(proc, 0));
+   ASSERT_EQ(0, PROC_set_recv_batch(proc, 8));
+   CMD_set_xdr_cmd_handler(IPC_CMDS_STATUS, &recv_batch_handler, &data);
+
+   // A spurious wakeup on an empty socket reads nothing
+   EXPECT_EQ(EVENT_KEEP, cmd_handler_cb(proc->cmdFd, EVENT_FD_READ, proc));
+   EXPECT_EQ(0, data.next);
+
+   ASSERT_EQ(0, getsockname(proc->cmdFd, (struct sockaddr*)&dest, &alen));
+   dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   fd = socket(AF_INET, SOCK_DGRAM, 0);
+   ASSERT_GE(fd, 0);
+
+   cmd.cmd = IPC_CMDS_STATUS;
+   cmd.parameters.type = IPC_TYPES_DATAREQ;
+   cmd.parameters.data = &req;
+   for (cmd.ipcref = 0; cmd.ipcref < data.max; cmd.ipcref++) {
+      len = 0;
+      ASSERT_EQ(0, IPC_Command_encode(&cmd, buff, &len, sizeof(buff), NULL));
+      ASSERT_EQ((ssize_t)len, sendto(fd, buff, len, 0,
+               (struct sockaddr*)&dest, sizeof(dest)));
+   }
+
+   EVT_start_loop(PROC_evt(proc));
+   CMD_set_xdr_cmd_handler(IPC_CMDS_STATUS, NULL, NULL);
+   close(fd);
+
+   EXPECT_EQ(data.max, data.next);
+   EXPECT_EQ(0, data.out_of_order);
+}
+
+struct EncodeArenaData {
+   int responses;
+   int timeouts;
+   struct sockaddr_in dest;
+   struct IPC_DataReq req;
+   struct ProcessData *proc;
+};
+
+void arena_echo_handler(struct ProcessData *proc, struct IPC_Command *cmd,
+      struct sockaddr_in *fromAddr, void *arg, int fd) {
+   IPC_success(proc, cmd, fromAddr);
+}
+
+void arena_response(struct ProcessData *proc, int timeout, void *arg,
+      char *resp_buff, size_t resp_len, enum IPC_CB_TYPE cb_type) {
+   struct EncodeArenaData *data = (struct EncodeArenaData *)arg;
+
+   if (timeout)
+      data->timeouts++;
+   else
+      data->responses++;
+
+   if (data->responses + data->timeouts < 10)
+      IPC_command(proc, IPC_CMDS_STATUS, &data->req, IPC_TYPES_DATAREQ,
+            data->dest, arena_response, data, IPC_CB_TYPE_RAW, 1000);
+   else
+      EVT_exit_loop(PROC_evt(proc));
+}
+
+// Test that commands and responses are encoded in the reused arena
+TEST_F(TestEvents, EncodeArena) {
+   struct EncodeArenaData data;
+   socklen_t alen = sizeof(data.dest);
+   uint32_t reqs[] = { IPC_TYPES_HEARTBEAT, IPC_TYPES_LOOP_STATS };
+   char *arena;
+
+   memset(&data, 0, sizeof(data));
+   data.proc = proc;
+   data.req.length = 2;
+   data.req.reqs = reqs;
+   ASSERT_EQ(0, getsockname(proc->cmdFd, (struct sockaddr*)&data.dest,
+            &alen));
+   data.dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   CMD_set_xdr_cmd_handler(IPC_CMDS_STATUS, &arena_echo_handler, NULL);
+
+   ASSERT_EQ(0, IPC_command(proc, IPC_CMDS_STATUS, &data.req,
+            IPC_TYPES_DATAREQ, data.dest, arena_response, &data,
+            IPC_CB_TYPE_RAW, 1000));
+   arena = proc->encodeBuff;
+   ASSERT_TRUE(arena != NULL);
+
+   EVT_start_loop(PROC_evt(proc));
+   CMD_set_xdr_cmd_handler(IPC_CMDS_STATUS, NULL, NULL);
+
+   EXPECT_EQ(10, data.responses);
+   EXPECT_EQ(0, data.timeouts);
+   // The command is the largest message sent, so the arena never grew
+   EXPECT_EQ(arena, proc->encodeBuff);
+}
+
+struct SendQueueData {
+   int rx;
+   struct sockaddr_in dest;
+   int sent;
+   int pending;
+   struct ProcessData *proc;
+};
+
+int send_queue_burst(void *arg) {
+   struct SendQueueData *data = (struct SendQueueData *)arg;
+   struct pollfd pfd = { data->rx, POLLIN, 0 };
+   int *seq;
+
+   for (; data->sent < 100; data->sent++) {
+      seq = (int*)malloc(sizeof(int));
+      *seq = data->sent;
+      EXPECT_EQ((int)sizeof(int), PROC_cmd_raw_sockaddr(data->proc, seq,
+               sizeof(int), &data->dest));
+   }
+
+   // Nothing goes out until the loop reaches its deferred events
+   data->pending = poll(&pfd, 1, 0);
+   return EVENT_REMOVE;
+}
+
+int send_queue_rx(int fd, char type, void *arg) {
+   struct SendQueueData *data = (struct SendQueueData *)arg;
+   static int expected = 0;
+   int seq;
+
+   while (read(fd, &seq, sizeof(seq)) == sizeof(seq)) {
+      EXPECT_EQ(expected, seq);
+      expected = seq + 1;
+   }
+   if (expected == data->sent) {
+      expected = 0;
+      EVT_exit_loop(PROC_evt(data->proc));
+   }
+
+   return EVENT_KEEP;
+}
+
+// Test that queued datagrams are sent together, in order, after the burst
+TEST_F(TestEvents, SendQueue) {
+   struct SendQueueData data;
+   socklen_t alen = sizeof(data.dest);
+
+   memset(&data, 0, sizeof(data));
+   data.proc = proc;
+   data.rx = socket(AF_INET, SOCK_DGRAM, 0);
+   ASSERT_GE(data.rx, 0);
+   data.dest.sin_family = AF_INET;
+   data.dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   ASSERT_EQ(0, bind(data.rx, (struct sockaddr*)&data.dest,
+            sizeof(data.dest)));
+   ASSERT_EQ(0, getsockname(data.rx, (struct sockaddr*)&data.dest, &alen));
+   ASSERT_EQ(0, fcntl(data.rx, F_SETFL, O_NONBLOCK));
+
+   ASSERT_EQ(0, PROC_set_send_queue(proc, proc->cmdFd, 1));
+   EVT_fd_add(PROC_evt(proc), data.rx, EVENT_FD_READ, send_queue_rx, &data);
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(10), send_queue_burst, &data);
+   EVT_start_loop(PROC_evt(proc));
+
+   EXPECT_EQ(0, data.pending);
+   EXPECT_EQ(100, data.sent);
+
+   EVT_fd_remove(PROC_evt(proc), data.rx, EVENT_FD_READ);
+   EXPECT_EQ(0, PROC_set_send_queue(proc, proc->cmdFd, 0));
+   close(data.rx);
+}
+
+struct PendingRespData {
+   int responses;
+   int timeouts;
+   int expected;
+   struct ProcessData *proc;
+};
+
+void pending_response(struct ProcessData *proc, int timeout, void *arg,
+      char *resp_buff, size_t resp_len, enum IPC_CB_TYPE cb_type) {
+   struct PendingRespData *data = (struct PendingRespData *)arg;
+
+   if (timeout)
+      data->timeouts++;
+   else
+      data->responses++;
+
+   if (data->responses + data->timeouts == data->expected)
+      EVT_exit_loop(PROC_evt(proc));
+}
+
+// Test matching many outstanding commands, some of which never get a reply
+TEST_F(TestEvents, PendingResponses) {
+   struct PendingRespData data;
+   struct sockaddr_in dest, silent;
+   socklen_t alen = sizeof(dest);
+   uint32_t reqs[] = { IPC_TYPES_HEARTBEAT };
+   struct IPC_DataReq req;
+   int i;
+
+   memset(&data, 0, sizeof(data));
+   data.proc = proc;
+   data.expected = 200 + 1001;
+   req.length = 1;
+   req.reqs = reqs;
+   ASSERT_EQ(0, getsockname(proc->cmdFd, (struct sockaddr*)&dest, &alen));
+   dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   silent = dest;
+   silent.sin_port = htons(ntohs(dest.sin_port) + 1);
+   CMD_set_xdr_cmd_handler(IPC_CMDS_STATUS, &arena_echo_handler, NULL);
+
+   EXPECT_EQ(0, CMD_pending_responses(proc->cmds));
+   for (i = 0; i < 200; i++)
+      ASSERT_EQ(0, IPC_command(proc, IPC_CMDS_STATUS, &req,
+               IPC_TYPES_DATAREQ, dest, pending_response, &data,
+               IPC_CB_TYPE_RAW, 2000));
+   // Callbacks waiting on a host that never answers, including two that
+   //  share an ipcref
+   for (i = 0; i < 1000; i++)
+      CMD_add_response_cb(proc, i, silent, pending_response, &data,
+            IPC_CB_TYPE_RAW, 50);
+   CMD_add_response_cb(proc, 7, silent, pending_response, &data,
+         IPC_CB_TYPE_RAW, 50);
+   EXPECT_EQ(1, CMD_pending_responses(proc->cmds));
+
+   EVT_start_loop(PROC_evt(proc));
+   CMD_set_xdr_cmd_handler(IPC_CMDS_STATUS, NULL, NULL);
+
+   EXPECT_EQ(200, data.responses);
+   EXPECT_EQ(1001, data.timeouts);
+   EXPECT_EQ(0, CMD_pending_responses(proc->cmds));
+}
+
+struct ClientCacheData {
+   int echo;
+   int received;
+   int replies;
+   int timeouts;
+   in_port_t srcPorts[8];
+   int ports;
+   struct sockaddr_in echoAddr, silentAddr;
+   struct ProcessData *proc;
+};
+
+int client_echo_cb(int fd, char type, void *arg) {
+   struct ClientCacheData *data = (struct ClientCacheData *)arg;
+   struct sockaddr_in src;
+   socklen_t alen = sizeof(src);
+   char buff[64];
+   ssize_t len;
+   int i;
+
+   len = recvfrom(fd, buff, sizeof(buff), 0, (struct sockaddr*)&src, &alen);
+   EXPECT_GT(len, 0);
+   for (i = 0; i < data->ports && data->srcPorts[i] != src.sin_port; i++)
+      ;
+   if (i == data->ports && data->ports < 8)
+      data->srcPorts[data->ports++] = src.sin_port;
+   EXPECT_EQ(len, sendto(fd, buff, len, 0, (struct sockaddr*)&src, alen));
+   // The blocking thread's requests end the second loop
+   if (++data->received == 8)
+      EVT_exit_loop(PROC_evt(data->proc));
+
+   return EVENT_KEEP;
+}
+
+void client_timeout_response(void *arg, void *rxResp, int rxLen) {
+   struct ClientCacheData *data = (struct ClientCacheData *)arg;
+
+   EXPECT_EQ(-2, rxLen);
+   EXPECT_TRUE(rxResp == NULL);
+   data->timeouts++;
+   EVT_exit_loop(PROC_evt(data->proc));
+}
+
+void client_echo_response(void *arg, void *rxResp, int rxLen) {
+   struct ClientCacheData *data = (struct ClientCacheData *)arg;
+
+   ASSERT_EQ((int)sizeof(int), rxLen);
+   EXPECT_EQ(data->replies, *(int*)rxResp);
+   if (++data->replies < 5)
+      EXPECT_EQ(0, socket_send_packet_async_sa(PROC_evt(data->proc),
+               &data->echoAddr, &data->replies, sizeof(int), 1000,
+               client_echo_response, data));
+   else
+      EXPECT_EQ(0, socket_send_packet_async_sa(PROC_evt(data->proc),
+               &data->silentAddr, &data->replies, sizeof(int), 20,
+               client_timeout_response, data));
+}
+
+static in_port_t client_src_port(int fd) {
+   struct sockaddr_in src;
+   socklen_t alen = sizeof(src);
+   char buff[64];
+
+   memset(&src, 0, sizeof(src));
+   EXPECT_GT(recvfrom(fd, buff, sizeof(buff), MSG_DONTWAIT,
+            (struct sockaddr*)&src, &alen), 0);
+   return src.sin_port;
+}
+
+void *client_blocking_thread(void *arg) {
+   struct ClientCacheData *data = (struct ClientCacheData *)arg;
+   int i, resp;
+
+   for (i = 0; i < 3; i++) {
+      resp = -1;
+      EXPECT_EQ((int)sizeof(int), socket_send_packet_and_read_xdr_sa(
+               &data->echoAddr, &i, sizeof(int), &resp, sizeof(resp), 1000));
+      EXPECT_EQ(i, resp);
+   }
+
+   return NULL;
+}
+
+// Test that requests reuse a connected client socket
+TEST_F(TestEvents, ClientCache) {
+   struct ClientCacheData data;
+   socklen_t alen = sizeof(data.echoAddr);
+   pthread_t thread;
+   int silent, i, resp;
+   in_port_t silentPorts[3];
+
+   memset(&data, 0, sizeof(data));
+   data.proc = proc;
+   data.echo = socket(AF_INET, SOCK_DGRAM, 0);
+   silent = socket(AF_INET, SOCK_DGRAM, 0);
+   ASSERT_GE(data.echo, 0);
+   ASSERT_GE(silent, 0);
+   data.echoAddr.sin_family = AF_INET;
+   data.echoAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   data.silentAddr = data.echoAddr;
+   ASSERT_EQ(0, bind(data.echo, (struct sockaddr*)&data.echoAddr, alen));
+   ASSERT_EQ(0, getsockname(data.echo, (struct sockaddr*)&data.echoAddr,
+            &alen));
+   ASSERT_EQ(0, bind(silent, (struct sockaddr*)&data.silentAddr, alen));
+   ASSERT_EQ(0, getsockname(silent, (struct sockaddr*)&data.silentAddr,
+            &alen));
+   EVT_fd_add(PROC_evt(proc), data.echo, EVENT_FD_READ, client_echo_cb,
+         &data);
+
+   ASSERT_EQ(0, socket_send_packet_async_sa(PROC_evt(proc), &data.echoAddr,
+            &data.replies, sizeof(int), 1000, client_echo_response, &data));
+   EVT_start_loop(PROC_evt(proc));
+   EXPECT_EQ(5, data.replies);
+   EXPECT_EQ(1, data.timeouts);
+
+   ASSERT_EQ(0, pthread_create(&thread, NULL, client_blocking_thread, &data));
+   EVT_start_loop(PROC_evt(proc));
+   pthread_join(thread, NULL);
+   // A request made from a response callback can't reuse the responding
+   //  socket yet, so the chain alternates between two.  The blocking calls
+   //  pick up a socket the async requests released.
+   EXPECT_EQ(2, data.ports);
+
+   // Sockets that timed out are closed, so a late reply can't be taken as
+   //  the answer to the next request
+   silentPorts[0] = client_src_port(silent);
+   for (i = 1; i < 3; i++) {
+      EXPECT_EQ(-2, socket_send_packet_and_read_xdr_sa(&data.silentAddr,
+               &i, sizeof(int), &resp, sizeof(resp), 20));
+      silentPorts[i] = client_src_port(silent);
+      EXPECT_NE(silentPorts[i - 1], silentPorts[i]);
+   }
+
+   EVT_fd_remove(PROC_evt(proc), data.echo, EVENT_FD_READ);
+   socket_client_cache_flush();
+   close(data.echo);
+   close(silent);
+}
+
+int fd_read_handler(int fd, char type, void *arg) {
+   struct HandlerData *data = (struct HandlerData *)arg;
+   char buff[16];
+   ssize_t len;
+
+   // A slow loop can let the timer write more than once between reads
+   EXPECT_EQ(EVENT_FD_READ, type);
+   len = read(fd, buff, data->max - data->count);
+   EXPECT_GE(len, 1);
+   if (len > 0)
+      data->count += len;
+   if (data->count >= data->max) {
+      EVT_exit_loop(PROC_evt(data->proc));
+      return EVENT_REMOVE;
+   }
+
+   return EVENT_KEEP;
+}
+
+int fd_write_data(void *arg) {
+   EXPECT_EQ(1, write(*(int*)arg, "x", 1));
+   return EVENT_KEEP;
+}
+
+// Test dispatching fd events
+TEST_F(TestEvents, FdEvents) {
+   struct HandlerData data;
+   int sv[2];
+   
+   data.count = 0;
+   data.max = 5;
+   data.proc = proc;
+
+   ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+   EXPECT_EQ(1, EVT_fd_add(PROC_evt(proc), sv[0], EVENT_FD_READ,
+            fd_read_handler, &data));
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(10), fd_write_data, &sv[1]);
+   
+   EVT_start_loop(PROC_evt(proc));
+
+   // Check the event ran the right amount of times
+   EXPECT_EQ(data.count, data.max);
+
+   close(sv[0]);
+   close(sv[1]);
+}
+
+struct ModeData {
+   int fd, wfd;
+   int mode;
+   int count;
+   int step;
+   int errors;
+   struct ProcessData *proc;
+};
+
+// Counts readiness without draining, so a level-triggered fd stays ready
+static int mode_read(int fd, char type, void *arg) {
+   ((struct ModeData *)arg)->count++;
+   return EVENT_KEEP;
+}
+
+static int mode_check(void *arg) {
+   struct ModeData *data = (struct ModeData *)arg;
+
+   data->step++;
+   if (data->count != data->step)
+      data->errors++;
+
+   if (data->step == 2) {
+      EVT_fd_remove(PROC_evt(data->proc), data->fd, EVENT_FD_READ);
+      EVT_exit_loop(PROC_evt(data->proc));
+      return EVENT_REMOVE;
+   }
+
+   // Allow exactly one more callback
+   if (data->mode == EVT_FD_ONESHOT)
+      EXPECT_EQ(1, EVT_fd_rearm(PROC_evt(data->proc), data->fd));
+   else
+      EXPECT_EQ(1, write(data->wfd, "x", 1));
+
+   return EVENT_KEEP;
+}
+
+static void run_fd_mode(struct ProcessData *proc, int mode) {
+   struct ModeData data;
+   int sv[2];
+
+   ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+   memset(&data, 0, sizeof(data));
+   data.fd = sv[0];
+   data.wfd = sv[1];
+   data.mode = mode;
+   data.proc = proc;
+
+   EXPECT_EQ(1, write(sv[1], "x", 1));
+   EXPECT_EQ(1, EVT_fd_add_flags(PROC_evt(proc), sv[0], EVENT_FD_READ,
+            mode_read, &data, mode));
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(30), mode_check, &data);
+   EVT_start_loop(PROC_evt(proc));
+
+   EXPECT_EQ(0, data.errors);
+   EXPECT_EQ(2, data.count);
+
+   close(sv[0]);
+   close(sv[1]);
+}
+
+static int reuse_read(int fd, char type, void *arg) {
+   char buff[16];
+
+   EXPECT_EQ(1, read(fd, buff, sizeof(buff)));
+   ((struct ModeData *)arg)->count++;
+   return EVENT_KEEP;
+}
+
+static int reuse_done(void *arg) {
+   EVT_exit_loop(PROC_evt(((struct ModeData *)arg)->proc));
+   return EVENT_REMOVE;
+}
+
+// Test re-adding a fd number that was closed and reused without removing it
+//  from the event loop first
+TEST_F(TestEvents, FdReused) {
+   struct ModeData data;
+   int sv[2], reused[2];
+
+   ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+   ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, reused));
+   memset(&data, 0, sizeof(data));
+   data.proc = proc;
+
+   EXPECT_EQ(1, EVT_fd_add(PROC_evt(proc), sv[0], EVENT_FD_READ,
+            reuse_read, &data));
+   ASSERT_EQ(sv[0], dup2(reused[0], sv[0]));
+   close(reused[0]);
+   EXPECT_EQ(1, EVT_fd_add(PROC_evt(proc), sv[0], EVENT_FD_READ,
+            reuse_read, &data));
+
+   EXPECT_EQ(1, write(reused[1], "x", 1));
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(30), reuse_done, &data);
+   EVT_start_loop(PROC_evt(proc));
+   EXPECT_EQ(1, data.count);
+
+   EVT_fd_remove(PROC_evt(proc), sv[0], EVENT_FD_READ);
+   close(sv[0]);
+   close(sv[1]);
+   close(reused[1]);
+}
+
+// Test one-shot fds fire once per arming with both pollers
+TEST_F(TestEvents, FdOneShot) {
+   run_fd_mode(proc, EVT_FD_ONESHOT);
+
+   ASSERT_EQ(0, EVT_set_poller(PROC_evt(proc), EP_select_init()));
+   run_fd_mode(proc, EVT_FD_ONESHOT);
+}
+
+// Test edge-triggered fds only fire when new data arrives
+TEST_F(TestEvents, FdEdgeTriggered) {
+   struct EventPoller *ep = EP_epoll_init();
+
+   // select emulates edge-triggered fds as level-triggered
+   if (!ep)
+      return;
+   ASSERT_EQ(0, EVT_set_poller(PROC_evt(proc), ep));
+   run_fd_mode(proc, EVT_FD_EDGE);
+   EXPECT_EQ(0, EVT_fd_add_flags(PROC_evt(proc), 0, EVENT_FD_READ,
+            mode_read, NULL, 0x80));
+}
+
+static int edge_oneshot_check(void *arg) {
+   struct ModeData *data = (struct ModeData *)arg;
+
+   data->step++;
+   switch (data->step) {
+      case 1:
+         EXPECT_EQ(1, data->count);
+         // A new edge while disarmed must not be reported
+         EXPECT_EQ(1, write(data->wfd, "x", 1));
+         return EVENT_KEEP;
+      case 2:
+         EXPECT_EQ(1, data->count);
+         EXPECT_EQ(1, EVT_fd_rearm(PROC_evt(data->proc), data->fd));
+         return EVENT_KEEP;
+   }
+
+   EXPECT_EQ(2, data->count);
+   EVT_fd_remove(PROC_evt(data->proc), data->fd, EVENT_FD_READ);
+   EVT_exit_loop(PROC_evt(data->proc));
+   return EVENT_REMOVE;
+}
+
+static void run_edge_oneshot(struct ProcessData *proc) {
+   struct ModeData data;
+   int sv[2];
+
+   ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+   memset(&data, 0, sizeof(data));
+   data.fd = sv[0];
+   data.wfd = sv[1];
+   data.proc = proc;
+
+   EXPECT_EQ(1, write(sv[1], "x", 1));
+   EXPECT_EQ(1, EVT_fd_add_flags(PROC_evt(proc), sv[0], EVENT_FD_READ,
+            mode_read, &data, EVT_FD_EDGE | EVT_FD_ONESHOT));
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(30), edge_oneshot_check, &data);
+   EVT_start_loop(PROC_evt(proc));
+
+   EXPECT_EQ(3, data.step);
+   close(sv[0]);
+   close(sv[1]);
+}
+
+// Test edge-triggered one-shot fds stay quiet until rearmed
+TEST_F(TestEvents, FdEdgeOneShot) {
+   run_edge_oneshot(proc);
+
+   ASSERT_EQ(0, EVT_set_poller(PROC_evt(proc), EP_select_init()));
+   run_edge_oneshot(proc);
+}
+
+struct PrioData {
+   int realtime;
+   int bulk;
+   int first;           // Class of the first callback
+   int timed;
+   int errors;
+};
+
+static int prio_realtime(int fd, char type, void *arg) {
+   struct PrioData *data = (struct PrioData *)arg;
+
+   if (!data->realtime++ && !data->bulk)
+      data->first = EVT_PRIO_REALTIME;
+   return EVENT_KEEP;
+}
+
+static int prio_bulk(int fd, char type, void *arg) {
+   struct PrioData *data = (struct PrioData *)arg;
+
+   if (!data->realtime && !data->bulk)
+      data->first = EVT_PRIO_BULK;
+   // Each iteration runs the realtime fd and one bulk fd
+   if (++data->bulk > data->realtime)
+      data->errors++;
+   return EVENT_KEEP;
+}
+
+static int prio_timed(void *arg) {
+   struct PrioData *data = (struct PrioData *)arg;
+
+   // Bulk timed work waits for the realtime fd ready in the same iteration
+   if (!data->realtime)
+      data->errors++;
+   data->timed++;
+   return EVENT_REMOVE;
+}
+
+static int prio_exit(void *arg) {
+   EVT_exit_loop((EVTHandler *)arg);
+   return EVENT_REMOVE;
+}
+
+// Test a flood of bulk fds can't starve a realtime fd
+TEST_F(TestEvents, FdPriority) {
+   EVTHandler *evt = PROC_evt(proc);
+   struct PrioData data;
+   int sv[5][2], i;
+   void *id;
+
+   memset(&data, 0, sizeof(data));
+   data.first = -1;
+   EVT_set_priority_budget(evt, EVT_PRIO_BULK, 1);
+
+   // The fds are never drained, so they are ready on every iteration
+   for (i = 0; i < 5; i++) {
+      ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]));
+      EXPECT_EQ(1, write(sv[i][1], "x", 1));
+   }
+   for (i = 0; i < 4; i++) {
+      EXPECT_EQ(1, EVT_fd_add(evt, sv[i][0], EVENT_FD_READ, prio_bulk, &data));
+      EVT_fd_set_priority(evt, sv[i][0], EVT_PRIO_BULK);
+   }
+   EXPECT_EQ(1, EVT_fd_add(evt, sv[4][0], EVENT_FD_READ, prio_realtime,
+            &data));
+   EVT_fd_set_priority(evt, sv[4][0], EVT_PRIO_REALTIME);
+
+   id = EVT_sched_add(evt, EVT_ms2tv(0), prio_timed, &data);
+   EVT_sched_set_priority(evt, id, EVT_PRIO_BULK);
+   EVT_sched_add(evt, EVT_ms2tv(50), prio_exit, evt);
+   EVT_start_loop(evt);
+
+   EXPECT_EQ(EVT_PRIO_REALTIME, data.first);
+   EXPECT_GT(data.bulk, 4);
+   EXPECT_EQ(1, data.timed);
+   EXPECT_EQ(0, data.errors);
+
+   for (i = 0; i < 5; i++) {
+      EVT_fd_remove(evt, sv[i][0], EVENT_FD_READ);
+      close(sv[i][0]);
+      close(sv[i][1]);
+   }
+}
+
+// Test dispatching fd events on a fd beyond the initial table size
+TEST_F(TestEvents, FdEventsHighFd) {
+   struct HandlerData data;
+   int sv[2], high;
+   
+   data.count = 0;
+   data.max = 3;
+   data.proc = proc;
+
+   ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+   high = dup2(sv[0], 500);
+   ASSERT_EQ(500, high);
+   EXPECT_EQ(1, EVT_fd_add(PROC_evt(proc), high, EVENT_FD_READ,
+            fd_read_handler, &data));
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(10), fd_write_data, &sv[1]);
+   
+   EVT_start_loop(PROC_evt(proc));
+
+   EXPECT_EQ(data.count, data.max);
+
+   close(high);
+   close(sv[0]);
+   close(sv[1]);
+}
+
+struct Reactor {
+   EVTHandler *evt;
+   int count;
+   int expected;
+};
+
+static int reactor_post_cb(void *arg) {
+   struct Reactor *r = (struct Reactor *)arg;
+
+   if (++r->count == r->expected)
+      EVT_exit_loop(r->evt);
+   return 0;
+}
+
+static void *reactor_main(void *arg) {
+   struct Reactor *r = (struct Reactor *)arg;
+
+   EVT_start_loop(r->evt);
+   return NULL;
+}
+
+static void *poster_main(void *arg) {
+   struct Reactor *r = (struct Reactor *)arg;
+   int i;
+
+   for (i = 0; i < 1000; i++)
+      EVT_post(r->evt, reactor_post_cb, r);
+   return NULL;
+}
+
+// Test posting callbacks into an event loop running on another thread
+TEST_F(TestEvents, PostAcrossThreads) {
+   struct Reactor r;
+   pthread_t loop, posters[4];
+   int i;
+
+   r.evt = EVT_create_handler(NULL, NULL);
+   ASSERT_TRUE(r.evt != NULL);
+   r.count = 0;
+   r.expected = 4000;
+
+   ASSERT_EQ(0, pthread_create(&loop, NULL, reactor_main, &r));
+   for (i = 0; i < 4; i++)
+      ASSERT_EQ(0, pthread_create(&posters[i], NULL, poster_main, &r));
+   for (i = 0; i < 4; i++)
+      pthread_join(posters[i], NULL);
+   pthread_join(loop, NULL);
+
+   // Every post ran exactly once, on the reactor's thread
+   EXPECT_EQ(4000, r.count);
+   EVT_free_handler(r.evt);
+}
+
+static int slow_handler(void *arg) {
+   struct HandlerData *data = (struct HandlerData *)arg;
+
+   usleep(3000);
+   if (++data->count >= data->max)
+      EVT_exit_loop(PROC_evt(data->proc));
+   return EVENT_KEEP;
+}
+
+struct StatsSeen {
+   int found;
+   uint32_t count, max_usec, bucket_total;
+};
+
+static void stats_visitor(void *arg, const char *name, int fd, int event,
+      const struct EVTEventStats *stats) {
+   struct StatsSeen *seen = (struct StatsSeen *)arg;
+   int i;
+
+   if (strcmp(name, "Slow Event"))
+      return;
+   EXPECT_EQ(-1, fd);
+   seen->found++;
+   seen->count = stats->duration.count;
+   seen->max_usec = stats->duration.max_usec;
+   for (i = 0; i < EVT_HIST_BUCKETS; i++)
+      seen->bucket_total += stats->duration.buckets[i];
+}
+
+// Test callback timing and loop utilization statistics
+TEST_F(TestEvents, LoopStats) {
+   struct HandlerData data;
+   struct EVTLoopStats stats;
+   struct StatsSeen seen;
+   void *evt;
+
+   data.count = 0;
+   data.max = 5;
+   data.proc = proc;
+   memset(&seen, 0, sizeof(seen));
+
+   EVT_set_event_stats(PROC_evt(proc), 1);
+   evt = EVT_sched_add(PROC_evt(proc), EVT_ms2tv(10), slow_handler, &data);
+   ASSERT_TRUE(evt != NULL);
+   EVT_sched_set_name(evt, "Slow Event");
+   EVT_start_loop(PROC_evt(proc));
+
+   EVT_get_loop_stats(PROC_evt(proc), &stats);
+   EXPECT_GE(stats.timed.duration.count, 5u);
+   EXPECT_GE(stats.timed.duration.max_usec, 3000u);
+   EXPECT_GE(stats.busy_usec, 15000u);
+   EXPECT_GE(stats.idle_usec, 25000u);
+
+   EVT_iterate_event_stats(PROC_evt(proc), stats_visitor, &seen);
+   EXPECT_EQ(1, seen.found);
+   EXPECT_EQ(5u, seen.count);
+   EXPECT_EQ(5u, seen.bucket_total);
+   EXPECT_GE(seen.max_usec, 3000u);
+
+   EVT_reset_loop_stats(PROC_evt(proc));
+   EVT_get_loop_stats(PROC_evt(proc), &stats);
+   EXPECT_EQ(0u, stats.timed.duration.count);
+   EXPECT_EQ(0u, stats.busy_usec);
+   EVT_sched_remove(PROC_evt(proc), evt);
+}
+
+struct WorkData {
+   int done;
+   int sum;
+   struct ProcessData *proc;
+};
+
+static int work_square(void *arg) {
+   intptr_t val = (intptr_t)arg;
+
+   return val * val;
+}
+
+static int work_done(void *arg, int retval) {
+   struct WorkData *data = (struct WorkData *)arg;
+
+   data->sum += retval;
+   if (++data->done == 100)
+      EVT_exit_loop(PROC_evt(data->proc));
+   return 0;
+}
+
+// Test work offloaded to the worker pool completes on the event loop
+TEST_F(TestEvents, WorkerPool) {
+   struct WorkData data;
+   intptr_t i;
+   int expected = 0;
+
+   data.done = 0;
+   data.sum = 0;
+   data.proc = proc;
+
+   for (i = 0; i < 100; i++) {
+      ASSERT_EQ(0, thread_function(proc, (void *)work_square, (void *)i,
+               (void *)work_done, &data));
+      expected += i * i;
+   }
+   EVT_start_loop(PROC_evt(proc));
+
+   EXPECT_EQ(100, data.done);
+   EXPECT_EQ(expected, data.sum);
+}
+
+static int work_sleep(void *arg) {
+   usleep(20000);
+   return 1;
+}
+
+static int work_count(void *arg, int retval) {
+   int *counts = (int *)arg;
+
+   counts[retval < 0 ? 1 : 0]++;
+   if (retval < 0)
+      EXPECT_EQ(ECANCELED, errno);
+   return 0;
+}
+
+// Test jobs in flight keep an auto-exit loop running and destroying the
+//  pool cancels the jobs that haven't started
+TEST_F(TestEvents, WorkerPoolAutoExit) {
+   EVTHandler *evt = EVT_create_handler(NULL, NULL);
+   struct WorkerPool *pool;
+   int counts[2] = { 0, 0 };
+   int i;
+
+   ASSERT_TRUE(evt != NULL);
+   pool = WP_init(evt, 1, 4);
+   ASSERT_TRUE(pool != NULL);
+
+   for (i = 0; i < 2; i++)
+      ASSERT_EQ(0, WP_submit(pool, work_sleep, NULL, work_count, counts));
+   EVT_start_loop_auto_exit(evt, EVT_EXIT_FD);
+   EXPECT_EQ(2, counts[0]);
+   EXPECT_EQ(0, counts[1]);
+
+   counts[0] = 0;
+   for (i = 0; i < 3; i++)
+      ASSERT_EQ(0, WP_submit(pool, work_sleep, NULL, work_count, counts));
+   WP_destroy(pool);
+   EXPECT_GE(counts[1], 2);
+
+   // The job that was running still delivers its completion
+   EVT_start_loop_auto_exit(evt, EVT_EXIT_FD);
+   EXPECT_EQ(3, counts[0] + counts[1]);
+
+   EVT_free_handler(evt);
 }
 
+}
@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <pthread.h>
+#include "../../hashtable.h"
+#include "../../frozenTable.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+struct Entry {
+   intptr_t key;
+   int visited;
+};
+
+static size_t int_hash(void *key) {
+   return (size_t)(intptr_t)key;
+}
+
+static int int_cmp(void *key1, void *key2) {
+   return key1 == key2;
+}
+
+static void *entry_key(void *data) {
+   return (void *)((struct Entry *)data)->key;
+}
+
+static int remove_odd(void *data) {
+   struct Entry *entry = (struct Entry *)data;
+
+   entry->visited++;
+   return entry->key & 1;
+}
+
+// Test the table grows past its initial size and keeps every entry
+TEST(TestHashTable, Grow) {
+   struct HashTable *table;
+   static struct Entry entries[10000];
+   struct Entry other;
+   intptr_t i;
+
+   table = HASH_create_table(37, int_hash, int_cmp, entry_key);
+   ASSERT_TRUE(table != NULL);
+
+   for (i = 0; i < 10000; i++) {
+      entries[i].key = i * 64 + (i & 1);
+      entries[i].visited = 0;
+      ASSERT_EQ(0, HASH_add_data(table, &entries[i]));
+   }
+   EXPECT_EQ(-3, HASH_add_data(table, &entries[5]));
+
+   // Replacing swaps in an entry with an equal key
+   other.key = entries[5].key;
+   other.visited = 0;
+   EXPECT_EQ(&entries[5], HASH_replace_data(table, &other));
+   EXPECT_EQ(&other, HASH_find_key(table, (void *)other.key));
+   EXPECT_EQ(&other, HASH_replace_data(table, &entries[5]));
+   other.key = 2;
+   EXPECT_TRUE(HASH_replace_data(table, &other) == NULL);
+
+   for (i = 0; i < 10000; i++)
+      EXPECT_EQ(&entries[i], HASH_find_key(table, (void *)entries[i].key));
+   EXPECT_TRUE(HASH_find_key(table, (void *)2) == NULL);
+
+   // Removing during iteration visits every entry exactly once
+   HASH_iterate_table(table, remove_odd);
+   for (i = 0; i < 10000; i++) {
+      EXPECT_EQ(1, entries[i].visited);
+      EXPECT_EQ(i & 1 ? NULL : &entries[i],
+            HASH_find_data(table, &entries[i]));
+   }
+
+   for (i = 0; i < 10000; i += 2) {
+      EXPECT_EQ(&entries[i], HASH_remove_data(table, &entries[i]));
+      EXPECT_TRUE(HASH_find_data(table, &entries[i]) == NULL);
+   }
+
+   HASH_free_table(table);
+}
+
+struct FrozenReader {
+   struct FrozenTable *table;
+   struct Entry *entries;
+   int stop;
+   int errors;
+};
+
+static void *frozen_reader(void *arg) {
+   struct FrozenReader *r = (struct FrozenReader *)arg;
+   struct Entry *found;
+   int i;
+
+   while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+      // The first 100 entries are registered before the reader starts
+      for (i = 0; i < 100; i++) {
+         found = (struct Entry *)FT_find(r->table, r->entries[i].key);
+         if (found != &r->entries[i])
+            r->errors++;
+      }
+   }
+
+   return NULL;
+}
+
+// Test lookups see late registrations and stay valid while republishing
+TEST(TestFrozenTable, Republish) {
+   struct FrozenTable table;
+   struct FrozenReader reader;
+   static struct Entry entries[1000], other;
+   pthread_t thread;
+   int i;
+
+   FT_init(&table);
+   EXPECT_TRUE(FT_find(&table, 0) == NULL);
+
+   for (i = 0; i < 1000; i++)
+      entries[i].key = (i * 7919) % 1000 + 1;
+   for (i = 0; i < 100; i++)
+      ASSERT_EQ(0, FT_insert(&table, entries[i].key, &entries[i], 0));
+
+   reader.table = &table;
+   reader.entries = entries;
+   reader.stop = 0;
+   reader.errors = 0;
+   ASSERT_EQ(0, pthread_create(&thread, NULL, &frozen_reader, &reader));
+
+   for (i = 100; i < 1000; i++) {
+      ASSERT_EQ(0, FT_insert(&table, entries[i].key, &entries[i], 0));
+      EXPECT_EQ(&entries[i], FT_find(&table, entries[i].key));
+   }
+
+   __atomic_store_n(&reader.stop, 1, __ATOMIC_RELEASE);
+   pthread_join(thread, NULL);
+   EXPECT_EQ(0, reader.errors);
+
+   EXPECT_EQ(1000u, FT_size(&table));
+   EXPECT_TRUE(FT_find(&table, 0) == NULL);
+   EXPECT_TRUE(FT_find(&table, 1001) == NULL);
+
+   other.key = entries[5].key;
+   EXPECT_EQ(-1, FT_insert(&table, other.key, &other, 0));
+   EXPECT_EQ(&entries[5], FT_find(&table, other.key));
+   EXPECT_EQ(0, FT_insert(&table, other.key, &other, 1));
+   EXPECT_EQ(&other, FT_find(&table, other.key));
+
+   FT_clear(&table);
+   EXPECT_EQ(0u, FT_size(&table));
+   EXPECT_TRUE(FT_find(&table, entries[0].key) == NULL);
+}
+
+}
@@ -204,6 +204,49 @@ TEST_F(TestVirtClkEvt, MultipleEvents) {
    EXPECT_EQ(t.tv_usec, 0);
 }
 
+struct SlackData {
+   struct timeval ran;
+   int exit;
+   struct ProcessData *proc;
+};
+
+int slack_handler(void *arg) {
+   struct SlackData *data = (struct SlackData *)arg;
+
+   EVT_get_gmt_time(PROC_evt(data->proc), &data->ran);
+   if (data->exit)
+      EVT_exit_loop(PROC_evt(data->proc));
+   return EVENT_REMOVE;
+}
+
+// Test events with slack share the wakeup of a later event
+TEST_F(TestVirtClkEvt, Slack) {
+   struct SlackData a, b, c;
+   void *evt;
+
+   memset(&a, 0, sizeof(a));
+   memset(&b, 0, sizeof(b));
+   memset(&c, 0, sizeof(c));
+   a.proc = b.proc = c.proc = proc;
+   c.exit = 1;
+
+   evt = EVT_sched_add(PROC_evt(proc), EVT_ms2tv(1000), slack_handler, &a);
+   EXPECT_EQ(0, EVT_sched_set_slack(PROC_evt(proc), evt, EVT_ms2tv(2000)));
+   EVT_sched_add(PROC_evt(proc), EVT_ms2tv(2500), slack_handler, &b);
+   evt = EVT_sched_add(PROC_evt(proc), EVT_ms2tv(4000), slack_handler, &c);
+   EXPECT_EQ(0, EVT_sched_set_slack(PROC_evt(proc), evt, EVT_ms2tv(500)));
+
+   EVT_start_loop(PROC_evt(proc));
+
+   // a is delayed to run with b, c has nothing to share and uses its slack
+   EXPECT_EQ(2, a.ran.tv_sec);
+   EXPECT_EQ(500000, a.ran.tv_usec);
+   EXPECT_EQ(2, b.ran.tv_sec);
+   EXPECT_EQ(500000, b.ran.tv_usec);
+   EXPECT_EQ(4, c.ran.tv_sec);
+   EXPECT_EQ(500000, c.ran.tv_usec);
+}
+
 int start_pause(void *arg) {
    struct ProcessData *proc = (struct ProcessData *)arg;
    struct EventState *evt = PROC_evt(proc);
@@ -0,0 +1,217 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timerWheel.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TW_LEVELS 8
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+#define TW_SLOT_MASK (TW_SLOTS - 1)
+// Each level is 2^TW_LEVEL_SHIFT times coarser than the level below
+#define TW_LEVEL_SHIFT 3
+
+#define TW_GRAN_SHIFT(lvl) ((lvl) * TW_LEVEL_SHIFT)
+// Largest delta held by a level
+#define TW_LEVEL_RANGE(lvl) ((uint64_t)TW_SLOTS << TW_GRAN_SHIFT(lvl))
+
+struct TimerWheel {
+   uint64_t now;
+   size_t count;
+   uint64_t occupied[TW_LEVELS];          // Bitmap of non-empty slots
+   struct TW_node *slots[TW_LEVELS][TW_SLOTS];
+};
+
+struct TimerWheel *TW_init(uint64_t now)
+{
+   struct TimerWheel *tw;
+
+   tw = malloc(sizeof(struct TimerWheel));
+   if (!tw)
+      return NULL;
+   memset(tw, 0, sizeof(struct TimerWheel));
+   tw->now = now;
+
+   return tw;
+}
+
+void TW_free(struct TimerWheel *tw)
+{
+   if (tw)
+      free(tw);
+}
+
+size_t TW_size(struct TimerWheel *tw)
+{
+   return tw ? tw->count : 0;
+}
+
+int TW_add(struct TimerWheel *tw, struct TW_node *node, uint64_t expires)
+{
+   uint64_t delta;
+   int lvl, slot;
+
+   if (expires <= tw->now)
+      return -1;
+   delta = expires - tw->now;
+
+   for (lvl = 0; lvl < TW_LEVELS && delta >= TW_LEVEL_RANGE(lvl); lvl++)
+      ;
+   if (lvl == TW_LEVELS)
+      return -1;
+
+   // The slot holding a node starts at or before its expiration, but always
+   //  after now because the node didn't fit in the next finer level
+   slot = (expires >> TW_GRAN_SHIFT(lvl)) & TW_SLOT_MASK;
+   node->expires = expires;
+   node->slot = (lvl << TW_SLOT_BITS) | slot;
+   node->next = tw->slots[lvl][slot];
+   if (node->next)
+      node->next->pprev = &node->next;
+   node->pprev = &tw->slots[lvl][slot];
+   tw->slots[lvl][slot] = node;
+   tw->occupied[lvl] |= 1ULL << slot;
+   tw->count++;
+
+   return 0;
+}
+
+void TW_remove(struct TimerWheel *tw, struct TW_node *node)
+{
+   int lvl, slot;
+
+   if (!node->pprev)
+      return;
+
+   lvl = node->slot >> TW_SLOT_BITS;
+   slot = node->slot & TW_SLOT_MASK;
+
+   *node->pprev = node->next;
+   if (node->next)
+      node->next->pprev = node->pprev;
+   node->next = NULL;
+   node->pprev = NULL;
+   tw->count--;
+
+   if (!tw->slots[lvl][slot])
+      tw->occupied[lvl] &= ~(1ULL << slot);
+}
+
+// Rotates a level's bitmap so bit 0 is the first slot after unit
+static uint64_t tw_rotate(uint64_t bits, uint64_t unit)
+{
+   int rot = (unit + 1) & TW_SLOT_MASK;
+
+   if (!rot)
+      return bits;
+   return (bits >> rot) | (bits << (TW_SLOTS - rot));
+}
+
+uint64_t TW_next(struct TimerWheel *tw)
+{
+   uint64_t next = UINT64_MAX, unit, start, bits;
+   int lvl;
+
+   for (lvl = 0; lvl < TW_LEVELS; lvl++) {
+      if (!tw->occupied[lvl])
+         continue;
+
+      unit = tw->now >> TW_GRAN_SHIFT(lvl);
+      bits = tw_rotate(tw->occupied[lvl], unit);
+      start = (unit + 1 + __builtin_ctzll(bits)) << TW_GRAN_SHIFT(lvl);
+      if (start < next)
+         next = start;
+   }
+
+   return next;
+}
+
+static void tw_release_slot(struct TimerWheel *tw, int lvl, int slot,
+      TW_node_cb cb, void *arg)
+{
+   struct TW_node *node, *next;
+
+   node = tw->slots[lvl][slot];
+   tw->slots[lvl][slot] = NULL;
+   tw->occupied[lvl] &= ~(1ULL << slot);
+
+   for (; node; node = next) {
+      next = node->next;
+      node->next = NULL;
+      node->pprev = NULL;
+      tw->count--;
+      (*cb)(node, arg);
+   }
+}
+
+void TW_release_all(struct TimerWheel *tw, TW_node_cb cb, void *arg)
+{
+   int lvl, slot;
+
+   for (lvl = 0; lvl < TW_LEVELS; lvl++)
+      for (slot = 0; slot < TW_SLOTS; slot++)
+         if (tw->occupied[lvl] & (1ULL << slot))
+            tw_release_slot(tw, lvl, slot, cb, arg);
+}
+
+void TW_advance(struct TimerWheel *tw, uint64_t now, TW_node_cb cb, void *arg)
+{
+   uint64_t prev = tw->now, unit, target, bits;
+   int lvl, bit;
+
+   if (now == prev)
+      return;
+
+   // Nodes added by the callback must be placed relative to the new time
+   tw->now = now;
+
+   if (now < prev) {
+      TW_release_all(tw, cb, arg);
+      return;
+   }
+
+   for (lvl = 0; lvl < TW_LEVELS; lvl++) {
+      unit = prev >> TW_GRAN_SHIFT(lvl);
+      target = now >> TW_GRAN_SHIFT(lvl);
+      if (target == unit)
+         continue;
+
+      // Walk the slots in time order, stopping at the first that hasn't
+      //  started yet.  Snapshot the bitmap so re-added nodes aren't visited.
+      bits = tw_rotate(tw->occupied[lvl], unit);
+      while (bits) {
+         bit = __builtin_ctzll(bits);
+         if (unit + 1 + bit > target)
+            break;
+         tw_release_slot(tw, lvl, (unit + 1 + bit) & TW_SLOT_MASK, cb, arg);
+         bits &= bits - 1;
+      }
+   }
+}
+
+void TW_iterate(struct TimerWheel *tw, TW_node_cb cb, void *arg)
+{
+   struct TW_node *node;
+   int lvl, slot;
+
+   for (lvl = 0; lvl < TW_LEVELS; lvl++)
+      for (slot = 0; slot < TW_SLOTS; slot++)
+         for (node = tw->slots[lvl][slot]; node; node = node->next)
+            (*cb)(node, arg);
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file timerWheel.h Hierarchical timing wheel.
+ *
+ * The wheel holds nodes keyed by an expiration tick with O(1) insertion and
+ * removal.  Each level has 64 slots and is 8 times coarser than the level
+ * below it.  Nodes are never cascaded between levels.  Instead a node is
+ * released as soon as the start of its slot is reached, which may be up to
+ * one slot width before its expiration tick.  Callers that need exact
+ * deadlines should move released nodes into an exact structure, such as
+ * a priority queue, to wait out the remainder.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Node embedded in each element stored in the wheel */
+struct TW_node {
+   struct TW_node *next;
+   struct TW_node **pprev;    // NULL when the node is not in a wheel
+   uint64_t expires;
+   uint16_t slot;
+};
+
+struct TimerWheel;
+
+/** Callback invoked for each node released or visited */
+typedef void (*TW_node_cb)(struct TW_node *node, void *arg);
+
+/**
+ * Create an empty wheel.
+ *
+ * @param now The current tick.
+ *
+ * @return The wheel or NULL for insufficient memory.
+ */
+struct TimerWheel *TW_init(uint64_t now);
+
+/**
+ * Free the wheel.  Nodes still in the wheel are not touched.
+ */
+void TW_free(struct TimerWheel *tw);
+
+/**
+ * Add a node to the wheel.
+ *
+ * @param tw The wheel.
+ * @param node A node not currently in any wheel.
+ * @param expires The tick the node expires at.
+ *
+ * @return 0 on success, -1 if the node is already due or too far in the
+ *    future for the wheel to hold.
+ */
+int TW_add(struct TimerWheel *tw, struct TW_node *node, uint64_t expires);
+
+/**
+ * Remove a node from the wheel.
+ */
+void TW_remove(struct TimerWheel *tw, struct TW_node *node);
+
+/**
+ * @return Non-zero if the node is currently in a wheel.
+ */
+static inline int TW_is_queued(struct TW_node *node)
+{
+   return node->pprev != NULL;
+}
+
+/**
+ * @return The earliest tick at which a node will be released, or
+ *    UINT64_MAX if the wheel is empty.
+ */
+uint64_t TW_next(struct TimerWheel *tw);
+
+/**
+ * Advance the wheel to the given tick, releasing every node whose slot has
+ * started.  If time moved backwards all nodes are released.  The callback
+ * may add nodes back into the wheel.
+ *
+ * @param tw The wheel.
+ * @param now The current tick.
+ * @param cb Called with each released node.
+ * @param arg Passed to the callback.
+ */
+void TW_advance(struct TimerWheel *tw, uint64_t now, TW_node_cb cb, void *arg);
+
+/**
+ * Release every node in the wheel regardless of its expiration.
+ */
+void TW_release_all(struct TimerWheel *tw, TW_node_cb cb, void *arg);
+
+/**
+ * Visit every node in the wheel.  The callback must not modify the wheel.
+ */
+void TW_iterate(struct TimerWheel *tw, TW_node_cb cb, void *arg);
+
+/**
+ * @return The number of nodes in the wheel.
+ */
+size_t TW_size(struct TimerWheel *tw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
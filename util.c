@@ -25,10 +25,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <errno.h>
 
 #include "util.h"
 #include "ipc.h"
-#include "priorityQueue.h"
+#include "minHeap.h"
 #include "debug.h"
 
 static const char *serialNumFileName = "/proc/cpuinfo";
@@ -130,7 +131,6 @@ struct CleanupState
 {
    struct dirent dirent;
    struct timeval score;
-   size_t pos;
 };
 
 struct UnlinkNode {
@@ -138,41 +138,13 @@ struct UnlinkNode {
    struct UnlinkNode *next;
 };
 
-static struct timeval get_pri_cleanup_state(void *a)
-{
-   return ((struct CleanupState *) a)->score;
-}
-
-static void set_pri_cleanup_state(void *a, struct timeval pri)
-{
-   ((struct CleanupState *) a)->score = pri;
-}
-
-static int cmp_pri_cleanup_state(struct timeval next, struct timeval curr)
-{
-   return timercmp(&next, &curr, >=);
-}
-
-static size_t get_pos_cleanup_state(void *a)
-{
-   // printf("getpos %p: %lu\n", a, (unsigned long)((struct CleanupState *) a)->pos);
-   return ((struct CleanupState *) a)->pos;
-}
-
-// Set position callback
-static void set_pos_cleanup_state(void *a, size_t pos)
-{
-   // printf("setpos %p ->%lu\n", a, (unsigned long)pos);
-   ((struct CleanupState *) a)->pos = pos;
-}
-
 int UTIL_cleanup_dir(const char *dirname, int max_entries, int ignore_hidden,
     cleanup_mod_time_cb_t modtime_cb, void *cb_arg, post_delete_cb_t del_cb,
     void *del_cb_arg)
 {
    DIR *dir = NULL;
    struct dirent *prev_ent = NULL;
-   ps_pqueue_t *queue = NULL;
+   struct MinHeap *queue = NULL;
    struct CleanupState *cleanup_records = NULL, *next_rec = NULL;
    int res = 0;
    char *path_buff = NULL;
@@ -199,27 +171,25 @@ int UTIL_cleanup_dir(const char *dirname, int max_entries, int ignore_hidden,
       path_buff[name_offset++] = '/';
    path_buff[name_offset] = 0;
 
-   // Pre-allocate a pqueue (efficient data structure for keeping entries
+   // Pre-allocate a heap (efficient data structure for keeping entries
    //  sorted) to hold max + 5 entries
-   queue = ps_pqueue_init(max_entries + 5, cmp_pri_cleanup_state,
-      get_pri_cleanup_state, set_pri_cleanup_state,
-      get_pos_cleanup_state, set_pos_cleanup_state);
+   queue = MH_init(max_entries + 5, MH_NO_POS);
 
    if (!queue) {
-      ERR_REPORT(DBG_LEVEL_WARN, "failed to allocate pqueue\n");
+      ERR_REPORT(DBG_LEVEL_WARN, "failed to allocate heap\n");
       res = -ENOMEM;
       goto cleanup;
    }
 
-   // Pre-allocate max + 1 records to store in pqueue
+   // Pre-allocate max + 1 records to store in heap
    cleanup_records = malloc( (max_entries + 1) * sizeof(*cleanup_records));
-   if (!queue) {
-      ERR_REPORT(DBG_LEVEL_WARN, "failed to allocate pqueue\n");
+   if (!cleanup_records) {
+      ERR_REPORT(DBG_LEVEL_WARN, "failed to allocate cleanup records\n");
       res = -ENOMEM;
       goto cleanup;
    }
 
-   // Next record to use in pqueue.  if queue->size < max, use the next slot
+   // Next record to use in heap.  if queue->size < max, use the next slot
    //  in pre-allocated array.  Otherwise use the record we just removed from
    //  queue.
    next_rec = cleanup_records;
@@ -262,15 +232,15 @@ int UTIL_cleanup_dir(const char *dirname, int max_entries, int ignore_hidden,
       }
 
       // Add the file into our queue
-      ps_pqueue_insert(queue, next_rec);
+      MH_insert(queue, next_rec, MH_tv2key(&next_rec->score));
 
       // If the queue is too big (> max_entries), dequeue oldest entry,
       //  delete it, and reuse entry storage for next iteration through
       //  the readdir() loop
-      if (ps_pqueue_size(queue) > max_entries) {
-         next_rec = ps_pqueue_pop(queue);
+      if (MH_size(queue) > max_entries) {
+         next_rec = MH_pop(queue);
          if (!next_rec) {
-            ERR_REPORT(DBG_LEVEL_WARN, "pqueue internal error.  pop on non-empty queue didn't return record\n");
+            ERR_REPORT(DBG_LEVEL_WARN, "heap internal error.  pop on non-empty heap didn't return record\n");
             res = -1;
             goto cleanup;
          }
@@ -319,7 +289,7 @@ cleanup:
       closedir(dir);
 
    if (queue)
-      ps_pqueue_free(queue);
+      MH_free(queue);
 
    if (cleanup_records)
       free(cleanup_records);
@@ -350,16 +320,33 @@ int UTIL_ensure_dir(const char *toDir)
 int UTIL_ensure_path(const char *toDir)
 {
    char buff[PATH_MAX];
+   char *itr, end;
 
+   if (!*toDir)
+      return 0;
    if (UTIL_ensure_dir(toDir))
       return 1;
 
-   snprintf(buff, sizeof(buff), "mkdir -p \"%s\"", toDir);
-   buff[sizeof(buff)-1] = 0;
-
-   if(system(buff) == -1) {
-      ERR_REPORT(DBG_LEVEL_WARN, "error running mkdir");
-      return 0;
+   // Create each missing parent in turn, like mkdir -p.  Done here instead
+   //  of with system() so the child doesn't inherit blocked signals.
+   snprintf(buff, sizeof(buff), "%s", toDir);
+   // Skip the root of absolute paths
+   for (itr = buff; *itr == '/'; itr++)
+      ;
+   for (; ; itr++) {
+      if (*itr && *itr != '/')
+         continue;
+      if (itr > buff && itr[-1] != '/') {
+         end = *itr;
+         *itr = 0;
+         if (mkdir(buff, 0777) == -1 && errno != EEXIST) {
+            ERR_REPORT(DBG_LEVEL_WARN, "error running mkdir");
+            return 0;
+         }
+         *itr = end;
+      }
+      if (!*itr)
+         break;
    }
 
    return UTIL_ensure_dir(toDir);
@@ -0,0 +1,204 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "workerPool.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define WP_STACK_SIZE 0x80000
+
+struct WP_job {
+   EVTHandler *evt;
+   WP_work_cb work;
+   void *arg;
+   WP_done_cb done;
+   void *done_arg;
+   int retval;
+};
+
+struct WorkerPool {
+   EVTHandler *evt;
+   pthread_mutex_t lock;
+   pthread_cond_t ready;
+   struct WP_job **queue;     // Ring buffer of waiting jobs
+   int queue_len, head, count;
+   int stop;
+   int threads;
+   pthread_t *tids;
+};
+
+// Runs on the event loop
+static int wp_complete(void *arg)
+{
+   struct WP_job *job = (struct WP_job*)arg;
+
+   EVT_post_release(job->evt);
+   if (job->done)
+      job->done(job->done_arg, job->retval);
+   free(job);
+
+   return 0;
+}
+
+static void *wp_main(void *arg)
+{
+   struct WorkerPool *pool = (struct WorkerPool*)arg;
+   struct WP_job *job;
+
+   for (;;) {
+      pthread_mutex_lock(&pool->lock);
+      while (!pool->count && !pool->stop)
+         pthread_cond_wait(&pool->ready, &pool->lock);
+      if (pool->stop) {
+         pthread_mutex_unlock(&pool->lock);
+         break;
+      }
+      job = pool->queue[pool->head];
+      pool->head = (pool->head + 1) % pool->queue_len;
+      pool->count--;
+      pthread_mutex_unlock(&pool->lock);
+
+      job->retval = job->work(job->arg);
+
+      if (EVT_post(pool->evt, &wp_complete, job) < 0) {
+         DBG_print(DBG_LEVEL_WARN, "Failed to deliver worker completion");
+         free(job);
+      }
+   }
+
+   return NULL;
+}
+
+struct WorkerPool *WP_init(EVTHandler *evt, int threads, int queue_len)
+{
+   struct WorkerPool *pool;
+   pthread_attr_t attr;
+
+   if (!evt || threads < 1 || queue_len < 1)
+      return NULL;
+
+   pool = malloc(sizeof(struct WorkerPool));
+   if (!pool)
+      return NULL;
+   memset(pool, 0, sizeof(struct WorkerPool));
+
+   pool->evt = evt;
+   pool->queue_len = queue_len;
+   pool->queue = calloc(queue_len, sizeof(struct WP_job*));
+   pool->tids = calloc(threads, sizeof(pthread_t));
+   if (!pool->queue || !pool->tids)
+      goto fail;
+
+   pthread_mutex_init(&pool->lock, NULL);
+   pthread_cond_init(&pool->ready, NULL);
+
+   if (pthread_attr_init(&attr) != 0)
+      goto fail_sync;
+   pthread_attr_setstacksize(&attr, WP_STACK_SIZE);
+
+   for (pool->threads = 0; pool->threads < threads; pool->threads++)
+      if (pthread_create(&pool->tids[pool->threads], &attr, &wp_main, pool))
+         break;
+   pthread_attr_destroy(&attr);
+
+   if (!pool->threads)
+      goto fail_sync;
+
+   return pool;
+
+fail_sync:
+   pthread_cond_destroy(&pool->ready);
+   pthread_mutex_destroy(&pool->lock);
+fail:
+   free(pool->queue);
+   free(pool->tids);
+   free(pool);
+   return NULL;
+}
+
+int WP_submit(struct WorkerPool *pool, WP_work_cb work, void *arg,
+      WP_done_cb done, void *done_arg)
+{
+   struct WP_job *job;
+
+   if (!pool || !work) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   job = malloc(sizeof(struct WP_job));
+   if (!job)
+      return -1;
+   job->evt = pool->evt;
+   job->work = work;
+   job->arg = arg;
+   job->done = done;
+   job->done_arg = done_arg;
+   job->retval = 0;
+
+   pthread_mutex_lock(&pool->lock);
+   if (pool->count == pool->queue_len) {
+      pthread_mutex_unlock(&pool->lock);
+      free(job);
+      errno = EAGAIN;
+      return -1;
+   }
+   pool->queue[(pool->head + pool->count++) % pool->queue_len] = job;
+   pthread_cond_signal(&pool->ready);
+   pthread_mutex_unlock(&pool->lock);
+
+   // Keep auto-exit loops running until the completion is delivered
+   EVT_post_hold(pool->evt);
+
+   return 0;
+}
+
+void WP_destroy(struct WorkerPool *pool)
+{
+   struct WP_job *job;
+   int i;
+
+   if (!pool)
+      return;
+
+   pthread_mutex_lock(&pool->lock);
+   pool->stop = 1;
+   pthread_cond_broadcast(&pool->ready);
+   pthread_mutex_unlock(&pool->lock);
+
+   for (i = 0; i < pool->threads; i++)
+      pthread_join(pool->tids[i], NULL);
+
+   // The workers are gone, so the jobs they didn't start are cancelled
+   for (; pool->count > 0; pool->count--) {
+      job = pool->queue[pool->head];
+      pool->head = (pool->head + 1) % pool->queue_len;
+      job->retval = -1;
+      errno = ECANCELED;
+      wp_complete(job);
+   }
+
+   pthread_cond_destroy(&pool->ready);
+   pthread_mutex_destroy(&pool->lock);
+   free(pool->queue);
+   free(pool->tids);
+   free(pool);
+}
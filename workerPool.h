@@ -0,0 +1,87 @@
+/*
+ * Copyright PolySat, California Polytechnic State University, San Luis Obispo. cubesat@calpoly.edu
+ * This file is part of libproc, a PolySat library.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file workerPool.h Fixed size thread pool for offloading blocking work.
+ *
+ * Work items are queued from the event loop thread into a bounded queue and
+ * run by a fixed set of worker threads.  When an item finishes its
+ * completion callback is posted back to the event loop with EVT_post, so
+ * every completion that finishes while the loop is busy is handled in a
+ * single wakeup.
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "events.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Work function, run on a worker thread */
+typedef int (*WP_work_cb)(void *arg);
+
+/** Completion function, run on the event loop with the work's return value */
+typedef int (*WP_done_cb)(void *arg, int retval);
+
+struct WorkerPool;
+
+/**
+ * Create a worker pool.
+ *
+ * @param evt The event loop completions are delivered to.
+ * @param threads The number of worker threads.
+ * @param queue_len The most work items that may wait for a worker.
+ *
+ * @return The pool, or NULL on failure.
+ */
+struct WorkerPool *WP_init(EVTHandler *evt, int threads, int queue_len);
+
+/**
+ * Queue work for the pool.  Must be called from the event loop's thread.
+ * The work counts as a critical fd for EVT_EXIT_FD until its completion is
+ * delivered.
+ *
+ * @param pool The worker pool.
+ * @param work The function to run on a worker thread.
+ * @param arg Argument passed to work.
+ * @param done The function to call on the event loop with work's return
+ *    value, or NULL.
+ * @param done_arg Argument passed to done.
+ *
+ * @return 0 on success, -1 on failure.  errno is EAGAIN if the queue is full.
+ */
+int WP_submit(struct WorkerPool *pool, WP_work_cb work, void *arg,
+      WP_done_cb done, void *done_arg);
+
+/**
+ * Stop the worker threads and free the pool.  Must be called from the event
+ * loop's thread.  Work that is running is allowed to finish and its
+ * completion is still delivered.  Work that hasn't started is cancelled
+ * by calling its completion function before returning, with a return
+ * value of -1 and errno set to ECANCELED.
+ */
+void WP_destroy(struct WorkerPool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
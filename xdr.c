@@ -6,7 +6,7 @@
 #include <assert.h>
 #include "xdr.h"
 #include "events.h"
-#include "hashtable.h"
+#include "frozenTable.h"
 #include <inttypes.h>
 #include <stdarg.h>
 
@@ -15,32 +15,14 @@
       ((c) >= 'a' && (c) <= 'f' ? (c) - 'a' + 10 : 0 ))) & 0xF)
 
 
-static struct HashTable *structHash = NULL;
-
-static size_t xdr_struct_hash_func(void *key)
-{
-   return (uintptr_t)key;
-}
-
-static void *xdr_struct_key_for_data(void *data)
-{
-   if (!data)
-      return 0;
-   return (void*)(uintptr_t)(((struct XDR_StructDefinition*)data)->type);
-}
-
-static int xdr_struct_cmp_key(void *key1, void *key2)
-{
-   if ( ((uintptr_t)key1) == ((uintptr_t)key2) )
-      return 1;
-   return 0;
-}
+// Looked up for every received packet, so lookups go through a lock-free
+//  snapshot of the registry
+static struct FrozenTable structTable = FT_INITIALIZER;
+static int cleanup_reg = 0;
 
 static void XDR_cleanup(void)
 {
-   if (structHash)
-      HASH_free_table(structHash);
-   structHash = NULL;
+   FT_clear(&structTable);
 }
 
 void XDR_register_struct(struct XDR_StructDefinition *def)
@@ -48,15 +30,11 @@ void XDR_register_struct(struct XDR_StructDefinition *def)
    if (!def)
       return;
 
-   if (!structHash) {
-      structHash = HASH_create_table(37, &xdr_struct_hash_func,
-            &xdr_struct_cmp_key, &xdr_struct_key_for_data);
-      if (!structHash)
-         return;
+   if (!cleanup_reg)
       atexit(&XDR_cleanup);
-   }
+   cleanup_reg = 1;
 
-   HASH_add_data(structHash, def);
+   FT_insert(&structTable, def->type, def, 0);
 }
 
 void XDR_register_structs(struct XDR_StructDefinition *structs)
@@ -1770,10 +1748,7 @@ void XDR_print_fields_func(FILE *out, void *data_void, void *arg,
 
 struct XDR_StructDefinition *XDR_definition_for_type(uint32_t type)
 {
-   if (structHash)
-      return (struct XDR_StructDefinition *)
-         HASH_find_key(structHash, (void*)(uintptr_t)type);
-   return NULL;
+   return (struct XDR_StructDefinition *)FT_find(&structTable, type);
 }
 
 void XDR_free_union(struct XDR_Union *goner)